@@ -111,6 +111,17 @@ int set_and_save_configuration(uint8_t odrive_num, uint8_t axis_num) {
 }
 
 
+// Maps the values that are printed in loop() onto registers 0..2
+bool configure_feedback_registers(uint8_t odrive_num, uint8_t axis_num) {
+  const uint16_t endpoint_ids[] = {
+    (uint16_t)(odrive::AXIS__ENCODER__POS_ESTIMATE + axis_num * odrive::per_axis_offset),
+    (uint16_t)(odrive::AXIS__MOTOR__CURRENT_CONTROL__IQ_MEASURED + axis_num * odrive::per_axis_offset),
+    odrive::VBUS_VOLTAGE
+  };
+  return odrive::configure_registers(odrive_num, endpoint_ids, sizeof(endpoint_ids) / sizeof(endpoint_ids[0]));
+}
+
+
 byte odrive_num = 7;
 byte axis_num = 0;
 bool do_setup = true;
@@ -132,6 +143,9 @@ void setup() {
     Serial.println("ODrive setup succeeded!");
     do_setup = false;
   }
+
+  if (!configure_feedback_registers(odrive_num, axis_num))
+    Serial.println("could not configure the register map");
 }
 
 
@@ -185,13 +199,18 @@ void loop() {
     return;
   }
 
-  // print Vbus to show liveness
-  float vbus;
-  success = odrive::read_property<odrive::VBUS_VOLTAGE>(odrive_num, &vbus);
+  // print position, current and Vbus to show liveness. All three values are
+  // read in a single I2C transaction.
+  uint8_t registers[12];
+  success = odrive::read_registers(odrive_num, 0, registers, sizeof(registers));
   if (!success) {
     Serial.println("error");
     return;
   }
-  Serial.println(vbus);
+  Serial.print(odrive::read_le<float>(registers));
+  Serial.print(" ");
+  Serial.print(odrive::read_le<float>(registers + 4));
+  Serial.print(" ");
+  Serial.println(odrive::read_le<float>(registers + 8));
 }
 
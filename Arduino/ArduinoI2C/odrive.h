@@ -6,6 +6,8 @@
 *   - Use read_property<PropertyId>() to read properties from the ODrive.
 *   - Use write_property<PropertyId>() to modify properties on the ODrive.
 *   - Use trigger<PropertyId>() to trigger a function (such as reboot or save_configuration)
+*   - Use configure_registers() and read_registers()/write_registers() to
+*     access several properties in a single I2C transaction.
 *   - Use endpoint_type_t<PropertyId> to retrieve the underlying type
 *     of a given property.
 *   - Refer to PropertyId for a list of available properties.
@@ -164,6 +166,63 @@ namespace odrive {
         return I2C_transaction(i2c_addr + num, i2c_tx_buffer, sizeof(i2c_tx_buffer), nullptr, 0);
     }
 
+    /* @brief Maps a list of endpoints onto consecutive registers.
+    * Register i then holds the value of endpoint_ids[i] in little endian
+    * encoding. Axis specific endpoints must include the axis offset
+    * (IPropertyId + axis * per_axis_offset).
+    *
+    * Usage example:
+    *   const uint16_t ids[] = {odrive::AXIS__ENCODER__POS_ESTIMATE, odrive::VBUS_VOLTAGE};
+    *   success = odrive::configure_registers(0, ids, 2);
+    *
+    * @param count Number of endpoints. With the 32 byte buffer of the AVR
+    * Wire library at most 14 endpoints can be configured in one call.
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool configure_registers(uint8_t num, const uint16_t* endpoint_ids, size_t count) {
+        uint8_t i2c_tx_buffer[4 + 2 * 32];
+        if (count > 32)
+            return false;
+        write_le<uint16_t>(i2c_tx_buffer, 0xffff);
+        write_le<uint16_t>(i2c_tx_buffer + 2, json_crc);
+        for (size_t i = 0; i < count; ++i)
+            write_le<uint16_t>(i2c_tx_buffer + 4 + 2 * i, endpoint_ids[i]);
+        return I2C_transaction(i2c_addr + num, i2c_tx_buffer, 4 + 2 * count, nullptr, 0);
+    }
+
+    /* @brief Reads the values of consecutive registers in one transaction.
+    * The values are packed back to back in the order in which the registers
+    * were configured. Bytes beyond the end of the map read as 0xff.
+    *
+    * Usage example:
+    *   uint8_t buffer[8];
+    *   success = odrive::read_registers(0, 0, buffer, sizeof(buffer));
+    *   float pos = odrive::read_le<float>(buffer);
+    *   float vbus = odrive::read_le<float>(buffer + 4);
+    *
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool read_registers(uint8_t num, uint16_t first_register, uint8_t* buffer, size_t length) {
+        uint8_t i2c_tx_buffer[2];
+        write_le<uint16_t>(i2c_tx_buffer, 0x8000 | first_register);
+        return I2C_transaction(i2c_addr + num, i2c_tx_buffer, sizeof(i2c_tx_buffer), buffer, length);
+    }
+
+    /* @brief Writes the values of consecutive registers in one transaction.
+    * buffer holds the values packed back to back in little endian encoding.
+    *
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool write_registers(uint8_t num, uint16_t first_register, const uint8_t* buffer, size_t length) {
+        uint8_t i2c_tx_buffer[2 + 30];
+        if (length > 30)
+            return false;
+        write_le<uint16_t>(i2c_tx_buffer, 0x8000 | first_register);
+        for (size_t i = 0; i < length; ++i)
+            i2c_tx_buffer[2 + i] = buffer[i];
+        return I2C_transaction(i2c_addr + num, i2c_tx_buffer, 2 + length, nullptr, 0);
+    }
+
     template<int IPropertyId>
     bool read_axis_property(uint8_t num, uint8_t axis, endpoint_type_t<IPropertyId>* value) {
         return read_property<IPropertyId>(num, value, IPropertyId + axis * per_axis_offset);
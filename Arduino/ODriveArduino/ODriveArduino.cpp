@@ -46,6 +46,14 @@ void ODriveArduino::TrapezoidalMove(int motor_number, float position){
     serial_ << "t " << motor_number << " " << position << "\n";
 }
 
+void ODriveArduino::StartFeedbackStream(float rate, const char* axes, const char* fields) {
+    serial_ << "fs " << rate << " " << axes << " " << fields << "\n";
+}
+
+void ODriveArduino::StopFeedbackStream() {
+    serial_ << "fs 0\n";
+}
+
 float ODriveArduino::readFloat() {
     return readString().toFloat();
 }
@@ -59,6 +67,19 @@ int32_t ODriveArduino::readInt() {
     return readString().toInt();
 }
 
+int ODriveArduino::readFeedback(uint32_t* timestamp, float* values, int max_values) {
+    String line = readString();
+    if (!line.startsWith("F "))
+        return 0;
+    char* ptr = const_cast<char*>(line.c_str()) + 2;
+    *timestamp = strtoul(ptr, &ptr, 10);
+    int n_values = 0;
+    while (n_values < max_values && *ptr == ' ') {
+        values[n_values++] = (float)strtod(ptr, &ptr);
+    }
+    return n_values;
+}
+
 bool ODriveArduino::run_state(int axis, int requested_state, bool wait_for_idle, float timeout) {
     int timeout_ctr = (int)(timeout * 10.0f);
     serial_ << "w axis" << axis << ".requested_state " << requested_state << '\n';
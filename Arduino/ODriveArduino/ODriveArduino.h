@@ -28,11 +28,15 @@ public:
     void SetVelocity(int motor_number, float velocity, float current_feedforward);
     void SetCurrent(int motor_number, float current);
     void TrapezoidalMove(int motor_number, float position);
+    void StartFeedbackStream(float rate, const char* axes = "01", const char* fields = "pv");
+    void StopFeedbackStream();
     // Getters
     float GetVelocity(int motor_number);
     // General params
     float readFloat();
     int32_t readInt();
+    // Reads the next line of an active feedback stream. Returns the number of values read.
+    int readFeedback(uint32_t* timestamp, float* values, int max_values);
 
     // State helper
     bool run_state(int axis, int requested_state, bool wait_for_idle, float timeout = 10.0f);
@@ -110,13 +110,15 @@ void loop() {
     if (c == 'p') {
       static const unsigned long duration = 10000;
       unsigned long start = millis();
+      // The ODrive sends the positions of both motors 20 times per second
+      odrive.StartFeedbackStream(20.0f, "01", "p");
       while(millis() - start < duration) {
-        for (int motor = 0; motor < 2; ++motor) {
-          odrive_serial << "r axis" << motor << ".encoder.pos_estimate\n";
-          Serial << odrive.readFloat() << '\t';
-        }
-        Serial << '\n';
+        uint32_t timestamp;
+        float positions[2];
+        if (odrive.readFeedback(&timestamp, positions, 2) == 2)
+          Serial << positions[0] << '\t' << positions[1] << '\n';
       }
+      odrive.StopFeedbackStream();
     }
   }
 }
@@ -82,6 +82,9 @@
 #define USB_TX_DATA_SIZE  64
 #define APP_RX_DATA_SIZE  USB_RX_DATA_SIZE
 #define APP_TX_DATA_SIZE  USB_TX_DATA_SIZE
+/* The native interface sends fibre packets of up to this size as a single
+   multi-packet bulk transfer (terminated by a short packet or ZLP) */
+#define USB_NATIVE_TX_DATA_SIZE  512
 /* USER CODE END EXPORTED_DEFINES */
 
 /**
@@ -39,6 +39,7 @@
 
 /* USER CODE BEGIN 0 */
 #include <Drivers/STM32/stm32_system.h>
+#include <communication/interface_uart.h>
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
@@ -359,7 +360,8 @@ void CAN1_SCE_IRQHandler(void)
 void USART2_IRQHandler(void)
 {
   /* USER CODE BEGIN USART2_IRQn 0 */
-
+  COUNT_IRQ(USART2_IRQn);
+  uart_irq_handler(&huart2);
   /* USER CODE END USART2_IRQn 0 */
   HAL_UART_IRQHandler(&huart2);
   /* USER CODE BEGIN USART2_IRQn 1 */
@@ -403,6 +405,7 @@ void UART4_IRQHandler(void)
 {
   /* USER CODE BEGIN UART4_IRQn 0 */
   COUNT_IRQ(UART4_IRQn);
+  uart_irq_handler(&huart4);
   /* USER CODE END UART4_IRQn 0 */
   HAL_UART_IRQHandler(&huart4);
   /* USER CODE BEGIN UART4_IRQn 1 */
@@ -122,7 +122,7 @@ uint8_t ODRIVERxBufferFS[APP_RX_DATA_SIZE];
 
 /** Data to send over USB CDC are stored in this buffer   */
 uint8_t CDCTxBufferFS[APP_TX_DATA_SIZE];
-uint8_t ODRIVETxBufferFS[APP_TX_DATA_SIZE];
+uint8_t ODRIVETxBufferFS[USB_NATIVE_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
 /* USER CODE END PRIVATE_VARIABLES */
@@ -315,25 +315,28 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len, uint8_t endpoint_pair)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
-  //Check length
-  if (Len > USB_TX_DATA_SIZE)
-    return USBD_FAIL;
-
   USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*) hUsbDeviceFS.pClassData;
 
   // Select EP
   USBD_CDC_EP_HandleTypeDef* hEP_Tx;
   uint8_t* TxBuff;
+  uint16_t TxBuffSize;
   if (endpoint_pair == CDC_OUT_EP) {
     hEP_Tx = &hcdc->CDC_Tx;
     TxBuff = CDCTxBufferFS;
+    TxBuffSize = sizeof(CDCTxBufferFS);
   } else if (endpoint_pair == ODRIVE_OUT_EP) {
     hEP_Tx = &hcdc->ODRIVE_Tx;
     TxBuff = ODRIVETxBufferFS;
+    TxBuffSize = sizeof(ODRIVETxBufferFS);
   } else {
     return USBD_FAIL;
   }
 
+  //Check length
+  if (Len > TxBuffSize)
+    return USBD_FAIL;
+
   // Check for ongoing transmission
   if (hEP_Tx->State != 0)
       return USBD_BUSY;
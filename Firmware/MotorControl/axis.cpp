@@ -273,17 +273,27 @@ bool Axis::start_closed_loop_control() {
             controller_.pos_estimate_circular_src_.disconnect();
             controller_.pos_wrap_src_.disconnect();
             controller_.vel_estimate_src_.connect_to(&sensorless_estimator_.vel_estimate_);
+            controller_.load_fusion_.stop();
         } else if (controller_.config_.load_encoder_axis < AXIS_COUNT) {
             Axis* ax = &axes[controller_.config_.load_encoder_axis];
             controller_.pos_estimate_circular_src_.connect_to(&ax->encoder_.pos_circular_);
             controller_.pos_wrap_src_.connect_to(&controller_.config_.circular_setpoint_range);
             controller_.pos_estimate_linear_src_.connect_to(&ax->encoder_.pos_estimate_);
-            controller_.vel_estimate_src_.connect_to(&ax->encoder_.vel_estimate_);
+            if (controller_.config_.enable_load_encoder_fusion) {
+                // Velocity loop runs on the motor encoder, the position loop
+                // on a fusion of both encoders
+                controller_.vel_estimate_src_.connect_to(&encoder_.vel_estimate_);
+                controller_.load_fusion_.start();
+            } else {
+                controller_.vel_estimate_src_.connect_to(&ax->encoder_.vel_estimate_);
+                controller_.load_fusion_.stop();
+            }
         } else {
             controller_.pos_estimate_circular_src_.disconnect();
             controller_.pos_estimate_linear_src_.disconnect();
             controller_.pos_wrap_src_.disconnect();
             controller_.vel_estimate_src_.disconnect();
+            controller_.load_fusion_.stop();
             controller_.set_error(Controller::ERROR_INVALID_LOAD_ENCODER);
             return false;
         }
@@ -43,6 +43,35 @@ void Controller::move_incremental(float displacement, bool from_input_pos = true
     input_pos_updated();
 }
 
+// @brief Queues a setpoint that is applied in the first control loop iteration
+// whose timestamp is at or after the given timestamp.
+// Fails if the queue is full or if that iteration has already started.
+bool Controller::schedule_input(uint32_t timestamp, float input_pos, float input_vel, float input_torque) {
+    bool result = false;
+    CRITICAL_SECTION() {
+        result = input_schedule_.push({timestamp, input_pos, input_vel, input_torque}, odrv.last_update_timestamp_);
+    }
+    return result;
+}
+
+void Controller::clear_input_schedule() {
+    CRITICAL_SECTION() {
+        input_schedule_.clear();
+    }
+}
+
+// @brief Applies the scheduled setpoints that are due in this control loop
+// iteration. Called from the control loop before the axes are updated.
+void Controller::apply_scheduled_input(uint32_t timestamp) {
+    SetpointSchedule::Entry entry;
+    while (input_schedule_.pop_due(timestamp, &entry)) {
+        input_pos_ = entry.input_pos;
+        input_vel_ = entry.input_vel;
+        input_torque_ = entry.input_torque;
+        input_pos_updated();
+    }
+}
+
 void Controller::start_anticogging_calibration() {
     // Ensure the cogging map was correctly allocated earlier and that the motor is capable of calibrating
     if (axis_->error_ == Axis::ERROR_NONE) {
@@ -105,6 +134,14 @@ bool Controller::update() {
     std::optional<float> anticogging_pos_estimate = axis_->encoder_.pos_estimate_.present();
     std::optional<float> anticogging_vel_estimate = axis_->encoder_.vel_estimate_.present();
 
+    if (load_fusion_.is_active()) {
+        // In fused mode pos_estimate_*_src_ is the load encoder and
+        // vel_estimate_src_ is the motor encoder (see Axis::start_closed_loop_control).
+        load_fusion_.update(current_meas_period, config_.load_encoder_ratio, config_.load_fusion_bandwidth,
+                            axis_->encoder_.pos_estimate_.present(),
+                            &pos_estimate_linear, &pos_estimate_circular, pos_wrap, &vel_estimate);
+    }
+
     if (config_.anticogging.calib_anticogging) {
         if (!anticogging_pos_estimate.has_value() || !anticogging_vel_estimate.has_value()) {
             set_error(ERROR_INVALID_ESTIMATE);
@@ -1,6 +1,9 @@
 #ifndef __CONTROLLER_HPP
 #define __CONTROLLER_HPP
 
+#include "load_encoder_fusion.hpp"
+#include "setpoint_schedule.hpp"
+
 class Controller : public ODriveIntf::ControllerIntf {
 public:
     typedef struct {
@@ -39,6 +42,9 @@ public:
         uint8_t axis_to_mirror = -1;
         float mirror_ratio = 1.0f;
         uint8_t load_encoder_axis = -1;  // default depends on Axis number and is set in load_configuration(). Set to -1 to select sensorless estimator.
+        bool enable_load_encoder_fusion = false; // position loop on load encoder, velocity loop on motor encoder
+        float load_encoder_ratio = 1.0f;         // [load turn / motor turn]
+        float load_fusion_bandwidth = 20.0f;     // [rad/s] crossover between motor and load encoder
 
         // custom setters
         Controller* parent;
@@ -61,6 +67,11 @@ public:
     // Trajectory-Planned control
     void move_to_pos(float goal_point);
     void move_incremental(float displacement, bool from_goal_point);
+
+    // Time-triggered setpoints
+    bool schedule_input(uint32_t timestamp, float input_pos, float input_vel, float input_torque);
+    void clear_input_schedule();
+    void apply_scheduled_input(uint32_t timestamp);
     
     // TODO: make this more similar to other calibration loops
     void start_anticogging_calibration();
@@ -93,11 +104,15 @@ public:
     float input_filter_ki_ = 0.0f;
 
     bool input_pos_updated_ = false;
+
+    SetpointSchedule input_schedule_;
     
     bool trajectory_done_ = true;
 
     bool anticogging_valid_ = false;
 
+    LoadEncoderFusion load_fusion_; // started by Axis::start_closed_loop_control()
+
     // Outputs
     OutputPort<float> torque_output_ = 0.0f;
 
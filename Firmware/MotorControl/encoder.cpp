@@ -1,14 +1,207 @@
 
 #include "odrive_main.h"
+#include "encoder_decoders.hpp"
 #include <Drivers/STM32/stm32_system.h>
 #include <bitset>
 
+//--------------------
+// Backends
+//--------------------
+
+class IncrementalBackend : public Encoder::Backend {
+public:
+    void sample_now(Encoder& encoder) final {
+        encoder.tim_cnt_sample_ = (int16_t)encoder.timer_->Instance->CNT;
+    }
+
+    Result decode(Encoder& encoder, int32_t* delta_enc) final {
+        //TODO: use count_in_cpr_ instead as shadow_count_ can overflow
+        //or use 64 bit
+        int16_t delta_enc_16 = (int16_t)encoder.tim_cnt_sample_ - (int16_t)encoder.shadow_count_;
+        *delta_enc = (int32_t)delta_enc_16; //sign extend
+        return RESULT_OK;
+    }
+};
+
+class HallBackend : public Encoder::Backend {
+public:
+    void sample_now(Encoder& encoder) final {
+        // do nothing: samples already captured in general GPIO capture
+    }
+
+    Result decode(Encoder& encoder, int32_t* delta_enc) final;
+
+    int32_t model(Encoder& encoder, float internal_pos) final {
+        return encoder.hall_model(internal_pos);
+    }
+};
+
+class SincosBackend : public Encoder::Backend {
+public:
+    void sample_now(Encoder& encoder) final {
+        encoder.sincos_sample_s_ = get_adc_relative_voltage(get_gpio(encoder.config_.sincos_gpio_pin_sin)) - 0.5f;
+        encoder.sincos_sample_c_ = get_adc_relative_voltage(get_gpio(encoder.config_.sincos_gpio_pin_cos)) - 0.5f;
+    }
+
+    Result decode(Encoder& encoder, int32_t* delta_enc) final {
+        float phase = fast_atan2(encoder.sincos_sample_s_, encoder.sincos_sample_c_);
+        int fake_count = (int)(1000.0f * phase);
+        //CPR = 6283 = 2pi * 1k
+
+        *delta_enc = fake_count - encoder.count_in_cpr_;
+        *delta_enc = mod(*delta_enc, 6283);
+        if (*delta_enc > 6283/2)
+            *delta_enc -= 6283;
+        return RESULT_OK;
+    }
+};
+
+/**
+ * @brief Common part of all absolute SPI encoders. The position is updated
+ * asynchronously by the SPI completion callback.
+ */
+class AbsSpiBackendBase : public Encoder::Backend {
+public:
+    Result decode(Encoder& encoder, int32_t* delta_enc) override {
+        if (encoder.abs_spi_pos_updated_ == false) {
+            // Low pass filter the error
+            encoder.spi_error_rate_ += current_meas_period * (1.0f - encoder.spi_error_rate_);
+            if (encoder.spi_error_rate_ > 0.005f) {
+                encoder.set_error(Encoder::ERROR_ABS_SPI_COM_FAIL);
+                return RESULT_ERROR;
+            }
+        } else {
+            // Low pass filter the error
+            encoder.spi_error_rate_ += current_meas_period * (0.0f - encoder.spi_error_rate_);
+        }
+
+        encoder.abs_spi_pos_updated_ = false;
+        *delta_enc = encoder.pos_abs_ - encoder.count_in_cpr_; //LATCH
+        *delta_enc = mod(*delta_enc, encoder.config_.cpr);
+        if (*delta_enc > encoder.config_.cpr/2) {
+            *delta_enc -= encoder.config_.cpr;
+        }
+        return RESULT_OK;
+    }
+};
+
+/**
+ * @brief Absolute encoder that sends its position as a single 16-bit SPI frame.
+ * The frame format is fixed at compile time by the decode function.
+ */
+template<bool (*decode_frame)(uint16_t raw, uint16_t* pos)>
+class AbsSpiBackend : public AbsSpiBackendBase {
+public:
+    void sample_now(Encoder& encoder) final {
+        encoder.abs_spi_start_transaction(encoder.abs_spi_dma_tx_, encoder.abs_spi_dma_rx_, 1, &on_complete);
+    }
+
+    static void on_complete(void* ctx, bool success) {
+        Encoder* encoder = (Encoder*)ctx;
+        uint16_t pos = 0;
+        success = success && decode_frame(encoder->abs_spi_dma_rx_[0], &pos);
+        encoder->abs_spi_cb(success, pos);
+    }
+};
+
+static bool decode_ssi(const Encoder::Config_t& config, const uint8_t* buf, size_t n_bits, AbsEncoderFrame* frame) {
+    return decode_ssi_frame(buf, n_bits, config.abs_mt_bits, config.abs_st_bits, config.abs_ssi_gray_code, frame);
+}
+
+static bool decode_biss_c(const Encoder::Config_t& config, const uint8_t* buf, size_t n_bits, AbsEncoderFrame* frame) {
+    return decode_biss_c_frame(buf, n_bits, config.abs_mt_bits, config.abs_st_bits, frame);
+}
+
+/**
+ * @brief Bit-serial absolute encoder (SSI, BiSS-C) that is clocked out as a
+ * sequence of abs_frame_bytes_ 8-bit SPI frames.
+ */
+template<bool (*decode_frame)(const Encoder::Config_t& config, const uint8_t* buf, size_t n_bits, AbsEncoderFrame* frame)>
+class AbsSpiBitstreamBackend : public AbsSpiBackendBase {
+public:
+    void sample_now(Encoder& encoder) final {
+        encoder.abs_spi_start_transaction(encoder.abs_frame_dma_tx_, encoder.abs_frame_dma_rx_,
+                                          encoder.abs_frame_bytes_, &on_complete);
+    }
+
+    Result decode(Encoder& encoder, int32_t* delta_enc) final {
+        bool pos_updated = encoder.abs_spi_pos_updated_;
+        Result result = AbsSpiBackendBase::decode(encoder, delta_enc);
+
+        // On the first valid frame jump to the absolute multi-turn position
+        // instead of tracking it from zero.
+        if (result == RESULT_OK && pos_updated && !encoder.abs_multi_turn_synced_) {
+            int32_t count = abs_encoder_count(encoder.abs_multi_turn_, encoder.pos_abs_,
+                                              encoder.config_.abs_mt_bits, encoder.config_.abs_st_bits);
+            encoder.shadow_count_ = count - *delta_enc;
+            encoder.pos_estimate_counts_ = (float)count;
+            encoder.abs_multi_turn_synced_ = true;
+        }
+        return result;
+    }
+
+    static void on_complete(void* ctx, bool success) {
+        Encoder* encoder = (Encoder*)ctx;
+        AbsEncoderFrame frame;
+        success = success && decode_frame(encoder->config_, encoder->abs_frame_dma_rx_,
+                                          encoder->abs_frame_bytes_ * 8, &frame);
+        if (success) {
+            encoder->abs_frame_error_ = frame.error;
+            encoder->abs_frame_warning_ = frame.warning;
+            encoder->abs_multi_turn_ = frame.multi_turn;
+        }
+        encoder->abs_spi_cb(success && !frame.error, frame.single_turn);
+    }
+};
+
+class UnsupportedBackend : public Encoder::Backend {
+public:
+    void sample_now(Encoder& encoder) final {
+        encoder.set_error(Encoder::ERROR_UNSUPPORTED_ENCODER_MODE);
+    }
+
+    Result decode(Encoder& encoder, int32_t* delta_enc) final {
+        encoder.set_error(Encoder::ERROR_UNSUPPORTED_ENCODER_MODE);
+        return RESULT_ERROR;
+    }
+};
+
+static IncrementalBackend incremental_backend;
+static HallBackend hall_backend;
+static SincosBackend sincos_backend;
+static AbsSpiBackend<decode_cui_frame> abs_spi_cui_backend;
+static AbsSpiBackend<decode_ams_frame> abs_spi_ams_backend;
+static AbsSpiBackend<decode_rls_frame> abs_spi_rls_backend;
+static AbsSpiBackend<decode_ma732_frame> abs_spi_ma732_backend;
+static AbsSpiBitstreamBackend<decode_ssi> abs_spi_ssi_backend;
+static AbsSpiBitstreamBackend<decode_biss_c> abs_spi_biss_c_backend;
+static UnsupportedBackend unsupported_backend;
+
+static Encoder::Backend* get_backend(Encoder::Mode mode) {
+    switch (mode) {
+        case Encoder::MODE_INCREMENTAL: return &incremental_backend;
+        case Encoder::MODE_HALL: return &hall_backend;
+        case Encoder::MODE_SINCOS: return &sincos_backend;
+        case Encoder::MODE_SPI_ABS_CUI: return &abs_spi_cui_backend;
+        case Encoder::MODE_SPI_ABS_AMS: return &abs_spi_ams_backend;
+        case Encoder::MODE_SPI_ABS_RLS: return &abs_spi_rls_backend;
+        case Encoder::MODE_SPI_ABS_MA732: return &abs_spi_ma732_backend;
+        case Encoder::MODE_SPI_ABS_SSI: return &abs_spi_ssi_backend;
+        case Encoder::MODE_SPI_ABS_BISS_C: return &abs_spi_biss_c_backend;
+        default: return &unsupported_backend; // includes MODE_SPI_ABS_AEAT (not yet implemented)
+    }
+}
+
+//--------------------
+// Encoder
+//--------------------
+
 Encoder::Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
                  Stm32Gpio hallA_gpio, Stm32Gpio hallB_gpio, Stm32Gpio hallC_gpio,
                  Stm32SpiArbiter* spi_arbiter) :
         timer_(timer), index_gpio_(index_gpio),
         hallA_gpio_(hallA_gpio), hallB_gpio_(hallB_gpio), hallC_gpio_(hallC_gpio),
-        spi_arbiter_(spi_arbiter)
+        spi_arbiter_(spi_arbiter), backend_(&incremental_backend)
 {
 }
 
@@ -19,6 +212,25 @@ static void enc_index_cb_wrapper(void* ctx) {
 bool Encoder::apply_config(ODriveIntf::MotorIntf::MotorType motor_type) {
     config_.parent = this;
 
+    // The mode can only change on reboot
+    mode_ = config_.mode;
+    backend_ = get_backend(mode_);
+
+    if (mode_ == MODE_SPI_ABS_SSI || mode_ == MODE_SPI_ABS_BISS_C) {
+        size_t n_bits = (mode_ == MODE_SPI_ABS_SSI) ?
+                ssi_frame_bits(config_.abs_mt_bits, config_.abs_st_bits) :
+                biss_c_frame_bits(config_.abs_mt_bits, config_.abs_st_bits);
+        abs_frame_bytes_ = (n_bits + 7) / 8;
+        if (abs_frame_bytes_ > ABS_FRAME_MAX_BYTES
+                || (size_t)config_.abs_mt_bits + config_.abs_st_bits > ABS_ENCODER_MAX_POSITION_BITS
+                || config_.cpr != ((int64_t)1 << config_.abs_st_bits)) {
+            set_error(ERROR_ABS_CONFIG_INVALID);
+            backend_ = &unsupported_backend;
+            abs_frame_bytes_ = 0;
+        }
+        std::fill_n(abs_frame_dma_tx_, ABS_FRAME_MAX_BYTES, 0xff);
+    }
+
     update_pll_gains();
 
     if (config_.pre_calibrated) {
@@ -37,14 +249,16 @@ void Encoder::setup() {
     HAL_TIM_Encoder_Start(timer_, TIM_CHANNEL_ALL);
     set_idx_subscribe();
 
-    mode_ = config_.mode;
+    bool is_bitstream = (mode_ == MODE_SPI_ABS_SSI || mode_ == MODE_SPI_ABS_BISS_C);
 
     spi_task_.config = {
         .Mode = SPI_MODE_MASTER,
         .Direction = SPI_DIRECTION_2LINES,
-        .DataSize = SPI_DATASIZE_16BIT,
-        .CLKPolarity = (mode_ == MODE_SPI_ABS_AEAT || mode_ == MODE_SPI_ABS_MA732) ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
-        .CLKPhase = SPI_PHASE_2EDGE,
+        .DataSize = is_bitstream ? SPI_DATASIZE_8BIT : SPI_DATASIZE_16BIT,
+        .CLKPolarity = (mode_ == MODE_SPI_ABS_AEAT || mode_ == MODE_SPI_ABS_MA732 || is_bitstream) ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
+        // SSI/BiSS-C: the encoder latches on the first falling clock edge and
+        // shifts out on rising edges so we sample on falling edges.
+        .CLKPhase = is_bitstream ? SPI_PHASE_1EDGE : SPI_PHASE_2EDGE,
         .NSS = SPI_NSS_SOFT,
         .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_32,
         .FirstBit = SPI_FIRSTBIT_MSB,
@@ -117,15 +331,24 @@ void Encoder::set_idx_subscribe(bool override_enable) {
 }
 
 void Encoder::update_pll_gains() {
-    pll_kp_ = 2.0f * config_.bandwidth;  // basic conversion to discrete time
-    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+    set_pll_bandwidth(config_.bandwidth);
+
+    float max_bandwidth = config_.enable_bandwidth_scheduling ?
+            std::max(config_.bandwidth, config_.bandwidth_high) : config_.bandwidth;
 
     // Check that we don't get problems with discrete time approximation
-    if (!(current_meas_period * pll_kp_ < 1.0f)) {
+    if (!(current_meas_period * 2.0f * max_bandwidth < 1.0f)) {
         set_error(ERROR_UNSTABLE_GAIN);
     }
 }
 
+// Cheap enough to be called on every control loop iteration
+void Encoder::set_pll_bandwidth(float bandwidth) {
+    pll_bandwidth_ = bandwidth;
+    pll_kp_ = 2.0f * bandwidth;  // basic conversion to discrete time
+    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+}
+
 void Encoder::check_pre_calibrated() {
     // TODO: restoring config from python backup is fragile here (ACIM motor type must be set first)
     if (!is_ready_ && axis_->motor_.config_.motor_type != Motor::MOTOR_TYPE_ACIM)
@@ -385,9 +608,21 @@ bool Encoder::run_offset_calibration() {
     }
 
 
+    // Fit the encoder count against the open loop electrical phase over a
+    // forward and a backward scan. The phase is measured relative to the
+    // center of the scan, which is where the electrical phase is zero.
+    // Both scans share the slope (direction and CPR) but the rotor lags
+    // behind the open loop phase in opposite directions, so each scan gets
+    // its own intercept and the offset is the mean of the two. The residual
+    // tells how well the rotor followed the phase apart from that lag.
     int32_t init_enc_val = shadow_count_;
-    uint32_t num_steps = 0;
-    int64_t encvaluesum = 0;
+    float half_distance = config_.calib_scan_distance / 2.0f;
+    LinearFit forward_fit, backward_fit;
+
+    auto add_sample = [&](LinearFit& fit) {
+        float distance = axis_->open_loop_controller_.total_distance_.any().value_or(0.0f);
+        fit.add(distance - half_distance, (float)(shadow_count_ - init_enc_val));
+    };
 
     CRITICAL_SECTION() {
         axis_->open_loop_controller_.target_vel_ = config_.calib_scan_omega;
@@ -400,35 +635,10 @@ bool Encoder::run_offset_calibration() {
         if (reached_target_dist) {
             break;
         }
-        encvaluesum += shadow_count_;
-        num_steps++;
+        add_sample(forward_fit);
         osDelay(1);
     }
 
-    // Check response and direction
-    if (shadow_count_ > init_enc_val + 8) {
-        // motor same dir as encoder
-        config_.direction = 1;
-    } else if (shadow_count_ < init_enc_val - 8) {
-        // motor opposite dir as encoder
-        config_.direction = -1;
-    } else {
-        // Encoder response error
-        set_error(ERROR_NO_RESPONSE);
-        axis_->motor_.disarm();
-        return false;
-    }
-
-    // Check CPR
-    float elec_rad_per_enc = axis_->motor_.config_.pole_pairs * 2 * M_PI * (1.0f / (float)(config_.cpr));
-    float expected_encoder_delta = config_.calib_scan_distance / elec_rad_per_enc;
-    calib_scan_response_ = std::abs(shadow_count_ - init_enc_val);
-    if (std::abs(calib_scan_response_ - expected_encoder_delta) / expected_encoder_delta > config_.calib_range) {
-        set_error(ERROR_CPR_POLEPAIRS_MISMATCH);
-        axis_->motor_.disarm();
-        return false;
-    }
-
     CRITICAL_SECTION() {
         axis_->open_loop_controller_.target_vel_ = -config_.calib_scan_omega;
     }
@@ -439,8 +649,7 @@ bool Encoder::run_offset_calibration() {
         if (reached_target_dist) {
             break;
         }
-        encvaluesum += shadow_count_;
-        num_steps++;
+        add_sample(backward_fit);
         osDelay(1);
     }
 
@@ -451,55 +660,52 @@ bool Encoder::run_offset_calibration() {
 
     axis_->motor_.disarm();
 
-    config_.phase_offset = encvaluesum / num_steps;
-    int32_t residual = encvaluesum - ((int64_t)config_.phase_offset * (int64_t)num_steps);
-    config_.phase_offset_float = (float)residual / (float)num_steps + 0.5f;  // add 0.5 to center-align state to phase
+    float forward_offset, backward_offset, slope, residual;
+    if (!LinearFit::solve_common_slope(forward_fit, backward_fit,
+            &forward_offset, &backward_offset, &slope, &residual)) {
+        set_error(ERROR_NO_RESPONSE);
+        return false;
+    }
 
-    is_ready_ = true;
-    return true;
-}
+    // Check response and direction
+    calib_scan_response_ = std::abs(slope) * config_.calib_scan_distance;
+    if (calib_scan_response_ <= 8.0f) {
+        // Encoder response error
+        set_error(ERROR_NO_RESPONSE);
+        return false;
+    }
+    config_.direction = slope > 0.0f ? 1 : -1;
 
-static bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
-    switch (hall_state) {
-        case 0b001: *hall_cnt = 0; return true;
-        case 0b011: *hall_cnt = 1; return true;
-        case 0b010: *hall_cnt = 2; return true;
-        case 0b110: *hall_cnt = 3; return true;
-        case 0b100: *hall_cnt = 4; return true;
-        case 0b101: *hall_cnt = 5; return true;
-        default: return false;
+    // Check CPR
+    float elec_rad_per_enc = axis_->motor_.config_.pole_pairs * 2 * M_PI * (1.0f / (float)(config_.cpr));
+    float expected_encoder_delta = config_.calib_scan_distance / elec_rad_per_enc;
+    if (std::abs(calib_scan_response_ - expected_encoder_delta) / expected_encoder_delta > config_.calib_range) {
+        set_error(ERROR_CPR_POLEPAIRS_MISMATCH);
+        return false;
+    }
+
+    // Check fit quality. Even a perfect scan has a residual of one count
+    // divided by sqrt(12) due to quantization, which is a lot for coarse
+    // encoders such as hall sensors (0.3 rad).
+    calib_fit_residual_ = residual * elec_rad_per_enc;
+    float quantization_residual = elec_rad_per_enc / std::sqrt(12.0f);
+    float max_residual = std::sqrt(config_.calib_max_residual * config_.calib_max_residual
+                                   + quantization_residual * quantization_residual);
+    if (calib_fit_residual_ > max_residual) {
+        set_error(ERROR_CALIB_RESIDUAL_TOO_HIGH);
+        return false;
     }
+
+    float phase_offset = (float)init_enc_val + (forward_offset + backward_offset) / 2.0f;
+    config_.phase_offset = (int32_t)std::floor(phase_offset);
+    config_.phase_offset_float = (phase_offset - (float)config_.phase_offset) + 0.5f;  // add 0.5 to center-align state to phase
+
+    is_ready_ = true;
+    return true;
 }
 
 void Encoder::sample_now() {
-    switch (mode_) {
-        case MODE_INCREMENTAL: {
-            tim_cnt_sample_ = (int16_t)timer_->Instance->CNT;
-        } break;
-
-        case MODE_HALL: {
-            // do nothing: samples already captured in general GPIO capture
-        } break;
-
-        case MODE_SINCOS: {
-            sincos_sample_s_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_sin)) - 0.5f;
-            sincos_sample_c_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_cos)) - 0.5f;
-        } break;
-
-        case MODE_SPI_ABS_AMS:
-        case MODE_SPI_ABS_CUI:
-        case MODE_SPI_ABS_AEAT:
-        case MODE_SPI_ABS_RLS:
-        case MODE_SPI_ABS_MA732:
-        {
-            abs_spi_start_transaction();
-            // Do nothing
-        } break;
-
-        default: {
-           set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
-        } break;
-    }
+    backend_->sample_now(*this);
 
     // Sample all GPIO digital input data registers, used for HALL sensors for example.
     for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
@@ -522,89 +728,32 @@ void Encoder::decode_hall_samples() {
                 | (read_sampled_gpio(hallC_gpio_) ? 4 : 0);
 }
 
-bool Encoder::abs_spi_start_transaction() {
-    if (mode_ & MODE_FLAG_ABS){
-        if (Stm32SpiArbiter::acquire_task(&spi_task_)) {
-            spi_task_.ncs_gpio = abs_spi_cs_gpio_;
-            spi_task_.tx_buf = (uint8_t*)abs_spi_dma_tx_;
-            spi_task_.rx_buf = (uint8_t*)abs_spi_dma_rx_;
-            spi_task_.length = 1;
-            spi_task_.on_complete = [](void* ctx, bool success) { ((Encoder*)ctx)->abs_spi_cb(success); };
-            spi_task_.on_complete_ctx = this;
-            spi_task_.next = nullptr;
-            
-            spi_arbiter_->transfer_async(&spi_task_);
-        } else {
-            return false;
-        }
+bool Encoder::abs_spi_start_transaction(const void* tx_buf, void* rx_buf, size_t length, void (*on_complete)(void*, bool)) {
+    if (Stm32SpiArbiter::acquire_task(&spi_task_)) {
+        spi_task_.ncs_gpio = abs_spi_cs_gpio_;
+        spi_task_.tx_buf = (const uint8_t*)tx_buf;
+        spi_task_.rx_buf = (uint8_t*)rx_buf;
+        spi_task_.length = length;
+        spi_task_.on_complete = on_complete;
+        spi_task_.on_complete_ctx = this;
+        spi_task_.next = nullptr;
+
+        spi_arbiter_->transfer_async(&spi_task_);
+        return true;
     }
-    return true;
-}
-
-uint8_t ams_parity(uint16_t v) {
-    v ^= v >> 8;
-    v ^= v >> 4;
-    v ^= v >> 2;
-    v ^= v >> 1;
-    return v & 1;
-}
-
-uint8_t cui_parity(uint16_t v) {
-    v ^= v >> 8;
-    v ^= v >> 4;
-    v ^= v >> 2;
-    return ~v & 3;
+    return false;
 }
 
-void Encoder::abs_spi_cb(bool success) {
-    uint16_t pos;
-
-    if (!success) {
-        goto done;
-    }
-
-    switch (mode_) {
-        case MODE_SPI_ABS_AMS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            // check if parity is correct (even) and error flag clear
-            if (ams_parity(rawVal) || ((rawVal >> 14) & 1)) {
-                goto done;
-            }
-            pos = rawVal & 0x3fff;
-        } break;
-
-        case MODE_SPI_ABS_CUI: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            // check if parity is correct
-            if (cui_parity(rawVal)) {
-                goto done;
-            }
-            pos = rawVal & 0x3fff;
-        } break;
-
-        case MODE_SPI_ABS_RLS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            pos = (rawVal >> 2) & 0x3fff;
-        } break;
-
-        case MODE_SPI_ABS_MA732: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            pos = (rawVal >> 2) & 0x3fff;
-        } break;
-
-        default: {
-           set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
-           goto done;
-        } break;
-    }
-
-    pos_abs_ = pos;
-    abs_spi_pos_updated_ = true;
-    if (config_.pre_calibrated) {
-        is_ready_ = true;
+// Called by the SPI backend once the received frame was decoded.
+void Encoder::abs_spi_cb(bool success, uint32_t pos) {
+    if (success) {
+        pos_abs_ = pos;
+        abs_spi_pos_updated_ = true;
+        if (config_.pre_calibrated) {
+            is_ready_ = true;
+        }
     }
 
-done:
     Stm32SpiArbiter::release_task(&spi_task_);
 }
 
@@ -645,141 +794,101 @@ int32_t Encoder::hall_model(float internal_pos) {
     return base_cnt;
 }
 
-bool Encoder::update() {
-    // update internal encoder state.
-    int32_t delta_enc = 0;
-    int32_t pos_abs_latched = pos_abs_; //LATCH
-
-    switch (mode_) {
-        case MODE_INCREMENTAL: {
-            //TODO: use count_in_cpr_ instead as shadow_count_ can overflow
-            //or use 64 bit
-            int16_t delta_enc_16 = (int16_t)tim_cnt_sample_ - (int16_t)shadow_count_;
-            delta_enc = (int32_t)delta_enc_16; //sign extend
-        } break;
-
-        case MODE_HALL: {
-            decode_hall_samples();
-            if (sample_hall_states_) {
-                states_seen_count_[hall_state_]++;
-            }
-            if (config_.hall_polarity_calibrated) {
-                int32_t hall_cnt;
-                if (decode_hall((hall_state_ ^ config_.hall_polarity), &hall_cnt)) {
-                    if (calibrate_hall_phase_) {
-                        if (sample_hall_phase_ && last_hall_cnt_.has_value()) {
-                            int mod_hall_cnt = mod(hall_cnt - last_hall_cnt_.value(), 6);
-                            size_t edge_idx;
-                            if (mod_hall_cnt == 0) { goto skip; } // no count - do nothing
-                            else if (mod_hall_cnt == 1) { // counted up
-                                edge_idx = hall_cnt;
-                            } else if (mod_hall_cnt == 5) { // counted down
-                                edge_idx = last_hall_cnt_.value();
-                            } else {
-                                set_error(ERROR_ILLEGAL_HALL_STATE);
-                                return false;
-                            }
-
-                            auto maybe_phase = axis_->open_loop_controller_.phase_.any();
-                            if (maybe_phase) {
-                                float phase = maybe_phase.value();
-                                // Early increment to get the right divisor in recursive average
-                                hall_phase_calib_seen_count_[edge_idx]++;
-                                float& edge_phase = config_.hall_edge_phcnt[edge_idx];
-                                if (hall_phase_calib_seen_count_[edge_idx] == 1)
-                                    edge_phase = phase;
-                                else {
-                                    // circularly wrapped recursive average
-                                    edge_phase += (phase - edge_phase) / hall_phase_calib_seen_count_[edge_idx];
-                                    edge_phase = wrap_pm_pi(edge_phase);
-                                }
-                            }
-                        }
-                    skip:
-                        last_hall_cnt_ = hall_cnt;
-
-                        return true; // Skip all velocity and phase estimation
-                    }
-
-                    delta_enc = hall_cnt - count_in_cpr_;
-                    delta_enc = mod(delta_enc, 6);
-                    if (delta_enc > 3)
-                        delta_enc -= 6;
-                } else {
-                    if (!config_.ignore_illegal_hall_state) {
-                        set_error(ERROR_ILLEGAL_HALL_STATE);
-                        return false;
-                    }
-                }
-            }
-        } break;
-
-        case MODE_SINCOS: {
-            float phase = fast_atan2(sincos_sample_s_, sincos_sample_c_);
-            int fake_count = (int)(1000.0f * phase);
-            //CPR = 6283 = 2pi * 1k
-
-            delta_enc = fake_count - count_in_cpr_;
-            delta_enc = mod(delta_enc, 6283);
-            if (delta_enc > 6283/2)
-                delta_enc -= 6283;
-        } break;
-        
-        case MODE_SPI_ABS_RLS:
-        case MODE_SPI_ABS_AMS:
-        case MODE_SPI_ABS_CUI: 
-        case MODE_SPI_ABS_AEAT:
-        case MODE_SPI_ABS_MA732: {
-            if (abs_spi_pos_updated_ == false) {
-                // Low pass filter the error
-                spi_error_rate_ += current_meas_period * (1.0f - spi_error_rate_);
-                if (spi_error_rate_ > 0.005f) {
-                    set_error(ERROR_ABS_SPI_COM_FAIL);
-                    return false;
-                }
+Encoder::Backend::Result HallBackend::decode(Encoder& encoder, int32_t* delta_enc) {
+    encoder.decode_hall_samples();
+    if (encoder.sample_hall_states_) {
+        encoder.states_seen_count_[encoder.hall_state_]++;
+    }
+    if (!encoder.config_.hall_polarity_calibrated) {
+        return RESULT_OK;
+    }
+
+    int32_t hall_cnt;
+    if (!decode_hall((encoder.hall_state_ ^ encoder.config_.hall_polarity), &hall_cnt)) {
+        if (!encoder.config_.ignore_illegal_hall_state) {
+            encoder.set_error(Encoder::ERROR_ILLEGAL_HALL_STATE);
+            return RESULT_ERROR;
+        }
+        return RESULT_OK;
+    }
+
+    if (encoder.calibrate_hall_phase_) {
+        if (encoder.sample_hall_phase_ && encoder.last_hall_cnt_.has_value()) {
+            int mod_hall_cnt = mod(hall_cnt - encoder.last_hall_cnt_.value(), 6);
+            size_t edge_idx;
+            if (mod_hall_cnt == 0) { goto skip; } // no count - do nothing
+            else if (mod_hall_cnt == 1) { // counted up
+                edge_idx = hall_cnt;
+            } else if (mod_hall_cnt == 5) { // counted down
+                edge_idx = encoder.last_hall_cnt_.value();
             } else {
-                // Low pass filter the error
-                spi_error_rate_ += current_meas_period * (0.0f - spi_error_rate_);
+                encoder.set_error(Encoder::ERROR_ILLEGAL_HALL_STATE);
+                return RESULT_ERROR;
             }
 
-            abs_spi_pos_updated_ = false;
-            delta_enc = pos_abs_latched - count_in_cpr_; //LATCH
-            delta_enc = mod(delta_enc, config_.cpr);
-            if (delta_enc > config_.cpr/2) {
-                delta_enc -= config_.cpr;
+            auto maybe_phase = encoder.axis_->open_loop_controller_.phase_.any();
+            if (maybe_phase) {
+                float phase = maybe_phase.value();
+                // Early increment to get the right divisor in recursive average
+                encoder.hall_phase_calib_seen_count_[edge_idx]++;
+                float& edge_phase = encoder.config_.hall_edge_phcnt[edge_idx];
+                if (encoder.hall_phase_calib_seen_count_[edge_idx] == 1)
+                    edge_phase = phase;
+                else {
+                    // circularly wrapped recursive average
+                    edge_phase += (phase - edge_phase) / encoder.hall_phase_calib_seen_count_[edge_idx];
+                    edge_phase = wrap_pm_pi(edge_phase);
+                }
             }
+        }
+    skip:
+        encoder.last_hall_cnt_ = hall_cnt;
 
-        }break;
-        default: {
-            set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
-            return false;
-        } break;
+        return RESULT_SKIP;
+    }
+
+    *delta_enc = hall_cnt - encoder.count_in_cpr_;
+    *delta_enc = mod(*delta_enc, 6);
+    if (*delta_enc > 3)
+        *delta_enc -= 6;
+    return RESULT_OK;
+}
+
+bool Encoder::update() {
+    // update internal encoder state.
+    int32_t delta_enc = 0;
+
+    switch (backend_->decode(*this, &delta_enc)) {
+        case Backend::RESULT_OK: break;
+        case Backend::RESULT_SKIP: return true; // Skip all velocity and phase estimation
+        default: return false;
     }
 
     shadow_count_ += delta_enc;
     count_in_cpr_ += delta_enc;
     count_in_cpr_ = mod(count_in_cpr_, config_.cpr);
 
-    if(mode_ & MODE_FLAG_ABS)
-        count_in_cpr_ = pos_abs_latched;
-
     // Memory for pos_circular
     float pos_cpr_counts_last = pos_cpr_counts_;
 
     //// run pll (for now pll is in units of encoder counts)
+    // Schedule the bandwidth between low and high speed based on the previous
+    // velocity estimate
+    if (config_.enable_bandwidth_scheduling) {
+        float vel = std::abs(vel_estimate_counts_) / (float)config_.cpr;
+        float vel_range = config_.bandwidth_vel_high - config_.bandwidth_vel_low;
+        float k = vel_range > 0.0f ? (vel - config_.bandwidth_vel_low) / vel_range
+                                   : (vel >= config_.bandwidth_vel_high ? 1.0f : 0.0f);
+        k = std::clamp(k, 0.0f, 1.0f);
+        set_pll_bandwidth(config_.bandwidth + k * (config_.bandwidth_high - config_.bandwidth));
+    }
+
     // Predict current pos
     pos_estimate_counts_ += current_meas_period * vel_estimate_counts_;
     pos_cpr_counts_      += current_meas_period * vel_estimate_counts_;
-    // Encoder model
-    auto encoder_model = [this](float internal_pos)->int32_t {
-        if (config_.mode == MODE_HALL)
-            return hall_model(internal_pos);
-        else
-            return (int32_t)std::floor(internal_pos);
-    };
-    // discrete phase detector
-    float delta_pos_counts = (float)(shadow_count_ - encoder_model(pos_estimate_counts_));
-    float delta_pos_cpr_counts = (float)(count_in_cpr_ - encoder_model(pos_cpr_counts_));
+    // discrete phase detector (the encoder model depends on the backend)
+    float delta_pos_counts = (float)(shadow_count_ - backend_->model(*this, pos_estimate_counts_));
+    float delta_pos_cpr_counts = (float)(count_in_cpr_ - backend_->model(*this, pos_cpr_counts_));
     delta_pos_cpr_counts = wrap_pm(delta_pos_cpr_counts, (float)(config_.cpr));
     delta_pos_cpr_counts_ += 0.1f * (delta_pos_cpr_counts - delta_pos_cpr_counts_); // for debug
     // pll feedback
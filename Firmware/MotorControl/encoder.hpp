@@ -13,6 +13,7 @@ class Encoder;
 class Encoder : public ODriveIntf::EncoderIntf {
 public:
     static constexpr uint32_t MODE_FLAG_ABS = 0x100;
+    static constexpr size_t ABS_FRAME_MAX_BYTES = 12; // max length of an SSI/BiSS-C frame
     static constexpr std::array<float, 6> hall_edge_defaults = 
         {0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f};
 
@@ -21,7 +22,12 @@ public:
         float calib_range = 0.02f; // Accuracy required to pass encoder cpr check
         float calib_scan_distance = 16.0f * M_PI; // rad electrical
         float calib_scan_omega = 4.0f * M_PI; // rad/s electrical
+        float calib_max_residual = 0.5f; // rad electrical, max RMS deviation of the offset calibration fit on top of the quantization noise
         float bandwidth = 1000.0f;
+        bool enable_bandwidth_scheduling = false; // Scale the bandwidth with the velocity estimate
+        float bandwidth_high = 3000.0f;   // [rad/s] used above bandwidth_vel_high
+        float bandwidth_vel_low = 1.0f;   // [turn/s] below this speed, bandwidth is used
+        float bandwidth_vel_high = 10.0f; // [turn/s] above this speed, bandwidth_high is used
         int32_t phase_offset = 0;        // Offset between encoder count and rotor electrical phase
         float phase_offset_float = 0.0f; // Sub-count phase alignment offset
         int32_t cpr = (2048 * 4);   // Default resolution of CUI-AMT102 encoder,
@@ -43,6 +49,9 @@ public:
         uint16_t abs_spi_cs_gpio_pin = 1;
         uint16_t sincos_gpio_pin_sin = 3;
         uint16_t sincos_gpio_pin_cos = 4;
+        uint8_t abs_st_bits = 20; // single-turn bits of an SSI/BiSS-C encoder
+        uint8_t abs_mt_bits = 0;  // multi-turn bits of an SSI/BiSS-C encoder
+        bool abs_ssi_gray_code = false;
 
 
         // custom setters
@@ -52,6 +61,45 @@ public:
         void set_abs_spi_cs_gpio_pin(uint16_t value) { abs_spi_cs_gpio_pin = value; parent->abs_spi_cs_pin_init(); }
         void set_pre_calibrated(bool value) { pre_calibrated = value; parent->check_pre_calibrated(); }
         void set_bandwidth(float value) { bandwidth = value; parent->update_pll_gains(); }
+        void set_enable_bandwidth_scheduling(bool value) { enable_bandwidth_scheduling = value; parent->update_pll_gains(); }
+        void set_bandwidth_high(float value) { bandwidth_high = value; parent->update_pll_gains(); }
+    };
+
+    /**
+     * @brief Mode specific part of the encoder.
+     *
+     * One backend per encoder mode is selected in apply_config() so that the
+     * per-cycle sampling and decoding paths don't need to branch on the mode.
+     * Backends are stateless, all state lives in the Encoder object.
+     */
+    class Backend {
+    public:
+        enum Result {
+            RESULT_OK,      // delta_enc is valid
+            RESULT_SKIP,    // sample was consumed, skip estimation this cycle
+            RESULT_ERROR,   // an error was set on the encoder
+        };
+
+        /**
+         * @brief Captures the raw encoder signals. Called from sampling_cb()
+         * so the same restrictions apply.
+         */
+        virtual void sample_now(Encoder& encoder) = 0;
+
+        /**
+         * @brief Decodes the latest sample into a count delta relative to
+         * count_in_cpr_/shadow_count_. Called from update().
+         */
+        virtual Result decode(Encoder& encoder, int32_t* delta_enc) = 0;
+
+        /**
+         * @brief Returns the count that the encoder would report at the given
+         * internal position. Used as the phase detector of the PLL in
+         * update(). Most encoders simply quantize the position.
+         */
+        virtual int32_t model(Encoder& encoder, float internal_pos) {
+            return (int32_t)std::floor(internal_pos);
+        }
     };
 
     Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
@@ -66,6 +114,7 @@ public:
     void enc_index_cb();
     void set_idx_subscribe(bool override_enable = false);
     void update_pll_gains();
+    void set_pll_bandwidth(float bandwidth);
     void check_pre_calibrated();
 
     void set_linear_count(int32_t count);
@@ -92,6 +141,7 @@ public:
     Axis* axis_ = nullptr; // set by Axis constructor
 
     Config_t config_;
+    Backend* backend_; // selected by apply_config()
 
     Error error_ = ERROR_NONE;
     bool index_found_ = false;
@@ -105,9 +155,11 @@ public:
     float pos_cpr_counts_ = 0.0f;  // [count]
     float delta_pos_cpr_counts_ = 0.0f;  // [count] phase detector result for debug
     float vel_estimate_counts_ = 0.0f;  // [count/s]
+    float pll_bandwidth_ = 0.0f; // [rad/s] currently active bandwidth
     float pll_kp_ = 0.0f;   // [count/s / count]
     float pll_ki_ = 0.0f;   // [(count/s^2) / count]
     float calib_scan_response_ = 0.0f; // debug report from offset calib
+    float calib_fit_residual_ = 0.0f; // [rad electrical] RMS residual of the last offset calib
     int32_t pos_abs_ = 0;
     float spi_error_rate_ = 0.0f;
 
@@ -133,8 +185,8 @@ public:
     float sincos_sample_s_ = 0.0f;
     float sincos_sample_c_ = 0.0f;
 
-    bool abs_spi_start_transaction();
-    void abs_spi_cb(bool success);
+    bool abs_spi_start_transaction(const void* tx_buf, void* rx_buf, size_t length, void (*on_complete)(void*, bool));
+    void abs_spi_cb(bool success, uint32_t pos);
     void abs_spi_cs_pin_init();
     bool abs_spi_pos_updated_ = false;
     Mode mode_ = MODE_INCREMENTAL;
@@ -143,6 +195,13 @@ public:
     uint32_t abs_spi_cr2;
     uint16_t abs_spi_dma_tx_[1] = {0xFFFF};
     uint16_t abs_spi_dma_rx_[1];
+    uint8_t abs_frame_dma_tx_[ABS_FRAME_MAX_BYTES];
+    uint8_t abs_frame_dma_rx_[ABS_FRAME_MAX_BYTES];
+    size_t abs_frame_bytes_ = 0; // SPI transfer length for SSI/BiSS-C
+    uint32_t abs_multi_turn_ = 0;
+    bool abs_multi_turn_synced_ = false; // shadow_count_ was initialized from the multi-turn position
+    bool abs_frame_error_ = false;
+    bool abs_frame_warning_ = false;
     Stm32SpiArbiter::SpiTask spi_task_;
 
     constexpr float getCoggingRatio(){
@@ -0,0 +1,213 @@
+#ifndef __ENCODER_DECODERS_HPP
+#define __ENCODER_DECODERS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Hardware independent decoding of raw encoder samples.
+// These functions are used by the encoder backends (see encoder.cpp) and are
+// kept free of HAL dependencies so that they can be unit tested on the host.
+
+/**
+ * @brief Converts a hall sensor state (bit[0] = HallA, .., bit[2] = HallC)
+ * into a count in [0, 6). Returns false for the illegal states 0b000 and 0b111.
+ */
+inline bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
+    switch (hall_state) {
+        case 0b001: *hall_cnt = 0; return true;
+        case 0b011: *hall_cnt = 1; return true;
+        case 0b010: *hall_cnt = 2; return true;
+        case 0b110: *hall_cnt = 3; return true;
+        case 0b100: *hall_cnt = 4; return true;
+        case 0b101: *hall_cnt = 5; return true;
+        default: return false;
+    }
+}
+
+inline uint8_t ams_parity(uint16_t v) {
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+}
+
+inline uint8_t cui_parity(uint16_t v) {
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    return ~v & 3;
+}
+
+// The decode_*_frame() functions take one 16-bit SPI frame as received from
+// the encoder and return true and the 14-bit position if the frame is valid.
+
+inline bool decode_ams_frame(uint16_t raw, uint16_t* pos) {
+    // check if parity is correct (even) and error flag clear
+    if (ams_parity(raw) || ((raw >> 14) & 1)) {
+        return false;
+    }
+    *pos = raw & 0x3fff;
+    return true;
+}
+
+inline bool decode_cui_frame(uint16_t raw, uint16_t* pos) {
+    // check if parity is correct
+    if (cui_parity(raw)) {
+        return false;
+    }
+    *pos = raw & 0x3fff;
+    return true;
+}
+
+inline bool decode_rls_frame(uint16_t raw, uint16_t* pos) {
+    *pos = (raw >> 2) & 0x3fff;
+    return true;
+}
+
+inline bool decode_ma732_frame(uint16_t raw, uint16_t* pos) {
+    *pos = (raw >> 2) & 0x3fff;
+    return true;
+}
+
+// Decoders for bit-serial absolute encoders (SSI, BiSS-C) that are read out
+// as a stream of 8-bit SPI frames (MSB first). The SPI clock is used as the
+// encoder clock (MA) and MISO as the encoder data line (SLO).
+
+struct AbsEncoderFrame {
+    uint32_t single_turn = 0;
+    uint32_t multi_turn = 0;
+    bool error = false;   // encoder reports an error (position may be invalid)
+    bool warning = false; // encoder reports a warning (position is valid)
+};
+
+/**
+ * @brief Maximum of mt_bits + st_bits such that every position of the encoder
+ * can be represented as a count in an int32_t.
+ */
+static constexpr size_t ABS_ENCODER_MAX_POSITION_BITS = 31;
+
+/**
+ * @brief Combines the multi-turn and single-turn position into a count.
+ * The multi-turn counter is interpreted as a signed mt_bits wide number so
+ * that a position slightly below turn 0 doesn't start 2^mt_bits turns ahead.
+ * mt_bits + st_bits must not exceed ABS_ENCODER_MAX_POSITION_BITS.
+ */
+inline int32_t abs_encoder_count(uint32_t multi_turn, uint32_t single_turn, uint8_t mt_bits, uint8_t st_bits) {
+    int64_t turns = multi_turn;
+    if (mt_bits && ((multi_turn >> (mt_bits - 1)) & 1))
+        turns -= (int64_t)1 << mt_bits;
+    return (int32_t)(turns * ((int64_t)1 << st_bits) + single_turn);
+}
+
+/**
+ * @brief Reads n_bits (at most 64) starting at bit_offset from a MSB-first
+ * bit stream.
+ */
+inline uint64_t read_bits_msb(const uint8_t* buf, size_t bit_offset, size_t n_bits) {
+    uint64_t result = 0;
+    for (size_t i = bit_offset; i < bit_offset + n_bits; ++i) {
+        result = (result << 1) | ((buf[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+    return result;
+}
+
+inline uint64_t gray_to_binary(uint64_t v) {
+    v ^= v >> 32;
+    v ^= v >> 16;
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v;
+}
+
+/**
+ * @brief CRC6 as used by BiSS-C: polynomial x^6 + x^1 + x^0, start value 0,
+ * over the n_bits least significant bits of data (MSB first). Note that the
+ * encoder transmits the inverted CRC.
+ */
+inline uint8_t biss_crc6(uint64_t data, size_t n_bits) {
+    uint8_t crc = 0;
+    for (size_t i = n_bits; i-- > 0;) {
+        uint8_t bit = ((data >> i) & 1) ^ ((crc >> 5) & 1);
+        crc = (crc << 1) & 0x3f;
+        if (bit)
+            crc ^= 0x03;
+    }
+    return crc;
+}
+
+/**
+ * @brief Number of bits that must be clocked in to read one frame.
+ * BiSS-C allows for a few bits of acknowledge latency which is covered by
+ * BISS_C_MAX_ACK_BITS.
+ */
+static constexpr size_t BISS_C_MAX_ACK_BITS = 8;
+inline size_t ssi_frame_bits(uint8_t mt_bits, uint8_t st_bits) {
+    return 1 + mt_bits + st_bits;
+}
+inline size_t biss_c_frame_bits(uint8_t mt_bits, uint8_t st_bits) {
+    return BISS_C_MAX_ACK_BITS + 2 + mt_bits + st_bits + 2 + 6;
+}
+
+/**
+ * @brief Decodes an SSI frame: one leading bit (sampled on the first clock
+ * edge, before the encoder outputs its MSB) followed by mt_bits multi-turn
+ * and st_bits single-turn bits.
+ * With gray_code, the multi-turn and single-turn bits together form one Gray
+ * coded position word, as is common for multi-turn SSI encoders.
+ */
+inline bool decode_ssi_frame(const uint8_t* buf, size_t buf_bits,
+        uint8_t mt_bits, uint8_t st_bits, bool gray_code, AbsEncoderFrame* frame) {
+    if (mt_bits > 32 || st_bits > 32 || st_bits == 0 || ssi_frame_bits(mt_bits, st_bits) > buf_bits) {
+        return false;
+    }
+    uint64_t position = read_bits_msb(buf, 1, (size_t)mt_bits + st_bits);
+    if (gray_code) {
+        position = gray_to_binary(position);
+    }
+    frame->multi_turn = (uint32_t)(position >> st_bits);
+    frame->single_turn = (uint32_t)(position & (((uint64_t)1 << st_bits) - 1));
+    frame->error = false;
+    frame->warning = false;
+    return true;
+}
+
+/**
+ * @brief Decodes a unidirectional BiSS-C frame:
+ * [idle/ack: 1..0][start: 1][CDS: 0][MT][ST][nE][nW][~CRC6]
+ * Returns false if no start bit was found or the CRC doesn't match.
+ */
+inline bool decode_biss_c_frame(const uint8_t* buf, size_t buf_bits,
+        uint8_t mt_bits, uint8_t st_bits, AbsEncoderFrame* frame) {
+    size_t data_bits = (size_t)mt_bits + st_bits + 2;
+    if (mt_bits > 32 || st_bits > 32 || st_bits == 0 || data_bits > 64) {
+        return false;
+    }
+
+    // Skip remaining idle bits, then the acknowledge bits up to the start bit
+    size_t i = 0;
+    while (i < buf_bits && read_bits_msb(buf, i, 1))
+        i++;
+    while (i < buf_bits && !read_bits_msb(buf, i, 1))
+        i++;
+    size_t start = i;
+    if (start + 2 + data_bits + 6 > buf_bits) {
+        return false; // start bit not found or frame truncated
+    }
+
+    uint64_t data = read_bits_msb(buf, start + 2, data_bits);
+    uint8_t crc = (uint8_t)read_bits_msb(buf, start + 2 + data_bits, 6);
+    if (biss_crc6(data, data_bits) != (~crc & 0x3f)) {
+        return false;
+    }
+
+    frame->error = !((data >> 1) & 1);
+    frame->warning = !(data & 1);
+    frame->single_turn = (uint32_t)((data >> 2) & ((1ULL << st_bits) - 1));
+    frame->multi_turn = (uint32_t)((data >> (2 + st_bits)) & ((1ULL << mt_bits) - 1));
+    return true;
+}
+
+#endif // __ENCODER_DECODERS_HPP
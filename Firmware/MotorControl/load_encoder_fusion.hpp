@@ -0,0 +1,83 @@
+#ifndef __LOAD_ENCODER_FUSION_HPP
+#define __LOAD_ENCODER_FUSION_HPP
+
+#include <optional>
+#include "utils.hpp"
+
+/**
+ * @brief Complementary filter between the motor encoder and the load encoder.
+ *
+ * The motor encoder is stiffly coupled to the rotor and provides the high
+ * frequency content of the position estimate. The load encoder provides the
+ * low frequency content. The filter state is the deflection between the two
+ * sides (belt compliance and backlash), which settles with a time constant of
+ * 1 / bandwidth. The position loop thus sees the true load position at steady
+ * state but doesn't see the resonance or dead zone of the transmission, which
+ * would otherwise cause limit cycling at high vel_gain.
+ *
+ * The filter only runs between start() and stop(), i.e. while the controller
+ * is actually connected to a load encoder (position) and a motor encoder
+ * (velocity).
+ */
+class LoadEncoderFusion {
+public:
+    void start() { active_ = true; valid_ = false; }
+    void stop() { active_ = false; valid_ = false; }
+    bool is_active() const { return active_; }
+    bool is_valid() const { return valid_; }
+    float get_deflection() const { return deflection_; }
+
+    /**
+     * @brief Replaces the load encoder estimates with the fused estimates.
+     * All estimates are converted to load encoder units.
+     *
+     * @param dt: Time since the last update [s]
+     * @param ratio: Load encoder turns per motor encoder turn
+     * @param bandwidth: Crossover of the filter [rad/s]
+     * @param motor_pos: Position estimate of the motor encoder
+     * @param pos_estimate_linear: In: load encoder position, out: fused position
+     * @param pos_estimate_circular: In: circular load encoder position, out: circular fused position
+     * @param pos_wrap: Wrap range of the circular position
+     * @param vel_estimate: In: motor encoder velocity, out: velocity in load encoder units
+     */
+    void update(float dt, float ratio, float bandwidth,
+                std::optional<float> motor_pos,
+                std::optional<float>* pos_estimate_linear,
+                std::optional<float>* pos_estimate_circular,
+                std::optional<float> pos_wrap,
+                std::optional<float>* vel_estimate) {
+        if (vel_estimate->has_value()) {
+            *vel_estimate = **vel_estimate * ratio;
+        }
+
+        if (!motor_pos.has_value() || !pos_estimate_linear->has_value()) {
+            *pos_estimate_linear = std::nullopt;
+            *pos_estimate_circular = std::nullopt;
+            valid_ = false;
+            return;
+        }
+
+        float load_pos = **pos_estimate_linear;
+        float motor_pos_on_load = *motor_pos * ratio;
+        if (!valid_) {
+            deflection_ = load_pos - motor_pos_on_load;
+            valid_ = true;
+        }
+
+        float k = std::min(dt * bandwidth, 1.0f);
+        deflection_ += k * (load_pos - motor_pos_on_load - deflection_);
+        float fused_pos = motor_pos_on_load + deflection_;
+
+        if (pos_estimate_circular->has_value() && pos_wrap.has_value()) {
+            *pos_estimate_circular = fmodf_pos(**pos_estimate_circular + (fused_pos - load_pos), *pos_wrap);
+        }
+        *pos_estimate_linear = fused_pos;
+    }
+
+private:
+    bool active_ = false;
+    bool valid_ = false;
+    float deflection_ = 0.0f; // [load turn] estimated lost motion between motor and load (compliance + backlash)
+};
+
+#endif // __LOAD_ENCODER_FUSION_HPP
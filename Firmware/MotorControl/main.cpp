@@ -10,11 +10,14 @@
 #include <communication/interface_uart.h>
 #include <communication/interface_i2c.h>
 #include <communication/interface_can.hpp>
+#include <communication/ascii_protocol.hpp>
 
 osSemaphoreId sem_usb_irq;
 osSemaphoreId sem_uart_dma;
+osSemaphoreId sem_uart_rx;
 osSemaphoreId sem_usb_rx;
-osSemaphoreId sem_usb_tx;
+osSemaphoreId sem_usb_tx_cdc;
+osSemaphoreId sem_usb_tx_native;
 osSemaphoreId sem_can;
 
 #if defined(STM32F405xx)
@@ -394,7 +397,11 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
             axis.sensorless_estimator_.vel_estimate_.reset();
         }
 
-        uart_poll();
+        usb_ascii_protocol.apply_staged_setpoints();
+        uart_ascii_protocol.apply_staged_setpoints();
+        fibre::transaction_buffer.apply();
+        for (auto& axis: axes)
+            axis.controller_.apply_scheduled_input(timestamp);
         odrv.oscilloscope_.update();
     }
 
@@ -448,6 +455,11 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
             axis.motor_.current_control_.update(timestamp); // uses the output of controller_ or open_loop_contoller_ and encoder_ or sensorless_estimator_ or acim_estimator_
     }
 
+    // Sample subscribed telemetry values now so that all of them belong to
+    // the same control loop iteration
+    usb_sample_telemetry(timestamp);
+    uart_sample_telemetry(timestamp);
+
     // Tell the axis threads that the control loop has finished
     for (auto& axis: axes) {
         if (axis.thread_id_) {
@@ -820,14 +832,21 @@ extern "C" int main(void) {
     osSemaphoreDef(sem_uart_dma);
     sem_uart_dma = osSemaphoreCreate(osSemaphore(sem_uart_dma), 1);
 
+    // Create a semaphore for UART RX
+    osSemaphoreDef(sem_uart_rx);
+    sem_uart_rx = osSemaphoreCreate(osSemaphore(sem_uart_rx), 1);
+    osSemaphoreWait(sem_uart_rx, 0);  // Remove a token.
+
     // Create a semaphore for USB RX
     osSemaphoreDef(sem_usb_rx);
     sem_usb_rx = osSemaphoreCreate(osSemaphore(sem_usb_rx), 1);
     osSemaphoreWait(sem_usb_rx, 0);  // Remove a token.
 
-    // Create a semaphore for USB TX
-    osSemaphoreDef(sem_usb_tx);
-    sem_usb_tx = osSemaphoreCreate(osSemaphore(sem_usb_tx), 1);
+    // Create a semaphore for each USB TX endpoint
+    osSemaphoreDef(sem_usb_tx_cdc);
+    sem_usb_tx_cdc = osSemaphoreCreate(osSemaphore(sem_usb_tx_cdc), 1);
+    osSemaphoreDef(sem_usb_tx_native);
+    sem_usb_tx_native = osSemaphoreCreate(osSemaphore(sem_usb_tx_native), 1);
 
     osSemaphoreDef(sem_can);
     sem_can = osSemaphoreCreate(osSemaphore(sem_can), 1);
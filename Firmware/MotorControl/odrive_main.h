@@ -69,6 +69,9 @@ struct BoardConfig_t {
     uint32_t uart_a_baudrate = 115200;
     uint32_t uart_b_baudrate = 115200;
     uint32_t uart_c_baudrate = 115200;
+    uint8_t uart_rs485_address = 0; // 0: point-to-point, 1...126: node address on a multi-drop bus
+    uint32_t uart_rs485_de_gpio_pin = 0; // 0: no driver enable pin
+    uint32_t uart_rs485_turnaround_us = 50;
     bool enable_can_a = true;
     bool enable_i2c_a = false;
     bool enable_ascii_protocol_on_usb = true;
@@ -233,6 +236,7 @@ public:
     uint32_t test_property_ = 0;
 
     uint32_t last_update_timestamp_ = 0;
+    uint32_t control_loop_timestamp_increment_ = CONTROL_TIMER_PERIOD_TICKS;
     uint32_t n_evt_sampling_ = 0;
     uint32_t n_evt_control_loop_ = 0;
     bool task_timers_armed_ = false;
@@ -0,0 +1,74 @@
+#ifndef __SETPOINT_SCHEDULE_HPP
+#define __SETPOINT_SCHEDULE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Queue of controller setpoints that take effect in a given control
+ * loop iteration.
+ *
+ * Each entry is tagged with a timestamp in the time base of the timestamp that
+ * is passed to ComponentBase::update() (see ODrive::control_loop_cb()). The
+ * control loop applies an entry in the first iteration whose timestamp is at
+ * or after the timestamp of the entry. Timestamps wrap around at 2^32, so an
+ * entry can be scheduled at most 2^31 ticks ahead.
+ *
+ * Entries are kept sorted by timestamp. Entries with the same timestamp are
+ * applied in the order in which they were pushed.
+ *
+ * push() and clear() are called by the communication threads, pop_due() by
+ * the control loop. None of them takes a lock, so the caller of push() and
+ * clear() must make sure that the control loop doesn't run in between (e.g.
+ * with CRITICAL_SECTION()).
+ */
+class SetpointSchedule {
+public:
+    static constexpr size_t CAPACITY = 8;
+
+    struct Entry {
+        uint32_t timestamp;
+        float input_pos;
+        float input_vel;
+        float input_torque;
+    };
+
+    // @brief Inserts an entry. Fails if the queue is full or if the timestamp
+    // of the entry is not after now (i.e. the entry would be late).
+    bool push(const Entry& entry, uint32_t now) {
+        if (n_entries_ >= CAPACITY || !is_after(entry.timestamp, now))
+            return false;
+        size_t i = n_entries_;
+        for (; i > 0 && is_after(entries_[i - 1].timestamp, entry.timestamp); --i)
+            entries_[i] = entries_[i - 1];
+        entries_[i] = entry;
+        n_entries_++;
+        return true;
+    }
+
+    // @brief Removes the earliest entry and returns true if it is due at now.
+    // Call repeatedly until it returns false.
+    bool pop_due(uint32_t now, Entry* entry) {
+        if (!n_entries_ || is_after(entries_[0].timestamp, now))
+            return false;
+        *entry = entries_[0];
+        n_entries_--;
+        for (size_t i = 0; i < n_entries_; ++i)
+            entries_[i] = entries_[i + 1];
+        return true;
+    }
+
+    void clear() { n_entries_ = 0; }
+
+    size_t size() const { return n_entries_; }
+
+private:
+    static bool is_after(uint32_t a, uint32_t b) {
+        return (int32_t)(a - b) > 0;
+    }
+
+    Entry entries_[CAPACITY];
+    size_t n_entries_ = 0;
+};
+
+#endif // __SETPOINT_SCHEDULE_HPP
@@ -156,3 +156,91 @@ inline int mod(const int dividend, const int divisor){
     if (r < 0) r += divisor;
     return r;
 }
+
+/**
+ * @brief Incremental least-squares fit of the line y = offset + slope * x.
+ * Keeps running means and co-moments (Welford's method) of the samples
+ * relative to the first sample, so that single precision is enough. The sum
+ * of squared residuals is updated with the prediction error of each new
+ * sample (recursive least squares) instead of being recovered from the
+ * co-moments, which would cancel catastrophically for large slopes.
+ */
+class LinearFit {
+public:
+    void add(float x, float y) {
+        if (n_ == 0.0f) {
+            x0_ = x;
+            y0_ = y;
+        }
+        x -= x0_;
+        y -= y0_;
+        float dx = x - mean_x_;
+        float dy = y - mean_y_;
+        if (cxx_ > 0.0f) {
+            float e = dy - cxy_ / cxx_ * dx;
+            sse_ += e * e / (1.0f + 1.0f / n_ + dx * dx / cxx_);
+        } else if (dx != 0.0f) {
+            sse_ = cyy_; // the line so far went through the mean of samples at one x
+        }
+        n_ += 1.0f;
+        mean_x_ += dx / n_;
+        mean_y_ += dy / n_;
+        cxx_ += dx * (x - mean_x_);
+        cxy_ += dx * (y - mean_y_);
+        cyy_ += dy * (y - mean_y_);
+    }
+
+    /**
+     * @brief Returns false if there are not enough samples or all samples
+     * have the same x value. rms_residual is the RMS deviation of y from the
+     * fitted line.
+     */
+    bool solve(float* offset, float* slope, float* rms_residual) const {
+        if (n_ < 2.0f || cxx_ <= 0.0f) {
+            return false;
+        }
+        float b = cxy_ / cxx_;
+        *offset = (y0_ + mean_y_) - b * (x0_ + mean_x_);
+        *slope = b;
+        *rms_residual = std::sqrt(sse_ / n_);
+        return true;
+    }
+
+    /**
+     * @brief Fits two parallel lines to the samples of a and b, that is one
+     * common slope with a separate offset for each. This is the model of a
+     * forward and a backward scan where the response lags behind by the same
+     * amount in both directions. rms_residual is the RMS deviation of all
+     * samples from their own line, so the lag does not show up in it.
+     * Returns false if either fit is empty or neither has two different x values.
+     */
+    static bool solve_common_slope(const LinearFit& a, const LinearFit& b,
+            float* offset_a, float* offset_b, float* slope, float* rms_residual) {
+        float cxx = a.cxx_ + b.cxx_;
+        if (a.n_ < 1.0f || b.n_ < 1.0f || cxx <= 0.0f) {
+            return false;
+        }
+        float s = (a.cxy_ + b.cxy_) / cxx;
+        float sse = a.sse_with_slope(s) + b.sse_with_slope(s);
+        *offset_a = (a.y0_ + a.mean_y_) - s * (a.x0_ + a.mean_x_);
+        *offset_b = (b.y0_ + b.mean_y_) - s * (b.x0_ + b.mean_x_);
+        *slope = s;
+        *rms_residual = std::sqrt(sse / (a.n_ + b.n_));
+        return true;
+    }
+
+    size_t size() const { return (size_t)n_; }
+
+private:
+    // Sum of squared residuals of a line with the given slope through the mean
+    float sse_with_slope(float slope) const {
+        if (cxx_ <= 0.0f) {
+            return cyy_;
+        }
+        float db = cxy_ / cxx_ - slope;
+        return sse_ + db * db * cxx_;
+    }
+
+    float x0_ = 0.0f, y0_ = 0.0f;
+    float n_ = 0.0f, mean_x_ = 0.0f, mean_y_ = 0.0f, cxx_ = 0.0f, cxy_ = 0.0f, cyy_ = 0.0f, sse_ = 0.0f;
+};
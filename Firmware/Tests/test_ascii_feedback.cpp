@@ -0,0 +1,146 @@
+
+#include <doctest.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "communication/ascii_feedback.cpp"
+
+class LineCollector : public StreamSink {
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        lines.emplace_back(buffer, buffer + length);
+        return 0;
+    }
+    size_t get_free_space() override { return free_space; }
+    std::vector<std::string> lines;
+    size_t free_space = SIZE_MAX;
+};
+
+static std::string format(float value) {
+    char buffer[16];
+    return std::string(buffer, AsciiFeedbackStream::format_float(buffer, value));
+}
+
+TEST_SUITE("ascii_feedback") {
+    TEST_CASE("float formatting") {
+        CHECK(format(0.0f) == "0");
+        CHECK(format(1.5f) == "1.5");
+        CHECK(format(-2.25f) == "-2.25");
+        CHECK(format(123.4567f) == "123.4567");
+        CHECK(format(0.00004f) == "0");
+        CHECK(format(0.99996f) == "1");
+        CHECK(format(-0.0001f) == "-0.0001");
+        CHECK(format(999999999.0f) == "1.000e+09");
+        CHECK(format(-INFINITY) == "-inf");
+        CHECK(format(NAN) == "nan");
+    }
+
+    TEST_CASE("rate to decimation") {
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 100.0f) == 80);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 3000.0f) == 3);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 1e6f) == 1);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, INFINITY) == 1);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 1e-3f) == 8000000);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 1e-30f) == AsciiFeedbackStream::MAX_DECIMATION);
+        CHECK(AsciiFeedbackStream::rate_to_decimation(8000.0f, 1e-45f) == AsciiFeedbackStream::MAX_DECIMATION);
+    }
+
+    TEST_CASE("text lines") {
+        AsciiFeedbackStream stream;
+        LineCollector output, other_output;
+        const uint8_t sources[] = {0x00, 0x01, 0x10, 0x11};
+        REQUIRE(stream.start(&output, 2, sources, sizeof(sources), false, false));
+
+        const float values[] = {1.5f, -0.25f, 10.0f, 0.0f};
+        for (uint32_t timestamp = 1; timestamp <= 4; ++timestamp) {
+            if (stream.sample_due())
+                stream.sample(timestamp, values);
+        }
+
+        // Only the latest sample is sent, and only on the requesting stream
+        CHECK(!stream.has_sample(other_output));
+        stream.send(other_output);
+        CHECK(other_output.lines.empty());
+        REQUIRE(stream.has_sample(output));
+        stream.send(output);
+        stream.send(output);
+        REQUIRE(output.lines.size() == 1);
+        CHECK(output.lines[0] == "F 4 1.5 -0.25 10 0\r\n");
+
+        stream.stop();
+        CHECK(!stream.sample_due());
+    }
+
+    TEST_CASE("checksum") {
+        AsciiFeedbackStream stream;
+        LineCollector output;
+        const uint8_t sources[] = {0x00};
+        REQUIRE(stream.start(&output, 1, sources, sizeof(sources), false, true));
+        const float values[] = {2.0f};
+        REQUIRE(stream.sample_due());
+        stream.sample(7, values);
+        stream.send(output);
+        REQUIRE(output.lines.size() == 1);
+
+        uint8_t checksum = 0;
+        for (char c : std::string("F 7 2"))
+            checksum ^= c;
+        CHECK(output.lines[0] == "F 7 2*" + std::to_string(checksum) + "\r\n");
+    }
+
+    TEST_CASE("binary frames") {
+        AsciiFeedbackStream stream;
+        LineCollector output;
+        const uint8_t sources[] = {0x00, 0x01};
+        REQUIRE(stream.start(&output, 1, sources, sizeof(sources), true, false));
+        const float values[] = {1.0f, -2.0f};
+        REQUIRE(stream.sample_due());
+        stream.sample(0x01020304, values);
+        stream.send(output);
+
+        REQUIRE(output.lines.size() == 1);
+        std::string frame = output.lines[0];
+        REQUIRE(frame.size() == 2 + 4 + 2 * 4 + 1);
+        CHECK((uint8_t)frame[0] == AsciiFeedbackStream::BINARY_PREFIX);
+        CHECK(frame[1] == 2);
+        CHECK(frame.substr(2, 4) == std::string("\x04\x03\x02\x01"));
+        float value;
+        memcpy(&value, frame.data() + 10, 4);
+        CHECK(value == -2.0f);
+        CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, reinterpret_cast<const uint8_t*>(frame.data()), frame.size()) == 0);
+    }
+
+    TEST_CASE("samples are dropped if the output is full") {
+        AsciiFeedbackStream stream;
+        LineCollector output;
+        const uint8_t sources[] = {0x00};
+        REQUIRE(stream.start(&output, 1, sources, sizeof(sources), false, false));
+        const float values[] = {1.0f};
+
+        output.free_space = 4;
+        REQUIRE(stream.sample_due());
+        stream.sample(1, values);
+        stream.send(output);
+        CHECK(output.lines.empty());
+        CHECK(!stream.has_sample(output));
+
+        output.free_space = 64;
+        REQUIRE(stream.sample_due());
+        stream.sample(2, values);
+        stream.send(output);
+        REQUIRE(output.lines.size() == 1);
+        CHECK(output.lines[0] == "F 2 1\r\n");
+    }
+
+    TEST_CASE("invalid configurations are rejected") {
+        AsciiFeedbackStream stream;
+        LineCollector output;
+        uint8_t sources[AsciiFeedbackStream::MAX_VALUES + 1] = {0};
+        CHECK(!stream.start(&output, 0, sources, 1, false, false));
+        CHECK(!stream.start(&output, 1, sources, 0, false, false));
+        CHECK(!stream.start(&output, 1, sources, sizeof(sources), false, false));
+        CHECK(!stream.start(nullptr, 1, sources, 1, false, false));
+        CHECK(!stream.sample_due());
+    }
+}
@@ -0,0 +1,358 @@
+
+#include <doctest.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "MotorControl/encoder_decoders.hpp"
+#include "MotorControl/utils.hpp"
+
+TEST_SUITE("encoder_decoders") {
+    TEST_CASE("hall sequence") {
+        // One electrical revolution in positive direction
+        const uint8_t states[] = {0b001, 0b011, 0b010, 0b110, 0b100, 0b101};
+        for (int32_t i = 0; i < 6; ++i) {
+            int32_t hall_cnt = -1;
+            CHECK(decode_hall(states[i], &hall_cnt));
+            CHECK(hall_cnt == i);
+        }
+
+        int32_t hall_cnt = -1;
+        CHECK(!decode_hall(0b000, &hall_cnt));
+        CHECK(!decode_hall(0b111, &hall_cnt));
+        CHECK(hall_cnt == -1);
+    }
+
+    TEST_CASE("hall polarity") {
+        // 60 degree sensor arrangement: flipping hall B yields the 120 degree sequence
+        const uint8_t states_60deg[] = {0b011, 0b001, 0b000, 0b100, 0b110, 0b111};
+        const uint8_t hall_polarity = 0b010;
+        for (int32_t i = 0; i < 6; ++i) {
+            int32_t hall_cnt = -1;
+            CHECK(decode_hall(states_60deg[i] ^ hall_polarity, &hall_cnt));
+            CHECK(hall_cnt == i);
+        }
+    }
+
+    TEST_CASE("AMS frame") {
+        uint16_t pos = 0;
+        CHECK(decode_ams_frame(0x9234, &pos)); // even parity, no error flag
+        CHECK(pos == 0x1234);
+        CHECK(decode_ams_frame(0x0000, &pos));
+        CHECK(pos == 0x0000);
+        CHECK(decode_ams_frame(0x3FFF, &pos));
+        CHECK(pos == 0x3FFF);
+
+        pos = 0xFFFF;
+        CHECK(!decode_ams_frame(0x1234, &pos)); // parity error
+        CHECK(!decode_ams_frame(0x9235, &pos)); // single bit flip
+        CHECK(!decode_ams_frame(0x5234, &pos)); // error flag set
+        CHECK(pos == 0xFFFF);
+    }
+
+    TEST_CASE("CUI frame") {
+        uint16_t pos = 0;
+        CHECK(decode_cui_frame(0x9234, &pos));
+        CHECK(pos == 0x1234);
+        CHECK(decode_cui_frame(0xC000, &pos));
+        CHECK(pos == 0x0000);
+
+        pos = 0xFFFF;
+        CHECK(!decode_cui_frame(0x1234, &pos)); // odd check bit wrong
+        CHECK(!decode_cui_frame(0xD234, &pos)); // even check bit wrong
+        CHECK(pos == 0xFFFF);
+    }
+
+    TEST_CASE("RLS and MA732 frames") {
+        uint16_t pos = 0;
+        CHECK(decode_rls_frame(0x1234 << 2, &pos));
+        CHECK(pos == 0x1234);
+        CHECK(decode_ma732_frame(0xFFFF, &pos));
+        CHECK(pos == 0x3FFF);
+    }
+
+    // Appends the n_bits least significant bits of value to an MSB-first bit stream
+    void push_bits(std::vector<uint8_t>& buf, size_t& n, uint64_t value, size_t n_bits) {
+        for (size_t i = n_bits; i-- > 0; ++n) {
+            if (buf.size() <= n / 8)
+                buf.push_back(0);
+            if ((value >> i) & 1)
+                buf[n / 8] |= 0x80 >> (n % 8);
+        }
+    }
+
+    TEST_CASE("gray code") {
+        CHECK(gray_to_binary(0b0000) == 0);
+        CHECK(gray_to_binary(0b0001) == 1);
+        CHECK(gray_to_binary(0b0011) == 2);
+        CHECK(gray_to_binary(0b0010) == 3);
+        CHECK(gray_to_binary(0b0110) == 4);
+        for (uint32_t i = 0; i < 100000; i += 7)
+            CHECK(gray_to_binary(i ^ (i >> 1)) == i);
+    }
+
+    TEST_CASE("SSI frame") {
+        std::vector<uint8_t> buf;
+        size_t n = 0;
+        push_bits(buf, n, 1, 1); // leading bit
+        push_bits(buf, n, 0xABC, 12);
+        push_bits(buf, n, 0x5A5A5, 20);
+        push_bits(buf, n, 0x7F, (8 - n % 8) % 8); // line idles high
+        REQUIRE(buf.size() * 8 >= ssi_frame_bits(12, 20));
+
+        AbsEncoderFrame frame;
+        CHECK(decode_ssi_frame(buf.data(), buf.size() * 8, 12, 20, false, &frame));
+        CHECK(frame.multi_turn == 0xABC);
+        CHECK(frame.single_turn == 0x5A5A5);
+        CHECK(!frame.error);
+
+        CHECK(decode_ssi_frame(buf.data(), buf.size() * 8, 12, 20, true, &frame));
+        uint64_t position = gray_to_binary(((uint64_t)0xABC << 20) | 0x5A5A5);
+        CHECK(frame.multi_turn == (position >> 20));
+        CHECK(frame.single_turn == (position & 0xfffff));
+
+        CHECK(!decode_ssi_frame(buf.data(), 16, 12, 20, false, &frame)); // buffer too short
+        CHECK(!decode_ssi_frame(buf.data(), buf.size() * 8, 0, 0, false, &frame));
+    }
+
+    TEST_CASE("SSI frame in Gray code") {
+        // The whole position word is Gray coded. With an odd number of ones in
+        // the multi-turn bits, all single-turn bits are inverted compared to
+        // Gray coding the single-turn bits on their own.
+        const uint32_t mt = 0xABC, st = 0x12345;
+        static_assert(__builtin_popcount(0xABC) % 2 == 1);
+        for (uint32_t turn : {mt, mt + 1}) {
+            uint64_t position = ((uint64_t)turn << 20) | st;
+            uint64_t gray = position ^ (position >> 1);
+
+            std::vector<uint8_t> buf;
+            size_t n = 0;
+            push_bits(buf, n, 1, 1); // leading bit
+            push_bits(buf, n, (uint32_t)(gray >> 20), 12);
+            push_bits(buf, n, (uint32_t)(gray & 0xfffff), 20);
+            push_bits(buf, n, 0x7F, (8 - n % 8) % 8);
+
+            AbsEncoderFrame frame;
+            CHECK(decode_ssi_frame(buf.data(), buf.size() * 8, 12, 20, true, &frame));
+            CHECK(frame.multi_turn == turn);
+            CHECK(frame.single_turn == st);
+        }
+    }
+
+    std::vector<uint8_t> make_biss_c_frame(size_t ack_bits, uint32_t mt, uint8_t mt_bits,
+            uint32_t st, uint8_t st_bits, bool n_error, bool n_warning) {
+        std::vector<uint8_t> buf;
+        size_t n = 0;
+        uint64_t data = ((((uint64_t)mt << st_bits) | st) << 2) | (n_error << 1) | n_warning;
+        size_t data_bits = mt_bits + st_bits + 2;
+        push_bits(buf, n, 1, 1); // idle
+        push_bits(buf, n, 0, ack_bits);
+        push_bits(buf, n, 0b10, 2); // start, CDS
+        push_bits(buf, n, data, data_bits);
+        push_bits(buf, n, ~biss_crc6(data, data_bits) & 0x3f, 6);
+        while (n < (biss_c_frame_bits(mt_bits, st_bits) + 7) / 8 * 8)
+            push_bits(buf, n, 0, 1); // timeout
+        return buf;
+    }
+
+    TEST_CASE("BiSS-C CRC") {
+        // Entries from the published CRC6 (0x43) lookup table
+        CHECK(biss_crc6(0x01, 6) == 0x03);
+        CHECK(biss_crc6(0x02, 6) == 0x06);
+        CHECK(biss_crc6(0x20, 6) == 0x23);
+        CHECK(biss_crc6(0, 32) == 0);
+    }
+
+    TEST_CASE("BiSS-C frame") {
+        AbsEncoderFrame frame;
+        for (size_t ack_bits = 1; ack_bits <= 4; ++ack_bits) {
+            auto buf = make_biss_c_frame(ack_bits, 0x123, 12, 0x3BEEF, 18, true, true);
+            CHECK(decode_biss_c_frame(buf.data(), buf.size() * 8, 12, 18, &frame));
+            CHECK(frame.multi_turn == 0x123);
+            CHECK(frame.single_turn == 0x3BEEF);
+            CHECK(!frame.error);
+            CHECK(!frame.warning);
+        }
+
+        auto buf = make_biss_c_frame(2, 0, 0, 0x1FFF, 13, false, true);
+        CHECK(decode_biss_c_frame(buf.data(), buf.size() * 8, 0, 13, &frame));
+        CHECK(frame.single_turn == 0x1FFF);
+        CHECK(frame.error);
+        CHECK(!frame.warning);
+
+        buf = make_biss_c_frame(2, 0, 0, 0x1FFF, 13, true, false);
+        CHECK(decode_biss_c_frame(buf.data(), buf.size() * 8, 0, 13, &frame));
+        CHECK(!frame.error);
+        CHECK(frame.warning);
+    }
+
+    TEST_CASE("BiSS-C frame errors") {
+        AbsEncoderFrame frame;
+        auto buf = make_biss_c_frame(2, 0x55, 8, 0x1234, 16, true, true);
+        for (size_t bit = 5; bit < 5 + 8 + 16 + 2 + 6; ++bit) {
+            auto corrupted = buf;
+            corrupted[bit / 8] ^= 0x80 >> (bit % 8);
+            CHECK(!decode_biss_c_frame(corrupted.data(), corrupted.size() * 8, 8, 16, &frame));
+        }
+
+        // No start bit
+        std::vector<uint8_t> idle(buf.size(), 0xff);
+        CHECK(!decode_biss_c_frame(idle.data(), idle.size() * 8, 8, 16, &frame));
+        std::vector<uint8_t> zero(buf.size(), 0x00);
+        CHECK(!decode_biss_c_frame(zero.data(), zero.size() * 8, 8, 16, &frame));
+    }
+
+    TEST_CASE("multi-turn count") {
+        CHECK(abs_encoder_count(0, 0x1234, 0, 20) == 0x1234);
+        CHECK(abs_encoder_count(3, 0x1234, 11, 20) == 3 * (1 << 20) + 0x1234);
+        // The turn count is signed
+        CHECK(abs_encoder_count(0x7ff, 0xfffff, 11, 20) == -1);
+        CHECK(abs_encoder_count(0x400, 0, 11, 20) == -1024 * (1 << 20));
+        CHECK(abs_encoder_count(0x3ff, 0xfffff, 11, 20) == (1 << 30) - 1);
+        CHECK(abs_encoder_count(0x4000, 0, 15, 16) == -(1 << 30));
+    }
+}
+
+TEST_SUITE("offset_calibration_fit") {
+    struct Scan {
+        LinearFit forward, backward;
+
+        // Same evaluation as Encoder::run_offset_calibration()
+        bool solve(float* offset, float* slope, float* residual) const {
+            float forward_offset, backward_offset;
+            if (!LinearFit::solve_common_slope(forward, backward, &forward_offset, &backward_offset, slope, residual))
+                return false;
+            *offset = (forward_offset + backward_offset) / 2.0f;
+            return true;
+        }
+    };
+
+    // Simulates the bidirectional scan of Encoder::run_offset_calibration()
+    // with a rotor that lags the open loop phase by lag (rad electrical).
+    Scan simulate_scan(float distance, float counts_per_rad, float offset, float lag, float noise, float cogging = 0.0f) {
+        std::mt19937 rng(42);
+        std::normal_distribution<float> dist(0.0f, noise);
+        Scan scan;
+        const size_t steps = 500;
+        for (size_t dir = 0; dir < 2; ++dir) {
+            for (size_t i = 0; i < steps; ++i) {
+                float x = (dir == 0 ? (float)i : (float)(steps - i)) / steps * distance - distance / 2.0f;
+                float rotor = x + (dir == 0 ? -lag : lag) + cogging * std::sin(6.0f * x) + dist(rng);
+                (dir == 0 ? scan.forward : scan.backward).add(x, std::round(offset + counts_per_rad * rotor));
+            }
+        }
+        return scan;
+    }
+
+    TEST_CASE("ideal scan") {
+        float offset, slope, residual;
+        CHECK(simulate_scan(4 * M_PI, 100.0f, -1234.0f, 0.0f, 0.001f).solve(&offset, &slope, &residual));
+        CHECK(offset == doctest::Approx(-1234.0f).epsilon(0.0005));
+        CHECK(slope == doctest::Approx(100.0f).epsilon(0.001));
+        CHECK(residual < 0.5f); // quantization only
+    }
+
+    TEST_CASE("lag and direction") {
+        float offset, slope, residual;
+        CHECK(simulate_scan(4 * M_PI, -50.0f, 300.0f, 0.2f, 0.01f).solve(&offset, &slope, &residual));
+        CHECK(offset == doctest::Approx(300.0f).epsilon(0.005));
+        CHECK(slope == doctest::Approx(-50.0f).epsilon(0.005));
+        // The lag is absorbed by the separate intercepts, only noise and quantization remain
+        CHECK(residual == doctest::Approx(std::sqrt(0.5f * 0.5f + 1.0f / 12.0f)).epsilon(0.1));
+
+        // A single line through both scans would report the lag as residual
+        Scan scan = simulate_scan(4 * M_PI, -50.0f, 300.0f, 0.2f, 0.01f);
+        float forward_offset, backward_offset;
+        CHECK(LinearFit::solve_common_slope(scan.forward, scan.backward, &forward_offset, &backward_offset, &slope, &residual));
+        CHECK((backward_offset - forward_offset) / slope / 2.0f == doctest::Approx(0.2f).epsilon(0.02));
+    }
+
+    TEST_CASE("large counts") {
+        // Single precision must be enough far away from count 0
+        float offset, slope, residual;
+        CHECK(simulate_scan(4 * M_PI, 1000.0f, 2000000.0f, 0.0f, 0.001f).solve(&offset, &slope, &residual));
+        CHECK(offset == doctest::Approx(2000000.0f).epsilon(0.00001));
+        CHECK(slope == doctest::Approx(1000.0f).epsilon(0.001));
+        CHECK(residual == doctest::Approx(std::sqrt(1.0f + 1.0f / 12.0f)).epsilon(0.1));
+    }
+
+    TEST_CASE("hall sensor quantization") {
+        // 6 counts per electrical revolution: the residual of an ideal scan
+        // is about one count / sqrt(12), i.e. 0.3 rad electrical
+        const float counts_per_rad = 6.0f / (2.0f * M_PI);
+        float offset, slope, residual;
+        CHECK(simulate_scan(8 * M_PI, counts_per_rad, 10.0f, 0.0f, 0.001f).solve(&offset, &slope, &residual));
+        CHECK(slope == doctest::Approx(counts_per_rad).epsilon(0.02));
+        CHECK(residual / counts_per_rad == doctest::Approx(2.0f * M_PI / 6.0f / std::sqrt(12.0f)).epsilon(0.15));
+    }
+
+    TEST_CASE("bad fit") {
+        float offset, slope, residual;
+        CHECK(simulate_scan(4 * M_PI, 100.0f, 0.0f, 0.0f, 0.001f, 1.0f).solve(&offset, &slope, &residual));
+        CHECK(residual / 100.0f > 0.5f);
+
+        LinearFit empty;
+        CHECK(!empty.solve(&offset, &slope, &residual));
+        LinearFit no_motion;
+        for (size_t i = 0; i < 10; ++i)
+            no_motion.add(1.0f, (float)i);
+        CHECK(!no_motion.solve(&offset, &slope, &residual));
+        LinearFit late_motion; // the first samples have the same x
+        late_motion.add(0.0f, 0.0f);
+        late_motion.add(0.0f, 2.0f);
+        late_motion.add(1.0f, 1.0f);
+        CHECK(late_motion.solve(&offset, &slope, &residual));
+        CHECK(residual == doctest::Approx(std::sqrt(2.0f / 3.0f)));
+        float backward_offset;
+        CHECK(!LinearFit::solve_common_slope(no_motion, no_motion, &offset, &backward_offset, &slope, &residual));
+        CHECK(!LinearFit::solve_common_slope(simulate_scan(4 * M_PI, 100.0f, 0.0f, 0.0f, 0.001f).forward, empty,
+                                             &offset, &backward_offset, &slope, &residual));
+    }
+}
+
+TEST_SUITE("encoder_decoders_benchmark" * doctest::skip()) {
+    enum Mode { MODE_CUI, MODE_AMS, MODE_RLS, MODE_MA732 };
+
+    // Reference: how abs_spi_cb used to decode the frame
+    bool decode_switch(Mode mode, uint16_t raw, uint16_t* pos) {
+        switch (mode) {
+            case MODE_CUI: return decode_cui_frame(raw, pos);
+            case MODE_AMS: return decode_ams_frame(raw, pos);
+            case MODE_RLS: return decode_rls_frame(raw, pos);
+            case MODE_MA732: return decode_ma732_frame(raw, pos);
+            default: return false;
+        }
+    }
+
+    template<typename TFn>
+    double ns_per_frame(const std::vector<uint16_t>& frames, TFn fn) {
+        uint32_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t rep = 0; rep < 100; ++rep) {
+            for (uint16_t raw: frames) {
+                uint16_t pos = 0;
+                sum += fn(raw, &pos) ? pos : 1;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        CHECK(sum != 0); // keep the loop alive
+        return std::chrono::duration<double, std::nano>(end - start).count() / (100.0 * frames.size());
+    }
+
+    TEST_CASE("dispatch") {
+        std::mt19937 rng(1234);
+        std::vector<uint16_t> frames(100000);
+        for (auto& f: frames)
+            f = (uint16_t)rng();
+
+        volatile Mode mode = MODE_AMS; // opaque to the optimizer, like config_.mode
+        bool (* volatile backend)(uint16_t, uint16_t*) = decode_ams_frame;
+
+        double t_switch = ns_per_frame(frames, [&](uint16_t raw, uint16_t* pos) { return decode_switch(mode, raw, pos); });
+        double t_backend = ns_per_frame(frames, [&](uint16_t raw, uint16_t* pos) { return backend(raw, pos); });
+
+        std::cout << "switch:  " << t_switch << " ns/frame" << std::endl;
+        std::cout << "backend: " << t_backend << " ns/frame" << std::endl;
+    }
+}
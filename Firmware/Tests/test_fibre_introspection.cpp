@@ -0,0 +1,208 @@
+
+#include <doctest.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fibre/protocol.hpp>
+#include <fibre/introspection.hpp>
+
+// Object tree with roughly the shape of the ODrive object tree:
+// odrv.axis0.controller.config.vel_limit
+// The TypeInfos mimic the ones generated from type_info_template.j2 but
+// resolve children by byte offset so that they can be built at runtime. Like
+// in the generated code, the leaves are Property<float> objects.
+
+struct Config { float values[40]; };
+struct Controller { Config config; float values[20]; };
+struct Axis { Controller controller; float values[25]; };
+struct Root { Axis axis0; Axis axis1; float values[30]; };
+
+struct MockMember {
+    std::string name;
+    const TypeInfo* type_info;
+    size_t offset;
+};
+
+// Holds the member tables, sorted by name like the generated ones. This is a
+// separate base so that it's initialized before the TypeInfo base.
+struct MockTables {
+    MockTables(std::vector<MockMember> members) : members_(members) {
+        std::sort(members_.begin(), members_.end(), [](const MockMember& a, const MockMember& b) {
+            return strcmp(a.name.c_str(), b.name.c_str()) < 0;
+        });
+        for (auto& member : members_) {
+            properties_.push_back({member.name.c_str(), member.type_info});
+        }
+    }
+    std::vector<MockMember> members_;
+    std::vector<PropertyInfo> properties_;
+};
+
+struct MockTypeInfo : MockTables, TypeInfo {
+    MockTypeInfo(std::vector<MockMember> members)
+        : MockTables(members), TypeInfo(properties_.data(), properties_.size()) {}
+
+    introspectable_storage_t get_child(introspectable_storage_t obj, size_t idx) const override {
+        introspectable_storage_t res{};
+        char* ptr = *(char**)&obj + members_[idx].offset;
+        if (members_[idx].type_info == &FibrePropertyTypeInfo<Property<float>>::singleton) {
+            new (&res) Property<float>((float*)ptr);
+        } else {
+            *(char**)&res = ptr;
+        }
+        return res;
+    }
+
+    template<typename T>
+    Introspectable make(T& obj) const { return make_introspectable(&obj, this); }
+};
+
+static std::vector<MockMember> float_members(const TypeInfo* leaf, size_t base, size_t count, std::vector<std::string> names) {
+    std::vector<MockMember> members;
+    for (size_t i = 0; i < count; ++i) {
+        std::string name = i < names.size() ? names[i] : ("attr_" + std::to_string(i));
+        members.push_back({name, leaf, base + i * sizeof(float)});
+    }
+    return members;
+}
+
+static std::vector<MockMember> concat(std::vector<MockMember> a, std::vector<MockMember> b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+static const TypeInfo* const leaf_type_info = &FibrePropertyTypeInfo<Property<float>>::singleton;
+static const MockTypeInfo config_type_info{float_members(leaf_type_info, offsetof(Config, values), 40, {"vel_limit", "vel_gain", "vel_integrator_gain", "pos_gain", "vel_limit_tolerance"})};
+static const MockTypeInfo controller_type_info{concat(
+    {{"config", &config_type_info, offsetof(Controller, config)}},
+    float_members(leaf_type_info, offsetof(Controller, values), 20, {"input_pos", "input_vel", "input_torque"}))};
+static const MockTypeInfo axis_type_info{concat(
+    {{"controller", &controller_type_info, offsetof(Axis, controller)}},
+    float_members(leaf_type_info, offsetof(Axis, values), 25, {"current_state", "requested_state"}))};
+static const MockTypeInfo root_type_info{concat(
+    {{"axis0", &axis_type_info, offsetof(Root, axis0)}, {"axis1", &axis_type_info, offsetof(Root, axis1)}},
+    float_members(leaf_type_info, offsetof(Root, values), 30, {"vbus_voltage", "ibus", "axis"}))};
+
+static Root root;
+
+static float* resolve(const char* path) {
+    Introspectable obj = root_type_info.make(root).get_child(path, strlen(path) + 1);
+    return obj.is_valid() ? *(float**)&obj.storage_ : nullptr;
+}
+
+TEST_SUITE("fibre_introspection") {
+    TEST_CASE("resolve paths") {
+        CHECK(resolve("axis0.controller.config.vel_limit") == &root.axis0.controller.config.values[0]);
+        CHECK(resolve("axis1.controller.config.vel_limit") == &root.axis1.controller.config.values[0]);
+        CHECK(resolve("axis1.controller.config.vel_limit_tolerance") == &root.axis1.controller.config.values[4]);
+        CHECK(resolve("axis0.controller.input_vel") == &root.axis0.controller.values[1]);
+        CHECK(resolve("axis0.requested_state") == &root.axis0.values[1]);
+        CHECK(resolve("vbus_voltage") == &root.values[0]);
+        CHECK(resolve("axis") == &root.values[2]);
+
+        // every generated member is found
+        for (size_t i = 5; i < 40; ++i) {
+            std::string path = "axis0.controller.config.attr_" + std::to_string(i);
+            CHECK(resolve(path.c_str()) == &root.axis0.controller.config.values[i]);
+        }
+    }
+
+    TEST_CASE("invalid paths") {
+        CHECK(resolve("axis2") == nullptr);
+        CHECK(resolve("axi") == nullptr);
+        CHECK(resolve("axis0.controller.config.vel_lim") == nullptr);
+        CHECK(resolve("axis0.controller.config.vel_limitx") == nullptr);
+        CHECK(resolve("axis0.controller.config.aaa") == nullptr);
+        CHECK(resolve("axis0.controller.config.zzz") == nullptr);
+        CHECK(resolve("axis0.controller.config.vel_limit.foo") == nullptr);
+    }
+
+    TEST_CASE("path is bounded by length") {
+        const char path[] = "axis0.controller.config.vel_limit_tolerance";
+        Introspectable obj = root_type_info.make(root).get_child(path, strlen("axis0.controller.config.vel_limit"));
+        REQUIRE(obj.is_valid());
+        CHECK(*(float**)&obj.storage_ == &root.axis0.controller.config.values[0]);
+    }
+
+    TEST_CASE("resolved handles can be reused") {
+        const char path[] = "axis0.controller.config.vel_limit";
+        Introspectable handle = root_type_info.make(root).get_child(path, sizeof(path));
+        REQUIRE(handle.is_valid());
+        CHECK(handle.get_type_info() == leaf_type_info);
+
+        // The handle refers to the object, not to the path
+        root.axis0.controller.config.values[0] = 3.0f;
+        CHECK(**(float**)&handle.storage_ == 3.0f);
+        **(float**)&handle.storage_ = 5.0f;
+        CHECK(root.axis0.controller.config.values[0] == 5.0f);
+    }
+
+    TEST_CASE("table order check") {
+        // The generated tables static_assert this. Upper case sorts before
+        // lower case in strcmp() order, unlike in Jinja's default sort.
+        CHECK(is_sorted_by_name({"I_bus", "config", "current_control", "error"}));
+        CHECK(is_sorted_by_name({"DC_calib_phA", "DC_calib_phB", "I_bus", "config"}));
+        CHECK(!is_sorted_by_name({"config", "current_control", "error", "I_bus"}));
+        CHECK(!is_sorted_by_name({"DC_calib_phA", "DC_calib_phA"}));
+        CHECK(!is_sorted_by_name({"vel_limit_tolerance", "vel_limit"}));
+        CHECK(is_sorted_by_name({"vel_limit", "vel_limit_tolerance"}));
+        CHECK(is_sorted_by_name({"config"}));
+    }
+}
+
+TEST_SUITE("fibre_introspection_benchmark" * doctest::skip()) {
+    TEST_CASE("path resolution") {
+        const char* paths[] = {
+            "axis0.controller.config.vel_limit",
+            "axis1.controller.config.attr_39",
+            "axis0.controller.input_vel",
+            "vbus_voltage",
+        };
+        Introspectable root_obj = root_type_info.make(root);
+        constexpr size_t N = 1000000;
+
+        // Reads and writes the property the way the ASCII r/w commands do
+        char buffer[16];
+        auto read_write = [&](const Introspectable& obj, float value) {
+            const StringConvertibleTypeInfo* string_type_info = dynamic_cast<const StringConvertibleTypeInfo*>(obj.get_type_info());
+            const FloatSettableTypeInfo* float_type_info = dynamic_cast<const FloatSettableTypeInfo*>(obj.get_type_info());
+            return string_type_info->get_string(obj, buffer, sizeof(buffer))
+                && float_type_info->set_float(obj, value);
+        };
+
+        size_t n_ok = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+            n_ok += root_obj.get_child(paths[i % 4], 64).is_valid();
+        }
+        auto end = std::chrono::steady_clock::now();
+        double t_resolve = std::chrono::duration<double, std::nano>(end - start).count() / N;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+            n_ok += read_write(root_obj.get_child(paths[i % 4], 64), (float)i);
+        }
+        end = std::chrono::steady_clock::now();
+        double t_uncached = std::chrono::duration<double, std::nano>(end - start).count() / N;
+
+        std::vector<Introspectable> handles;
+        for (const char* path : paths)
+            handles.push_back(root_obj.get_child(path, 64));
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+            n_ok += read_write(handles[i % 4], (float)i);
+        }
+        end = std::chrono::steady_clock::now();
+        double t_cached = std::chrono::duration<double, std::nano>(end - start).count() / N;
+
+        CHECK(n_ok == 3 * N);
+        CHECK(root.values[0] == (float)(N - 1)); // vbus_voltage was written last
+        std::cout << "resolve path:               " << t_resolve << " ns" << std::endl;
+        std::cout << "resolve path, read, write:  " << t_uncached << " ns" << std::endl;
+        std::cout << "cached handle, read, write: " << t_cached << " ns" << std::endl;
+    }
+}
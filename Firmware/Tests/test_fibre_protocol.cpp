@@ -0,0 +1,892 @@
+
+#include <doctest.h>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "fibre/cpp/protocol.cpp"
+#include "communication/i2c_register_map.cpp"
+
+// Minimal stand-ins for the symbols that are normally autogenerated
+const unsigned char fibre::embedded_json[] = "[{\"name\":\"test\"}]";
+const size_t fibre::embedded_json_length = sizeof(fibre::embedded_json) - 1;
+const unsigned char fibre::embedded_json_compressed[] = {0x78, 0xda, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+const size_t fibre::embedded_json_compressed_length = sizeof(fibre::embedded_json_compressed);
+const uint16_t fibre::json_crc_ = 0x1234;
+const uint32_t fibre::json_version_id_ = 0xdeadbeef;
+
+static std::vector<uint8_t> endpoint1_response;
+static uint32_t endpoint2_value;
+
+bool fibre::endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    if (idx == 0) {
+        return endpoint0_handler(input_buffer, output_buffer);
+    } else if (idx == 1) {
+        size_t n = std::min(output_buffer->size(), endpoint1_response.size());
+        memcpy(output_buffer->begin(), endpoint1_response.data(), n);
+        *output_buffer = output_buffer->skip(n);
+        return true;
+    } else if (idx == 2) {
+        // uint32 property with exchange semantics
+        uint32_t old_value = endpoint2_value;
+        std::optional<uint32_t> new_value = read_le<uint32_t>(input_buffer);
+        if (new_value.has_value())
+            endpoint2_value = *new_value;
+        write_le<uint32_t>(old_value, output_buffer);
+        return true;
+    }
+    return false;
+}
+
+bool fibre::is_property_endpoint(int idx) {
+    return idx == 1 || idx == 2 || idx == 3; // 3 has a setter with side effects
+}
+
+bool fibre::is_transactional_endpoint(int idx) {
+    return idx == 2;
+}
+
+class PacketCollector : public PacketSink {
+public:
+    int process_packet(const uint8_t* buffer, size_t length) override {
+        packets.emplace_back(buffer, buffer + length);
+        return 0;
+    }
+    std::vector<std::vector<uint8_t>> packets;
+};
+
+class ByteCollector : public StreamSink {
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        bytes.insert(bytes.end(), buffer, buffer + length);
+        if (processed_bytes)
+            *processed_bytes += length;
+        return 0;
+    }
+    size_t get_free_space() override { return SIZE_MAX; }
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<uint8_t> make_batch(std::vector<std::tuple<uint16_t, std::vector<uint8_t>, uint8_t>> entries, uint16_t json_crc = fibre::json_crc_) {
+    std::vector<uint8_t> payload(6);
+    write_le<uint32_t>(ENDPOINT0_BATCH, payload.data());
+    write_le<uint16_t>(json_crc, payload.data() + 4);
+    for (auto& [endpoint_id, input, output_length] : entries) {
+        payload.push_back(endpoint_id & 0xff);
+        payload.push_back(endpoint_id >> 8);
+        payload.push_back((uint8_t)input.size());
+        payload.push_back(output_length);
+        payload.insert(payload.end(), input.begin(), input.end());
+    }
+    return payload;
+}
+
+static std::vector<uint8_t> make_transaction(uint8_t flags, std::vector<std::tuple<uint16_t, std::vector<uint8_t>>> entries) {
+    std::vector<uint8_t> payload(7);
+    write_le<uint32_t>(ENDPOINT0_TRANSACTION, payload.data());
+    write_le<uint16_t>(fibre::json_crc_, payload.data() + 4);
+    payload[6] = flags;
+    for (auto& [endpoint_id, input] : entries) {
+        payload.push_back(endpoint_id & 0xff);
+        payload.push_back(endpoint_id >> 8);
+        payload.push_back((uint8_t)input.size());
+        payload.insert(payload.end(), input.begin(), input.end());
+    }
+    return payload;
+}
+
+static std::vector<uint8_t> make_payload(size_t length) {
+    std::vector<uint8_t> payload(length);
+    for (size_t i = 0; i < length; ++i)
+        payload[i] = (uint8_t)(i * 7 + 3);
+    return payload;
+}
+
+static std::vector<uint8_t> make_request(uint16_t endpoint_id, uint16_t response_length, std::vector<uint8_t> input, uint16_t trailer, uint16_t seq_no = 0x0081) {
+    std::vector<uint8_t> packet(6 + input.size() + 2);
+    write_le<uint16_t>(seq_no, packet.data());
+    write_le<uint16_t>(endpoint_id | 0x8000, packet.data() + 2);
+    write_le<uint16_t>(response_length, packet.data() + 4);
+    std::copy(input.begin(), input.end(), packet.begin() + 6);
+    write_le<uint16_t>(trailer, packet.data() + 6 + input.size());
+    return packet;
+}
+
+TEST_SUITE("fibre_crc") {
+    TEST_CASE("reference values") {
+        // Examples from docs/protocol.md
+        const uint8_t a[] = {0x01, 0x02, 0x03, 0x04};
+        const uint8_t b[] = {0x05, 0x04, 0x03, 0x02, 0x01};
+        CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, a, sizeof(a)) == 0x61);
+        CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, b, sizeof(b)) == 0x64);
+        CHECK(calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, a, sizeof(a)) == 0x672E);
+        CHECK(calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, b, sizeof(b)) == 0xE251);
+        CHECK(calc_crc16_slice_by_4<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, b, sizeof(b)) == 0xE251);
+    }
+
+    TEST_CASE("lookup tables match bitwise calculation") {
+        std::mt19937 rng(42);
+        std::vector<uint8_t> data(1000);
+        for (auto& byte : data)
+            byte = (uint8_t)rng();
+
+        for (size_t length : {0, 1, 2, 3, 4, 5, 7, 8, 63, 1000}) {
+            uint8_t crc8 = CANONICAL_CRC8_INIT;
+            uint16_t crc16 = CANONICAL_CRC16_INIT;
+            for (size_t i = 0; i < length; ++i) {
+                crc8 = calc_crc_bitwise<uint8_t, CANONICAL_CRC8_POLYNOMIAL>(crc8, data[i]);
+                crc16 = calc_crc_bitwise<uint16_t, CANONICAL_CRC16_POLYNOMIAL>(crc16, data[i]);
+            }
+            CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, data.data(), length) == crc8);
+            CHECK(calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, data.data(), length) == crc16);
+            CHECK(calc_crc16_slice_by_4<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, data.data(), length) == crc16);
+        }
+    }
+
+    TEST_CASE("tables are generated at compile time") {
+        static_assert(crc_table<uint8_t, CANONICAL_CRC8_POLYNOMIAL>.table[0][1] == CANONICAL_CRC8_POLYNOMIAL);
+        static_assert(crc_table<uint16_t, CANONICAL_CRC16_POLYNOMIAL>.table[0][0] == 0);
+        CHECK(crc_table<uint16_t, CANONICAL_CRC16_POLYNOMIAL, 4>.table[0][0x80] == calc_crc_bitwise<uint16_t, CANONICAL_CRC16_POLYNOMIAL>(0, 0x80));
+    }
+}
+
+TEST_SUITE("fibre_crc_benchmark" * doctest::skip()) {
+    template<typename TFn>
+    double mb_per_s(const std::vector<uint8_t>& data, TFn fn) {
+        uint32_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t rep = 0; rep < 100; ++rep)
+            sum += fn(data.data(), data.size());
+        auto end = std::chrono::steady_clock::now();
+        CHECK(sum != 0); // keep the loop alive
+        return 100.0 * data.size() / std::chrono::duration<double, std::micro>(end - start).count();
+    }
+
+    TEST_CASE("crc16 throughput") {
+        std::mt19937 rng(1234);
+        std::vector<uint8_t> data(100000);
+        for (auto& byte : data)
+            byte = (uint8_t)rng();
+
+        double t_bitwise = mb_per_s(data, [](const uint8_t* buf, size_t len) {
+            uint16_t crc = CANONICAL_CRC16_INIT;
+            while (len--)
+                crc = calc_crc_bitwise<uint16_t, CANONICAL_CRC16_POLYNOMIAL>(crc, *(buf++));
+            return crc;
+        });
+        double t_table = mb_per_s(data, [](const uint8_t* buf, size_t len) {
+            return calc_crc<uint16_t, CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, buf, len);
+        });
+        double t_slice4 = mb_per_s(data, [](const uint8_t* buf, size_t len) {
+            return calc_crc16_slice_by_4<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, buf, len);
+        });
+
+        std::cout << "bitwise:    " << t_bitwise << " MB/s" << std::endl;
+        std::cout << "table:      " << t_table << " MB/s" << std::endl;
+        std::cout << "slice-by-4: " << t_slice4 << " MB/s" << std::endl;
+    }
+}
+
+TEST_SUITE("fibre_framing") {
+    TEST_CASE("short packets use the original framing") {
+        ByteCollector stream;
+        StreamBasedPacketSink sink(stream);
+        auto payload = make_payload(127);
+        CHECK(sink.process_packet(payload.data(), payload.size()) == 0);
+        REQUIRE(stream.bytes.size() == 3 + 127 + 2);
+        CHECK(stream.bytes[0] == 0xAA);
+        CHECK(stream.bytes[1] == 127);
+        CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, stream.bytes.data(), 3) == 0);
+    }
+
+    TEST_CASE("varint length") {
+        ByteCollector stream;
+        StreamBasedPacketSink sink(stream);
+        auto payload = make_payload(300);
+        CHECK(sink.process_packet(payload.data(), payload.size()) == 0);
+        REQUIRE(stream.bytes.size() == 4 + 300 + 2);
+        CHECK(stream.bytes[1] == 0xAC); // 300 = 0b10 0101100
+        CHECK(stream.bytes[2] == 0x02);
+        CHECK(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, stream.bytes.data(), 4) == 0);
+    }
+
+    TEST_CASE("round trip") {
+        for (size_t length : {0, 1, 127, 128, 500, 1000}) {
+            ByteCollector stream;
+            StreamBasedPacketSink sink(stream);
+            auto payload = make_payload(length);
+            CHECK(sink.process_packet(payload.data(), payload.size()) == 0);
+
+            PacketCollector packets;
+            uint8_t rx_buf[1002];
+            StreamToPacketSegmenter segmenter(packets, rx_buf, sizeof(rx_buf));
+
+            // garbage before the packet and feeding byte by byte must not matter
+            const uint8_t garbage[] = {0x00, 0xAA, 0xFF, 'r', ' ', '0', '\n'};
+            segmenter.process_bytes(garbage, sizeof(garbage), nullptr);
+            for (uint8_t byte : stream.bytes)
+                segmenter.process_bytes(&byte, 1, nullptr);
+
+            REQUIRE(packets.packets.size() == 1);
+            CHECK(packets.packets[0] == payload);
+        }
+    }
+
+    TEST_CASE("oversized and corrupted packets are dropped") {
+        ByteCollector stream;
+        StreamBasedPacketSink sink(stream);
+        auto large = make_payload(200);
+        auto small = make_payload(20);
+        sink.process_packet(large.data(), large.size());
+        sink.process_packet(small.data(), small.size());
+        std::vector<uint8_t> corrupted = stream.bytes;
+        corrupted[1] ^= 0x01;
+        sink.process_packet(small.data(), small.size());
+
+        PacketCollector packets;
+        uint8_t rx_buf[RX_BUF_SIZE];
+        StreamToPacketSegmenter segmenter(packets, rx_buf, sizeof(rx_buf));
+        segmenter.process_bytes(stream.bytes.data(), stream.bytes.size(), nullptr);
+        REQUIRE(packets.packets.size() == 2);
+        CHECK(packets.packets[0] == small);
+        CHECK(packets.packets[1] == small);
+
+        packets.packets.clear();
+        segmenter.process_bytes(corrupted.data(), corrupted.size(), nullptr);
+        CHECK(packets.packets.size() == 1);
+    }
+    TEST_CASE("frame buffer gathers the frame into one write") {
+        class WriteCounter : public ByteCollector {
+        public:
+            int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+                n_writes++;
+                return ByteCollector::process_bytes(buffer, length, processed_bytes);
+            }
+            size_t n_writes = 0;
+        };
+
+        for (size_t length : {0, 1, 127, 128, 300}) {
+            auto payload = make_payload(length);
+            ByteCollector reference;
+            StreamBasedPacketSink(reference).process_packet(payload.data(), payload.size());
+
+            WriteCounter stream;
+            uint8_t frame_buf[128 + MAX_FRAME_OVERHEAD];
+            StreamBasedPacketSink sink(stream, frame_buf, sizeof(frame_buf));
+            CHECK(sink.process_packet(payload.data(), payload.size()) == 0);
+            CHECK(stream.bytes == reference.bytes);
+            // Packets that don't fit into the frame buffer are still sent
+            CHECK(stream.n_writes == (length <= 128 ? 1 : 3));
+        }
+    }
+
+    TEST_CASE("contiguous frames are passed on without copying") {
+        class PointerCollector : public PacketCollector {
+        public:
+            int process_packet(const uint8_t* buffer, size_t length) override {
+                pointers.push_back(buffer);
+                return PacketCollector::process_packet(buffer, length);
+            }
+            std::vector<const uint8_t*> pointers;
+        };
+
+        ByteCollector stream;
+        StreamBasedPacketSink sink(stream);
+        auto first = make_payload(20);
+        auto second = make_payload(100);
+        sink.process_packet(first.data(), first.size());
+        sink.process_packet(second.data(), second.size());
+        sink.process_packet(first.data(), first.size());
+
+        PointerCollector packets;
+        uint8_t rx_buf[RX_BUF_SIZE];
+        StreamToPacketSegmenter segmenter(packets, rx_buf, sizeof(rx_buf));
+
+        // The second frame is split across two calls
+        size_t split = 3 + 20 + 2 + 50;
+        size_t processed_bytes = 0;
+        segmenter.process_bytes(stream.bytes.data(), split, &processed_bytes);
+        segmenter.process_bytes(stream.bytes.data() + split, stream.bytes.size() - split, &processed_bytes);
+        CHECK(processed_bytes == stream.bytes.size());
+
+        REQUIRE(packets.packets.size() == 3);
+        CHECK(packets.packets[0] == first);
+        CHECK(packets.packets[1] == second);
+        CHECK(packets.packets[2] == first);
+        CHECK(packets.pointers[0] == stream.bytes.data() + 3);
+        CHECK(packets.pointers[1] == rx_buf);
+        CHECK(packets.pointers[2] == stream.bytes.data() + 3 + 20 + 2 + 3 + 100 + 2 + 3);
+    }
+}
+
+TEST_SUITE("fibre_framing_benchmark" * doctest::skip()) {
+    class NullStream : public StreamSink {
+    public:
+        int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+            n_bytes += length;
+            return 0;
+        }
+        size_t get_free_space() override { return SIZE_MAX; }
+        size_t n_bytes = 0;
+    };
+
+    class NullPacketSink : public PacketSink {
+    public:
+        int process_packet(const uint8_t* buffer, size_t length) override {
+            n_bytes += length;
+            return 0;
+        }
+        size_t n_bytes = 0;
+    };
+
+    constexpr size_t N_PACKETS = 100000;
+    constexpr size_t PACKET_LENGTH = 64;
+
+    TEST_CASE("segmenter throughput") {
+        ByteCollector stream;
+        StreamBasedPacketSink sink(stream);
+        auto payload = make_payload(PACKET_LENGTH);
+        for (size_t i = 0; i < 1000; ++i)
+            sink.process_packet(payload.data(), payload.size());
+
+        // Feeding single bytes exercises the byte-wise state machine,
+        // 256 byte chunks correspond to the UART DMA buffer.
+        for (size_t chunk_size : {(size_t)1, (size_t)256}) {
+            NullPacketSink packets;
+            uint8_t rx_buf[RX_BUF_SIZE];
+            StreamToPacketSegmenter segmenter(packets, rx_buf, sizeof(rx_buf));
+            auto start = std::chrono::steady_clock::now();
+            for (size_t rep = 0; rep < N_PACKETS / 1000; ++rep) {
+                for (size_t pos = 0; pos < stream.bytes.size(); pos += chunk_size) {
+                    size_t length = std::min(chunk_size, stream.bytes.size() - pos);
+                    segmenter.process_bytes(stream.bytes.data() + pos, length, nullptr);
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            CHECK(packets.n_bytes == N_PACKETS * PACKET_LENGTH);
+            double mb_per_s = (N_PACKETS / 1000) * stream.bytes.size() / std::chrono::duration<double, std::micro>(end - start).count();
+            std::cout << "segmenter, " << chunk_size << " byte chunks: " << mb_per_s << " MB/s" << std::endl;
+        }
+    }
+
+    TEST_CASE("packet sink throughput") {
+        auto payload = make_payload(PACKET_LENGTH);
+        uint8_t frame_buf[PACKET_LENGTH + MAX_FRAME_OVERHEAD];
+
+        for (bool gather : {false, true}) {
+            NullStream stream;
+            StreamBasedPacketSink sink(stream, gather ? frame_buf : nullptr, sizeof(frame_buf));
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < N_PACKETS; ++i)
+                sink.process_packet(payload.data(), payload.size());
+            auto end = std::chrono::steady_clock::now();
+            CHECK(stream.n_bytes == N_PACKETS * (PACKET_LENGTH + 3 + 2));
+            double mb_per_s = stream.n_bytes / std::chrono::duration<double, std::micro>(end - start).count();
+            std::cout << "packet sink, " << (gather ? "single write: " : "three writes: ") << mb_per_s << " MB/s" << std::endl;
+        }
+    }
+}
+
+TEST_SUITE("fibre_channel") {
+    TEST_CASE("packet size negotiation") {
+        endpoint1_response = make_payload(400);
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        // Before negotiation responses are limited to the legacy size
+        auto request = make_request(1, 1000, {}, fibre::json_crc_);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        CHECK(output.packets[0].size() == TX_BUF_SIZE);
+
+        // Negotiate
+        std::vector<uint8_t> input(8);
+        write_le<uint32_t>(ENDPOINT0_NEGOTIATE_PACKET_SIZE, input.data());
+        write_le<uint32_t>(4096, input.data() + 4);
+        request = make_request(0, 8, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 2);
+        REQUIRE(output.packets[1].size() == 2 + 8);
+        uint32_t max_rx, max_tx;
+        read_le<uint32_t>(&max_rx, output.packets[1].data() + 2);
+        read_le<uint32_t>(&max_tx, output.packets[1].data() + 6);
+        CHECK(max_rx == 100);
+        CHECK(max_tx == sizeof(tx_buf));
+
+        // Now responses can use the whole TX buffer
+        request = make_request(1, 1000, {}, fibre::json_crc_);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 3);
+        CHECK(output.packets[2].size() == sizeof(tx_buf));
+        CHECK(std::equal(output.packets[2].begin() + 2, output.packets[2].end(), endpoint1_response.begin()));
+    }
+
+    TEST_CASE("host limits packet size") {
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        std::vector<uint8_t> input(8);
+        write_le<uint32_t>(ENDPOINT0_NEGOTIATE_PACKET_SIZE, input.data());
+        write_le<uint32_t>(64, input.data() + 4);
+        auto request = make_request(0, 8, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        uint32_t max_tx;
+        read_le<uint32_t>(&max_tx, output.packets[0].data() + 6);
+        CHECK(max_tx == 64);
+    }
+
+    TEST_CASE("packet size below the legacy size is raised") {
+        endpoint1_response = make_payload(400);
+
+        PacketCollector output;
+        uint8_t tx_buf[64];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        for (uint32_t host_max_rx : {0, 1, 2, 16}) {
+            std::vector<uint8_t> input(8);
+            write_le<uint32_t>(ENDPOINT0_NEGOTIATE_PACKET_SIZE, input.data());
+            write_le<uint32_t>(host_max_rx, input.data() + 4);
+            auto request = make_request(0, 8, input, PROTOCOL_VERSION);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            uint32_t max_tx;
+            read_le<uint32_t>(&max_tx, output.packets[0].data() + 6);
+            CHECK(max_tx == TX_BUF_SIZE);
+
+            // Responses still fit into the TX buffer
+            request = make_request(1, 500, {}, fibre::json_crc_);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 2);
+            CHECK(output.packets[1].size() == TX_BUF_SIZE);
+            output.packets.clear();
+        }
+    }
+
+    TEST_CASE("endpoint 0 still serves the JSON") {
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        std::vector<uint8_t> input(4);
+        write_le<uint32_t>(0xffffffff, input.data());
+        auto request = make_request(0, 4, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        uint32_t version_id;
+        read_le<uint32_t>(&version_id, output.packets[0].data() + 2);
+        CHECK(version_id == fibre::json_version_id_);
+    }
+
+    TEST_CASE("compressed JSON") {
+        auto read_compressed = [](uint32_t position, uint16_t max_length) {
+            std::vector<uint8_t> input(8);
+            write_le<uint32_t>(ENDPOINT0_COMPRESSED_JSON, input.data());
+            write_le<uint32_t>(position, input.data() + 4);
+            uint8_t output[16];
+            fibre::cbufptr_t input_buffer{input.data(), input.size()};
+            fibre::bufptr_t output_buffer{output, max_length};
+            REQUIRE(fibre::endpoint0_handler(&input_buffer, &output_buffer));
+            return std::vector<uint8_t>(output, output_buffer.begin());
+        };
+
+        CHECK(read_compressed(0, 4) == std::vector<uint8_t>{0x78, 0xda, 0x01, 0x02});
+        CHECK(read_compressed(8, 4) == std::vector<uint8_t>{0x07, 0x08});
+        CHECK(read_compressed(10, 4).empty());
+        CHECK(read_compressed(0xffffffff, 4).empty());
+    }
+
+    TEST_CASE("retransmitted requests are answered from the history") {
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        auto exchange_endpoint2 = [&](uint32_t value, uint16_t seq_no) {
+            std::vector<uint8_t> input(4);
+            write_le<uint32_t>(value, input.data());
+            auto request = make_request(2, 4, input, fibre::json_crc_, seq_no);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            REQUIRE(output.packets[0].size() == 6);
+            uint32_t old_value;
+            read_le<uint32_t>(&old_value, output.packets[0].data() + 2);
+            output.packets.clear();
+            return old_value;
+        };
+
+        // Without negotiation, duplicates are executed again
+        endpoint2_value = 7;
+        CHECK(exchange_endpoint2(42, 0x0081) == 7);
+        CHECK(exchange_endpoint2(42, 0x0081) == 42);
+
+        std::vector<uint8_t> input(5);
+        write_le<uint32_t>(ENDPOINT0_NEGOTIATE_WINDOW, input.data());
+        input[4] = 100;
+        auto request = make_request(0, 1, input, PROTOCOL_VERSION, 0x0082);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        REQUIRE(output.packets[0].size() == 3);
+        CHECK(output.packets[0][2] == BidirectionalPacketBasedChannel::MAX_WINDOW_SIZE);
+        output.packets.clear();
+
+        // A duplicate gets the same response and is not executed again
+        endpoint2_value = 7;
+        CHECK(exchange_endpoint2(42, 0x0083) == 7);
+        CHECK(exchange_endpoint2(43, 0x0084) == 42);
+        CHECK(exchange_endpoint2(42, 0x0083) == 7);
+        CHECK(endpoint2_value == 43);
+
+        // Requests that dropped out of the window are executed again
+        for (uint16_t seq_no = 0x0085; seq_no < 0x0085 + BidirectionalPacketBasedChannel::MAX_WINDOW_SIZE; ++seq_no)
+            exchange_endpoint2(43, seq_no);
+        CHECK(exchange_endpoint2(44, 0x0083) == 43);
+        CHECK(endpoint2_value == 44);
+    }
+
+    TEST_CASE("history is keyed on the request content") {
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        auto negotiate_window = [&](uint16_t seq_no) {
+            std::vector<uint8_t> input(5);
+            write_le<uint32_t>(ENDPOINT0_NEGOTIATE_WINDOW, input.data());
+            input[4] = 4;
+            auto request = make_request(0, 1, input, PROTOCOL_VERSION, seq_no);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            CHECK(output.packets[0] == std::vector<uint8_t>{(uint8_t)seq_no, (uint8_t)((seq_no >> 8) | 0x80), 4});
+            output.packets.clear();
+        };
+        auto exchange_endpoint0 = [&](uint32_t offset, uint16_t seq_no) {
+            std::vector<uint8_t> input(4);
+            write_le<uint32_t>(offset, input.data());
+            auto request = make_request(0, 4, input, PROTOCOL_VERSION, seq_no);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            auto response = std::vector<uint8_t>(output.packets[0].begin() + 2, output.packets[0].end());
+            output.packets.clear();
+            return response;
+        };
+        auto write_endpoint2 = [&](uint32_t value, uint16_t seq_no) {
+            std::vector<uint8_t> input(4);
+            write_le<uint32_t>(value, input.data());
+            auto request = make_request(2, 4, input, fibre::json_crc_, seq_no);
+            channel.process_packet(request.data(), request.size());
+            output.packets.clear();
+        };
+
+        negotiate_window(0x0081);
+
+        // Different endpoint 0 requests with the same seq_no (e.g. from a new
+        // host session) are executed
+        std::vector<uint8_t> version_id(4);
+        write_le<uint32_t>(fibre::json_version_id_, version_id.data());
+        CHECK(exchange_endpoint0(0xffffffff, 0x0082) == version_id);
+        CHECK(exchange_endpoint0(0, 0x0082) == std::vector<uint8_t>{'[', '{', '"', 'n'});
+
+        // So are writes of a different value
+        endpoint2_value = 7;
+        write_endpoint2(42, 0x0083);
+        write_endpoint2(43, 0x0083);
+        CHECK(endpoint2_value == 43);
+        write_endpoint2(42, 0x0083);
+        CHECK(endpoint2_value == 43); // retransmission
+
+        // Negotiating again clears the history, even with a seq_no that is in
+        // the history
+        negotiate_window(0x0082);
+        write_endpoint2(42, 0x0083);
+        CHECK(endpoint2_value == 42);
+    }
+
+    TEST_CASE("batch request") {
+        endpoint1_response = make_payload(10);
+        endpoint2_value = 7;
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        // read endpoint 1, write + read back endpoint 2, invalid endpoint 9
+        auto batch = make_batch({
+            {1, {}, 4},
+            {2, {42, 0, 0, 0}, 0},
+            {2, {}, 4},
+            {9, {}, 4},
+        });
+        auto request = make_request(0, 30, batch, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        const std::vector<uint8_t> expected = {
+            0x81, 0x80,
+            4, endpoint1_response[0], endpoint1_response[1], endpoint1_response[2], endpoint1_response[3],
+            0,
+            4, 42, 0, 0, 0,
+            0,
+        };
+        CHECK(output.packets[0] == expected);
+        CHECK(endpoint2_value == 42);
+    }
+
+    TEST_CASE("batch request stops when the response is full") {
+        endpoint2_value = 7;
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        auto batch = make_batch({{2, {}, 4}, {2, {1, 0, 0, 0}, 4}});
+        auto request = make_request(0, 8, batch, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        CHECK(output.packets[0].size() == 2 + 5);
+        CHECK(endpoint2_value == 7); // second entry was not executed
+    }
+
+    TEST_CASE("batch request with wrong JSON CRC is ignored") {
+        endpoint2_value = 7;
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+
+        auto batch = make_batch({{2, {1, 0, 0, 0}, 4}}, fibre::json_crc_ + 1);
+        auto request = make_request(0, 30, batch, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        CHECK(output.packets[0].size() == 2);
+        CHECK(endpoint2_value == 7);
+    }
+
+    TEST_CASE("transactions are applied by the control loop") {
+        endpoint2_value = 7;
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+        auto send = [&](std::vector<uint8_t> transaction) {
+            output.packets.clear();
+            auto request = make_request(0, 1, transaction, PROTOCOL_VERSION);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            return output.packets[0];
+        };
+
+        // Staged over two requests, nothing happens before the commit
+        CHECK(send(make_transaction(TRANSACTION_BEGIN, {{2, {1, 0, 0, 0}}})) == std::vector<uint8_t>{0x81, 0x80, TransactionBuffer::kOk});
+        CHECK(send(make_transaction(0, {{2, {42, 0, 0, 0}}})) == std::vector<uint8_t>{0x81, 0x80, TransactionBuffer::kOk});
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 7);
+
+        CHECK(send(make_transaction(TRANSACTION_COMMIT, {})) == std::vector<uint8_t>{0x81, 0x80, TransactionBuffer::kOk});
+        CHECK(endpoint2_value == 7);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 42); // entries are applied in order
+
+        // A second commit has to wait until the first one was applied
+        CHECK(send(make_transaction(TRANSACTION_BEGIN | TRANSACTION_COMMIT, {{2, {43, 0, 0, 0}}}))[2] == TransactionBuffer::kOk);
+        CHECK(send(make_transaction(TRANSACTION_BEGIN | TRANSACTION_COMMIT, {{2, {44, 0, 0, 0}}}))[2] == TransactionBuffer::kBusy);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 43);
+        CHECK(send(make_transaction(TRANSACTION_COMMIT, {}))[2] == TransactionBuffer::kOk);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 44);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 44);
+    }
+
+    TEST_CASE("invalid transactions are rejected") {
+        endpoint2_value = 7;
+
+        PacketCollector output, other_output;
+        uint8_t tx_buf[256], other_tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+        BidirectionalPacketBasedChannel other_channel(other_output, other_tx_buf, sizeof(other_tx_buf), 100);
+        auto send = [](BidirectionalPacketBasedChannel& channel, PacketCollector& output, std::vector<uint8_t> transaction) {
+            output.packets.clear();
+            auto request = make_request(0, 1, transaction, PROTOCOL_VERSION);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            REQUIRE(output.packets[0].size() == 3);
+            return output.packets[0][2];
+        };
+
+        // Only properties can be written. The transaction is discarded.
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN, {{2, {1, 0, 0, 0}}})) == TransactionBuffer::kOk);
+        CHECK(send(channel, output, make_transaction(0, {{9, {1}}})) == TransactionBuffer::kRejected);
+        CHECK(send(channel, output, make_transaction(TRANSACTION_COMMIT, {})) == TransactionBuffer::kRejected);
+
+        // So are read-only properties
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN, {{1, {1}}})) == TransactionBuffer::kRejected);
+
+        // And properties whose setter must not run in the control loop interrupt
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN, {{3, {1, 0, 0, 0}}})) == TransactionBuffer::kRejected);
+
+        // Too many entries
+        std::vector<std::tuple<uint16_t, std::vector<uint8_t>>> entries(TransactionBuffer::MAX_SIZE / 7 + 1, {2, {1, 0, 0, 0}});
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN | TRANSACTION_COMMIT, entries)) == TransactionBuffer::kRejected);
+
+        // One open transaction at a time
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN, {{2, {1, 0, 0, 0}}})) == TransactionBuffer::kOk);
+        CHECK(send(other_channel, other_output, make_transaction(TRANSACTION_BEGIN, {{2, {2, 0, 0, 0}}})) == TransactionBuffer::kBusy);
+        CHECK(send(other_channel, other_output, make_transaction(TRANSACTION_COMMIT, {})) == TransactionBuffer::kRejected);
+        CHECK(send(channel, output, make_transaction(TRANSACTION_COMMIT, {})) == TransactionBuffer::kOk);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 1);
+    }
+
+    TEST_CASE("abandoned transactions are taken over") {
+        endpoint2_value = 7;
+
+        PacketCollector output, other_output;
+        uint8_t tx_buf[256], other_tx_buf[256];
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100);
+        BidirectionalPacketBasedChannel other_channel(other_output, other_tx_buf, sizeof(other_tx_buf), 100);
+        auto send = [](BidirectionalPacketBasedChannel& channel, PacketCollector& output, std::vector<uint8_t> transaction) {
+            output.packets.clear();
+            auto request = make_request(0, 1, transaction, PROTOCOL_VERSION);
+            channel.process_packet(request.data(), request.size());
+            REQUIRE(output.packets.size() == 1);
+            REQUIRE(output.packets[0].size() == 3);
+            return output.packets[0][2];
+        };
+
+        CHECK(send(channel, output, make_transaction(TRANSACTION_BEGIN, {{2, {1, 0, 0, 0}}})) == TransactionBuffer::kOk);
+        for (uint32_t i = 0; i < TransactionBuffer::STALE_TIMEOUT - 1; ++i)
+            fibre::transaction_buffer.apply();
+        CHECK(send(other_channel, other_output, make_transaction(TRANSACTION_BEGIN, {{2, {2, 0, 0, 0}}})) == TransactionBuffer::kBusy);
+
+        // Every request of the owner restarts the timeout
+        CHECK(send(channel, output, make_transaction(0, {{2, {3, 0, 0, 0}}})) == TransactionBuffer::kOk);
+        for (uint32_t i = 0; i < TransactionBuffer::STALE_TIMEOUT - 1; ++i)
+            fibre::transaction_buffer.apply();
+        CHECK(send(other_channel, other_output, make_transaction(TRANSACTION_BEGIN, {{2, {2, 0, 0, 0}}})) == TransactionBuffer::kBusy);
+
+        fibre::transaction_buffer.apply();
+        CHECK(send(other_channel, other_output, make_transaction(TRANSACTION_BEGIN | TRANSACTION_COMMIT, {{2, {2, 0, 0, 0}}})) == TransactionBuffer::kOk);
+        CHECK(send(channel, output, make_transaction(TRANSACTION_COMMIT, {})) == TransactionBuffer::kRejected);
+        fibre::transaction_buffer.apply();
+        CHECK(endpoint2_value == 2);
+    }
+
+    TEST_CASE("telemetry subscription") {
+        endpoint1_response = make_payload(3);
+        endpoint2_value = 7;
+
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        TelemetrySubscription telemetry;
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100, &telemetry);
+
+        std::vector<uint8_t> input(10);
+        write_le<uint32_t>(ENDPOINT0_SUBSCRIBE, input.data());
+        write_le<uint16_t>(fibre::json_crc_, input.data() + 4);
+        write_le<uint32_t>(2, input.data() + 6);
+        input.insert(input.end(), {2, 0, 1, 0});
+        auto request = make_request(0, 16, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        CHECK(output.packets[0] == std::vector<uint8_t>{0x81, 0x80, 4, 3});
+        output.packets.clear();
+
+        // nothing to send until a sample was taken
+        CHECK(channel.send_telemetry() == 0);
+        telemetry.sample(100);
+        CHECK(!telemetry.has_sample()); // decimation
+        telemetry.sample(101);
+        endpoint2_value = 8; // changes after sampling must not show up
+        CHECK(channel.send_telemetry() == 0);
+        REQUIRE(output.packets.size() == 1);
+        const std::vector<uint8_t> expected = {
+            0x00, 0xff,
+            101, 0, 0, 0,
+            7, 0, 0, 0,
+            endpoint1_response[0], endpoint1_response[1], endpoint1_response[2],
+        };
+        CHECK(output.packets[0] == expected);
+
+        // a sample is only sent once
+        channel.send_telemetry();
+        CHECK(output.packets.size() == 1);
+
+        // unsubscribe
+        input.resize(10);
+        write_le<uint32_t>(0, input.data() + 6);
+        request = make_request(0, 16, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        telemetry.sample(102);
+        telemetry.sample(103);
+        CHECK(!telemetry.has_sample());
+    }
+
+    TEST_CASE("telemetry subscription rejects functions") {
+        PacketCollector output;
+        uint8_t tx_buf[256];
+        TelemetrySubscription telemetry;
+        BidirectionalPacketBasedChannel channel(output, tx_buf, sizeof(tx_buf), 100, &telemetry);
+
+        std::vector<uint8_t> input(10);
+        write_le<uint32_t>(ENDPOINT0_SUBSCRIBE, input.data());
+        write_le<uint16_t>(fibre::json_crc_, input.data() + 4);
+        write_le<uint32_t>(1, input.data() + 6);
+        input.insert(input.end(), {2, 0, 9, 0});
+        auto request = make_request(0, 16, input, PROTOCOL_VERSION);
+        channel.process_packet(request.data(), request.size());
+        REQUIRE(output.packets.size() == 1);
+        CHECK(output.packets[0].size() == 2);
+        telemetry.sample(100);
+        CHECK(!telemetry.has_sample());
+    }
+}
+
+TEST_SUITE("i2c_register_map") {
+    TEST_CASE("block read and write") {
+        endpoint1_response = make_payload(3);
+        endpoint2_value = 7;
+        I2CRegisterMap map;
+        const uint8_t ids[] = {2, 0, 1, 0};
+        REQUIRE(map.configure({ids, sizeof(ids)}));
+        CHECK(map.get_register_count() == 2);
+
+        uint8_t buffer[16];
+        REQUIRE(map.read(0, buffer) == 7);
+        uint32_t value;
+        read_le<uint32_t>(&value, buffer);
+        CHECK(value == 7);
+        CHECK(std::equal(buffer + 4, buffer + 7, endpoint1_response.begin()));
+
+        // The second value doesn't fit and is left out
+        CHECK(map.read(0, {buffer, 6}) == 4);
+        CHECK(map.read(1, buffer) == 3);
+        CHECK(map.read(2, buffer) == 0);
+
+        write_le<uint32_t>(42, buffer);
+        CHECK(map.write(0, {buffer, 4}) == 1);
+        CHECK(endpoint2_value == 42);
+        CHECK(map.write(0, {buffer, 3}) == 0);
+        CHECK(endpoint2_value == 42);
+    }
+
+    TEST_CASE("invalid maps are rejected") {
+        endpoint1_response = make_payload(3);
+        I2CRegisterMap map;
+        const uint8_t valid_ids[] = {2, 0};
+        REQUIRE(map.configure({valid_ids, sizeof(valid_ids)}));
+        const uint8_t invalid_ids[] = {2, 0, 9, 0};
+        CHECK(!map.configure({invalid_ids, sizeof(invalid_ids)}));
+        CHECK(map.get_register_count() == 0);
+
+        std::vector<uint8_t> too_many_ids(2 * (I2CRegisterMap::MAX_REGISTERS + 1), 0);
+        for (size_t i = 0; i < too_many_ids.size(); i += 2)
+            too_many_ids[i] = 1;
+        CHECK(!map.configure({too_many_ids.data(), too_many_ids.size()}));
+        CHECK(!map.configure({valid_ids, (size_t)0}));
+    }
+}
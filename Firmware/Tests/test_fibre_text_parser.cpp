@@ -0,0 +1,173 @@
+
+#include <doctest.h>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fibre/text_parser.hpp>
+
+static fibre::cbufptr_t to_buf(const char* str) {
+    return {reinterpret_cast<const unsigned char*>(str), strlen(str)};
+}
+
+static std::optional<float> float_from(const char* str) {
+    fibre::cbufptr_t buf = to_buf(str);
+    return parse_float(&buf);
+}
+
+// Distance in units in the last place
+static uint32_t ulp_distance(float a, float b) {
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(a));
+    memcpy(&ib, &b, sizeof(b));
+    if (ia < 0) ia = INT32_MIN - ia;
+    if (ib < 0) ib = INT32_MIN - ib;
+    return ia > ib ? ia - ib : ib - ia;
+}
+
+TEST_SUITE("fibre_text_parser") {
+    TEST_CASE("integers") {
+        fibre::cbufptr_t buf = to_buf("  42 -7 +3 0x1f 017 x");
+        CHECK(parse_int<unsigned>(&buf) == 42u);
+        CHECK(parse_int<int>(&buf) == -7);
+        CHECK(parse_int<int>(&buf) == 3);
+        CHECK(parse_int<int>(&buf, 0) == 0x1f);
+        CHECK(parse_int<int>(&buf, 0) == 017);
+        CHECK(parse_int<int>(&buf) == std::nullopt);
+        CHECK(buf.size() == 1); // stops where the number was expected
+
+        buf = to_buf("-1");
+        CHECK(parse_int<unsigned>(&buf) == UINT_MAX);
+        buf = to_buf("99999999999 -99999999999 300");
+        CHECK(parse_int<int32_t>(&buf) == INT32_MAX);
+        CHECK(parse_int<int32_t>(&buf) == INT32_MIN);
+        CHECK(parse_int<uint8_t>(&buf) == 44); // truncated like %hhu
+
+        // "0x" without hex digits is a zero followed by "x"
+        buf = to_buf("0xg");
+        CHECK(parse_int<int>(&buf, 0) == 0);
+        CHECK(buf.size() == 2);
+    }
+
+    TEST_CASE("floats") {
+        CHECK(float_from("1.5") == 1.5f);
+        CHECK(float_from("-0.25") == -0.25f);
+        CHECK(float_from("  +10") == 10.0f);
+        CHECK(float_from(".5") == 0.5f);
+        CHECK(float_from("3.") == 3.0f);
+        CHECK(float_from("1e3") == 1000.0f);
+        CHECK(float_from("2.5E-2") == 0.025f);
+        CHECK(float_from("123.456") == 123.456f);
+        CHECK(float_from("1e40") == INFINITY);
+        CHECK(float_from("1e-50") == 0.0f);
+        CHECK(float_from("-inf") == -INFINITY);
+        CHECK(float_from("Infinity") == INFINITY);
+        CHECK(std::isnan(*float_from("nan")));
+        CHECK(float_from("") == std::nullopt);
+        CHECK(float_from("-") == std::nullopt);
+        CHECK(float_from(".") == std::nullopt);
+        CHECK(float_from("abc") == std::nullopt);
+
+        // An exponent without digits is not part of the number
+        fibre::cbufptr_t buf = to_buf("2e+ 1");
+        CHECK(parse_float(&buf) == 2.0f);
+        CHECK(buf.size() == 4);
+    }
+
+    TEST_CASE("floats match strtof") {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> mantissa(-10.0f, 10.0f);
+        std::uniform_int_distribution<int> exponent(-40, 38);
+        std::uniform_int_distribution<int> precision(1, 9);
+        char str[64];
+        for (size_t i = 0; i < 100000; ++i) {
+            snprintf(str, sizeof(str), "%.*e", precision(rng), (double)mantissa(rng) * pow(10.0, exponent(rng)));
+            float expected = strtof(str, nullptr);
+            std::optional<float> actual = float_from(str);
+            REQUIRE(actual.has_value());
+            CHECK_MESSAGE(ulp_distance(*actual, expected) <= 1, str);
+        }
+
+        // Typical setpoints must be exact
+        for (int i = -100000; i <= 100000; i += 7) {
+            snprintf(str, sizeof(str), "%.3f", i / 1000.0);
+            CHECK(float_from(str) == strtof(str, nullptr));
+        }
+    }
+
+    TEST_CASE("tokens") {
+        char token[8];
+        fibre::cbufptr_t buf = to_buf(" axis0.requested_state 8");
+        CHECK(parse_token(&buf, token, sizeof(token)) == 7u);
+        CHECK(std::string(token) == "axis0.r");
+        CHECK(parse_token(&buf, token, sizeof(token)) == 7u);
+        CHECK(parse_token(&buf, token, sizeof(token)) == 7u);
+        CHECK(std::string(token) == "d_state");
+        CHECK(parse_token(&buf, token, sizeof(token)) == 1u);
+        CHECK(std::string(token) == "8");
+        CHECK(parse_token(&buf, token, sizeof(token)) == std::nullopt);
+        CHECK(std::string(token) == "");
+    }
+
+    TEST_CASE("arguments match sscanf") {
+        const char* lines[] = {
+            " 0 1.5", " 1 -2 3 4", " 1 2 abc 4", "", " ", " x", " 0", " -1 2", " 0 1e3 0.5",
+            "1 2", " 0\t7.25  -1 ", " 0 inf",
+        };
+        for (const char* line : lines) {
+            unsigned motor_number = 0, ref_motor_number = 0;
+            float values[3] = {0}, ref_values[3] = {0};
+            int n_parsed = parse_args(to_buf(line), &motor_number, &values[0], &values[1], &values[2]);
+            int n_ref = sscanf(line, "%u %f %f %f", &ref_motor_number, &ref_values[0], &ref_values[1], &ref_values[2]);
+            CHECK_MESSAGE(n_parsed == std::max(n_ref, 0), line);
+            CHECK(motor_number == ref_motor_number);
+            for (size_t i = 0; i < 3; ++i)
+                CHECK(values[i] == ref_values[i]);
+        }
+
+        unsigned motor_number;
+        int count, ref_count;
+        CHECK(parse_args(to_buf(" 1 0x10"), &motor_number, &count) == 2);
+        sscanf(" 1 0x10", "%u %i", &motor_number, &ref_count);
+        CHECK(count == ref_count);
+    }
+}
+
+TEST_SUITE("fibre_text_parser_benchmark" * doctest::skip()) {
+    TEST_CASE("ascii command lines") {
+        // Arguments of typical ASCII protocol commands (without the command character)
+        const char* lines[] = {
+            " 0 10.5 2.25 0.1", " 1 -3.75", " 0 12.3456 0", " 1 0.001", " 0",
+        };
+        constexpr size_t N = 1000000;
+
+        unsigned motor_number;
+        float a, b, c;
+        float sum = 0.0f;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+            int n = sscanf(lines[i % 5], "%u %f %f %f", &motor_number, &a, &b, &c);
+            sum += n + a;
+        }
+        double t_sscanf = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<fibre::cbufptr_t> bufs;
+        for (const char* line : lines)
+            bufs.push_back(to_buf(line));
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+            int n = parse_args(bufs[i % 5], &motor_number, &a, &b, &c);
+            sum += n + a;
+        }
+        double t_parser = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        CHECK(sum != 0.0f); // keep the loops alive
+        std::cout << "sscanf:      " << N / t_sscanf << " lines/s" << std::endl;
+        std::cout << "text parser: " << N / t_parser << " lines/s" << std::endl;
+    }
+}
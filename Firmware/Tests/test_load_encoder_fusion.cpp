@@ -0,0 +1,75 @@
+
+#include <doctest.h>
+#include <optional>
+
+#include "MotorControl/load_encoder_fusion.hpp"
+
+static constexpr float dt = 0.000125f;
+
+TEST_SUITE("load_encoder_fusion") {
+    TEST_CASE("deflection converges to the load encoder") {
+        LoadEncoderFusion fusion;
+        fusion.start();
+
+        // Load lags the motor by 0.1 turn. The filter starts out at the
+        // first measured deflection, so step the load side by 0.05 turn
+        // afterwards and check that the fused position follows it.
+        std::optional<float> pos = 0.9f, circular = 0.9f, vel = 0.0f;
+        fusion.update(dt, 1.0f, 20.0f, 1.0f, &pos, &circular, 1.0f, &vel);
+        REQUIRE(fusion.is_valid());
+        CHECK(fusion.get_deflection() == doctest::Approx(-0.1f));
+        CHECK(*pos == doctest::Approx(0.9f));
+
+        for (int i = 0; i < 8000; ++i) { // 1s = 20 time constants
+            pos = 0.95f; circular = 0.95f; vel = 0.0f;
+            fusion.update(dt, 1.0f, 20.0f, 1.0f, &pos, &circular, 1.0f, &vel);
+        }
+        CHECK(fusion.get_deflection() == doctest::Approx(-0.05f).epsilon(0.001));
+        CHECK(*pos == doctest::Approx(0.95f).epsilon(0.001));
+        CHECK(*circular == doctest::Approx(0.95f).epsilon(0.001));
+
+        // High frequency motion of the motor passes through immediately
+        pos = 0.95f; circular = 0.95f; vel = 0.0f;
+        fusion.update(dt, 1.0f, 20.0f, 1.01f, &pos, &circular, 1.0f, &vel);
+        CHECK(*pos == doctest::Approx(0.96f).epsilon(0.001));
+    }
+
+    TEST_CASE("motor estimates are scaled to load units") {
+        LoadEncoderFusion fusion;
+        fusion.start();
+        std::optional<float> pos = 1.0f, circular = std::nullopt, vel = 10.0f;
+        fusion.update(dt, 0.25f, 20.0f, 4.0f, &pos, &circular, std::nullopt, &vel);
+        CHECK(*vel == doctest::Approx(2.5f));
+        CHECK(fusion.get_deflection() == doctest::Approx(0.0f));
+        CHECK(*pos == doctest::Approx(1.0f));
+        CHECK(!circular.has_value());
+    }
+
+    TEST_CASE("invalid estimates") {
+        LoadEncoderFusion fusion;
+        fusion.start();
+        std::optional<float> pos = 1.0f, circular = 0.5f, vel = 1.0f;
+        fusion.update(dt, 1.0f, 20.0f, 1.0f, &pos, &circular, 1.0f, &vel);
+        REQUIRE(fusion.is_valid());
+
+        // Missing motor position invalidates the fused position
+        pos = 1.0f; circular = 0.5f; vel = 1.0f;
+        fusion.update(dt, 1.0f, 20.0f, std::nullopt, &pos, &circular, 1.0f, &vel);
+        CHECK(!pos.has_value());
+        CHECK(!circular.has_value());
+        CHECK(!fusion.is_valid());
+
+        // Missing load position too, and the filter restarts at the new
+        // deflection once both are back
+        pos = std::nullopt; circular = std::nullopt; vel = 1.0f;
+        fusion.update(dt, 1.0f, 20.0f, 1.0f, &pos, &circular, 1.0f, &vel);
+        CHECK(!pos.has_value());
+        pos = 1.3f; circular = 0.3f;
+        fusion.update(dt, 1.0f, 20.0f, 1.0f, &pos, &circular, 1.0f, &vel);
+        CHECK(fusion.get_deflection() == doctest::Approx(0.3f));
+
+        fusion.stop();
+        CHECK(!fusion.is_active());
+        CHECK(!fusion.is_valid());
+    }
+}
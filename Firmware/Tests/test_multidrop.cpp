@@ -0,0 +1,102 @@
+
+#include <doctest.h>
+#include <optional>
+#include <vector>
+
+#include "communication/multidrop.cpp"
+
+class PacketRecorder : public PacketSink {
+public:
+    int process_packet(const uint8_t* buffer, size_t length) override {
+        packets.emplace_back(buffer, buffer + length);
+        return 0;
+    }
+    std::vector<std::vector<uint8_t>> packets;
+};
+
+// Answers every request with "ok" like a channel would
+class EchoResponder : public PacketSink {
+public:
+    explicit EchoResponder(PacketSink& output) : output_(output) {}
+    int process_packet(const uint8_t* buffer, size_t length) override {
+        requests.emplace_back(buffer, buffer + length);
+        const uint8_t response[] = {'o', 'k'};
+        return output_.process_packet(response, sizeof(response));
+    }
+    std::vector<std::vector<uint8_t>> requests;
+private:
+    PacketSink& output_;
+};
+
+struct MultidropNode {
+    explicit MultidropNode(uint8_t address) : filter(responder, address) {}
+    PacketRecorder bus;
+    uint8_t buffer[8];
+    MultidropPacketFilter filter;
+    MultidropPacketSink sink{bus, filter, buffer, sizeof(buffer)};
+    EchoResponder responder{sink};
+};
+
+TEST_SUITE("multidrop") {
+    TEST_CASE("addressed requests are answered") {
+        MultidropNode node(5);
+        const uint8_t request[] = {5, 'a', 'b'};
+        node.filter.process_packet(request, sizeof(request));
+        REQUIRE(node.responder.requests.size() == 1);
+        CHECK(node.responder.requests[0] == std::vector<uint8_t>{'a', 'b'});
+        REQUIRE(node.bus.packets.size() == 1);
+        CHECK(node.bus.packets[0] == std::vector<uint8_t>{0x85, 'o', 'k'});
+    }
+
+    TEST_CASE("other nodes and responses are ignored") {
+        MultidropNode node(5);
+        const uint8_t other_node[] = {6, 'a'};
+        const uint8_t own_echo[] = {0x85, 'o', 'k'};
+        const uint8_t empty[] = {0};
+        node.filter.process_packet(other_node, sizeof(other_node));
+        node.filter.process_packet(own_echo, sizeof(own_echo));
+        node.filter.process_packet(empty, 0);
+        CHECK(node.responder.requests.empty());
+        CHECK(node.bus.packets.empty());
+    }
+
+    TEST_CASE("broadcasts are executed but not answered") {
+        MultidropNode node(5);
+        const uint8_t request[] = {MultidropPacketFilter::BROADCAST_ADDRESS, 'a'};
+        node.filter.process_packet(request, sizeof(request));
+        CHECK(node.responder.requests.size() == 1);
+        CHECK(node.bus.packets.empty());
+        CHECK(!node.filter.is_muted());
+
+        // Unsolicited packets are still sent afterwards
+        const uint8_t packet[] = {'t'};
+        node.sink.process_packet(packet, sizeof(packet));
+        REQUIRE(node.bus.packets.size() == 1);
+        CHECK(node.bus.packets[0] == std::vector<uint8_t>{0x85, 't'});
+    }
+
+    TEST_CASE("address 0 passes packets through") {
+        MultidropNode node(0);
+        const uint8_t request[] = {5, 'a'};
+        node.filter.process_packet(request, sizeof(request));
+        REQUIRE(node.responder.requests.size() == 1);
+        CHECK(node.responder.requests[0] == std::vector<uint8_t>{5, 'a'});
+        REQUIRE(node.bus.packets.size() == 1);
+        CHECK(node.bus.packets[0] == std::vector<uint8_t>{'o', 'k'});
+    }
+
+    TEST_CASE("oversized responses are rejected") {
+        MultidropNode node(5);
+        uint8_t packet[8] = {0};
+        CHECK(node.sink.process_packet(packet, sizeof(packet)) != 0);
+        CHECK(node.bus.packets.empty());
+    }
+
+    TEST_CASE("valid addresses") {
+        CHECK(!MultidropPacketFilter::is_valid_address(0));
+        CHECK(MultidropPacketFilter::is_valid_address(1));
+        CHECK(MultidropPacketFilter::is_valid_address(126));
+        CHECK(!MultidropPacketFilter::is_valid_address(MultidropPacketFilter::BROADCAST_ADDRESS));
+        CHECK(!MultidropPacketFilter::is_valid_address(0x85));
+    }
+}
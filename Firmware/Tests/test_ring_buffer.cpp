@@ -0,0 +1,62 @@
+
+#include <doctest.h>
+#include <string>
+
+#include "communication/ring_buffer.hpp"
+
+static std::string read_all(RingBuffer<8>& buffer) {
+    std::string result;
+    const uint8_t* data;
+    while (size_t length = buffer.get_contiguous(&data)) {
+        result.append(reinterpret_cast<const char*>(data), length);
+        buffer.consume(length);
+    }
+    return result;
+}
+
+TEST_SUITE("ring_buffer") {
+    TEST_CASE("write reports backpressure") {
+        RingBuffer<8> buffer;
+        CHECK(buffer.get_free_space() == 8);
+        CHECK(buffer.write((const uint8_t*)"abcde", 5) == 5);
+        CHECK(buffer.write((const uint8_t*)"fghij", 5) == 3);
+        CHECK(buffer.get_free_space() == 0);
+        CHECK(buffer.write((const uint8_t*)"k", 1) == 0);
+        CHECK(read_all(buffer) == "abcdefgh");
+        CHECK(buffer.get_free_space() == 8);
+    }
+
+    TEST_CASE("contiguous blocks end at the wrap") {
+        RingBuffer<8> buffer;
+        const uint8_t* data;
+        buffer.write((const uint8_t*)"123456", 6);
+        REQUIRE(buffer.get_contiguous(&data) == 6);
+        buffer.consume(6);
+
+        // Wraps around after two bytes
+        CHECK(buffer.write((const uint8_t*)"abcde", 5) == 5);
+        REQUIRE(buffer.get_contiguous(&data) == 2);
+        CHECK(std::string((const char*)data, 2) == "ab");
+        buffer.consume(2);
+        REQUIRE(buffer.get_contiguous(&data) == 3);
+        CHECK(std::string((const char*)data, 3) == "cde");
+        buffer.consume(3);
+        CHECK(buffer.get_contiguous(&data) == 0);
+    }
+
+    TEST_CASE("partial consume") {
+        RingBuffer<8> buffer;
+        std::string expected, actual;
+        for (size_t i = 0; i < 100; ++i) {
+            char chunk[3] = {(char)('a' + i % 26), (char)('A' + i % 26), (char)('0' + i % 10)};
+            size_t written = buffer.write((const uint8_t*)chunk, sizeof(chunk));
+            expected.append(chunk, written);
+            const uint8_t* data;
+            size_t length = std::min<size_t>(buffer.get_contiguous(&data), 2);
+            actual.append((const char*)data, length);
+            buffer.consume(length);
+        }
+        actual += read_all(buffer);
+        CHECK(actual == expected);
+    }
+}
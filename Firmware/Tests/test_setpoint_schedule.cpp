@@ -0,0 +1,57 @@
+
+#include <doctest.h>
+#include <vector>
+
+#include "MotorControl/setpoint_schedule.hpp"
+
+static std::vector<float> pop_all_due(SetpointSchedule& schedule, uint32_t now) {
+    std::vector<float> positions;
+    SetpointSchedule::Entry entry;
+    while (schedule.pop_due(now, &entry))
+        positions.push_back(entry.input_pos);
+    return positions;
+}
+
+TEST_SUITE("setpoint_schedule") {
+    TEST_CASE("entries are applied in their iteration") {
+        SetpointSchedule schedule;
+        CHECK(schedule.push({300, 3.0f, 0.0f, 0.0f}, 0));
+        CHECK(schedule.push({100, 1.0f, 0.0f, 0.0f}, 0));
+        CHECK(schedule.push({200, 2.0f, 0.0f, 0.0f}, 0));
+        CHECK(schedule.push({200, 2.5f, 0.0f, 0.0f}, 0));
+        CHECK(schedule.size() == 4);
+
+        CHECK(pop_all_due(schedule, 99).empty());
+        CHECK(pop_all_due(schedule, 100) == std::vector<float>{1.0f});
+        CHECK(pop_all_due(schedule, 200) == std::vector<float>{2.0f, 2.5f});
+        // Timestamps between two iterations take effect in the later one
+        CHECK(pop_all_due(schedule, 350) == std::vector<float>{3.0f});
+        CHECK(schedule.size() == 0);
+    }
+
+    TEST_CASE("late entries and full queues are rejected") {
+        SetpointSchedule schedule;
+        CHECK(!schedule.push({100, 1.0f, 0.0f, 0.0f}, 100));
+        CHECK(!schedule.push({50, 1.0f, 0.0f, 0.0f}, 100));
+        for (uint32_t i = 0; i < SetpointSchedule::CAPACITY; ++i)
+            CHECK(schedule.push({101 + i, 1.0f, 0.0f, 0.0f}, 100));
+        CHECK(!schedule.push({200, 1.0f, 0.0f, 0.0f}, 100));
+
+        schedule.clear();
+        CHECK(schedule.size() == 0);
+        CHECK(schedule.push({200, 1.0f, 0.0f, 0.0f}, 100));
+    }
+
+    TEST_CASE("timestamps wrap around") {
+        SetpointSchedule schedule;
+        const uint32_t now = UINT32_MAX - 10;
+        CHECK(schedule.push({5, 2.0f, 0.0f, 0.0f}, now));
+        CHECK(schedule.push({UINT32_MAX, 1.0f, 0.0f, 0.0f}, now));
+
+        SetpointSchedule::Entry entry;
+        CHECK(!schedule.pop_due(now, &entry));
+        CHECK(pop_all_due(schedule, UINT32_MAX) == std::vector<float>{1.0f});
+        CHECK(pop_all_due(schedule, 4).empty());
+        CHECK(pop_all_due(schedule, 5) == std::vector<float>{2.0f});
+    }
+}
@@ -61,6 +61,7 @@ EndBSPDependencies */
 #include "usbd_ctlreq.h"
 #include <cmsis_os.h>
 #include <freertos_vars.h>
+#include <communication/interface_usb.h>
 
 
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
@@ -605,8 +606,7 @@ static uint8_t USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
       hcdc->CDC_Tx.State = 0;
     if (epnum == ODRIVE_OUT_EP)
       hcdc->ODRIVE_Tx.State = 0;
-    //Note: We could use independent semaphores for simoultainous USB transmission.
-    osSemaphoreRelease(sem_usb_tx);
+    usb_tx_complete(epnum);
     //((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(hcdc->TxBuffer, &hcdc->TxLength, epnum);
   }
 
@@ -827,6 +827,10 @@ uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev, uint8_t endpoint_pair)
     {
       /* Tx Transfer in progress */
       hEP_Tx->State = 1;
+
+      /* Update the packet total length so that USBD_CDC_DataIn() can
+         terminate multi-packet transfers with a ZLP */
+      pdev->ep_in[in_ep & 0xFU].total_length = hEP_Tx->Length;
       
       /* Transmit next packet */
       USBD_LL_Transmit(pdev,
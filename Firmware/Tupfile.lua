@@ -87,9 +87,12 @@ odrive_firmware_pkg = {
         'communication/can/odrive_can.cpp',    
         'communication/communication.cpp',
         'communication/ascii_protocol.cpp',
+        'communication/ascii_feedback.cpp',
         'communication/interface_uart.cpp',
         'communication/interface_usb.cpp',
         'communication/interface_i2c.cpp',
+        'communication/i2c_register_map.cpp',
+        'communication/multidrop.cpp',
         'fibre/cpp/protocol.cpp',
         'FreeRTOS-openocd.c',
         'autogen/version.c'
@@ -378,6 +381,15 @@ else
     error("unknown UART protocol "..tup.getconfig("UART_PROTOCOL"))
 end
 
+if tup.getconfig("UART_RX_BUFFER_SIZE") ~= "" then
+    CFLAGS += "-DUART_RX_BUFFER_SIZE="..tup.getconfig("UART_RX_BUFFER_SIZE")
+end
+
+-- Fibre settings
+if tup.getconfig("CRC16_SLICE_BY_4") == "true" then
+    CFLAGS += "-DFIBRE_CRC16_SLICE_BY_4"
+end
+
 -- GPIO settings
 if tup.getconfig("STEP_DIR") == "y" then
     if tup.getconfig("UART_PROTOCOL") == "none" then
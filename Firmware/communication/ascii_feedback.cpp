@@ -0,0 +1,197 @@
+
+#include "ascii_feedback.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+bool AsciiFeedbackStream::start(StreamSink* output, uint32_t decimation, const uint8_t* sources, size_t n_sources, bool binary, bool use_checksum) {
+    stop();
+    if (!output || !decimation || !n_sources || n_sources > MAX_VALUES) {
+        return false;
+    }
+
+    memcpy(sources_, sources, n_sources);
+    n_values_ = n_sources;
+    binary_ = binary;
+    use_checksum_ = use_checksum;
+    output_ = output;
+    last_read_seq_ = seq_;
+    decimation_counter_ = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    decimation_ = decimation;
+    return true;
+}
+
+void AsciiFeedbackStream::stop() {
+    // Stop sampling before the configuration is modified
+    decimation_ = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    output_ = nullptr;
+}
+
+bool AsciiFeedbackStream::sample_due() {
+    uint32_t decimation = decimation_;
+    if (!decimation || ++decimation_counter_ < decimation) {
+        return false;
+    }
+    decimation_counter_ = 0;
+    return true;
+}
+
+void AsciiFeedbackStream::sample(uint32_t timestamp, const float* values) {
+    seq_ = seq_ + 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    timestamp_ = timestamp;
+    memcpy(values_, values, n_values_ * sizeof(float));
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    seq_ = seq_ + 1;
+}
+
+// Formats the latest sample and sends it on output if output is the stream
+// that the feedback was requested on.
+int AsciiFeedbackStream::send(StreamSink& output) {
+    if (!has_sample(output)) {
+        return 0;
+    }
+
+    // Copy the sample, retry if sample() preempted us while copying
+    uint32_t timestamp;
+    float values[MAX_VALUES];
+    bool valid = false;
+    for (size_t attempt = 0; attempt < 3 && !valid; ++attempt) {
+        uint32_t seq = seq_;
+        if (seq & 1) {
+            continue;
+        }
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        timestamp = timestamp_;
+        memcpy(values, values_, n_values_ * sizeof(float));
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (seq_ == seq) {
+            last_read_seq_ = seq;
+            valid = true;
+        }
+    }
+    if (!valid) {
+        return 0;
+    }
+
+    uint8_t buffer[MAX_LINE_LENGTH];
+    size_t length = binary_ ? format_binary(buffer, timestamp, values)
+                            : format_text(reinterpret_cast<char*>(buffer), timestamp, values);
+    // Don't block the thread on a slow output. The sample is dropped instead.
+    if (output.get_free_space() < length) {
+        return 0;
+    }
+    return output.process_bytes(buffer, length, nullptr);
+}
+
+// @brief Returns the number of control loop iterations between two samples
+// for the requested rate [samples/s]. The rate must be positive. Rates above
+// the loop frequency give one sample per iteration, very low rates give
+// MAX_DECIMATION.
+uint32_t AsciiFeedbackStream::rate_to_decimation(float loop_frequency, float rate) {
+    // Clamp in float so that the conversion can't overflow
+    float decimation = loop_frequency / rate + 0.5f;
+    return (uint32_t)std::clamp(decimation, 1.0f, (float)MAX_DECIMATION);
+}
+
+// @brief Writes value with up to 4 decimal places without trailing zeros.
+// This is much faster than printf("%f") and covers the resolution of all
+// position and velocity estimates.
+// Returns the number of characters written (at most 15).
+size_t AsciiFeedbackStream::format_float(char* buffer, float value) {
+    if (isnan(value)) {
+        memcpy(buffer, "nan", 3);
+        return 3;
+    }
+
+    char* ptr = buffer;
+    if (value < 0.0f) {
+        *(ptr++) = '-';
+        value = -value;
+    }
+    if (value >= 1e9f) {
+        if (isinf(value)) {
+            memcpy(ptr, "inf", 3);
+            return ptr - buffer + 3;
+        }
+        return ptr - buffer + snprintf(ptr, 12, "%.3e", (double)value);
+    }
+
+    uint64_t scaled = (uint64_t)(value * 10000.0f + 0.5f);
+    uint32_t integer_part = (uint32_t)(scaled / 10000);
+    uint32_t fractional_part = (uint32_t)(scaled % 10000);
+
+    char digits[10];
+    size_t n_digits = 0;
+    do {
+        digits[n_digits++] = '0' + (integer_part % 10);
+        integer_part /= 10;
+    } while (integer_part);
+    while (n_digits)
+        *(ptr++) = digits[--n_digits];
+
+    if (fractional_part) {
+        *(ptr++) = '.';
+        for (uint32_t divisor = 1000; fractional_part; divisor /= 10) {
+            *(ptr++) = '0' + fractional_part / divisor;
+            fractional_part %= divisor;
+        }
+    }
+    return ptr - buffer;
+}
+
+size_t AsciiFeedbackStream::format_text(char* buffer, uint32_t timestamp, const float* values) {
+    char* ptr = buffer;
+    *(ptr++) = 'F';
+    *(ptr++) = ' ';
+
+    char digits[10];
+    size_t n_digits = 0;
+    do {
+        digits[n_digits++] = '0' + (timestamp % 10);
+        timestamp /= 10;
+    } while (timestamp);
+    while (n_digits)
+        *(ptr++) = digits[--n_digits];
+
+    for (size_t i = 0; i < n_values_; ++i) {
+        *(ptr++) = ' ';
+        ptr += format_float(ptr, values[i]);
+    }
+
+    if (use_checksum_) {
+        uint8_t checksum = 0;
+        for (char* c = buffer; c < ptr; ++c)
+            checksum ^= *c;
+        *(ptr++) = '*';
+        if (checksum >= 100)
+            *(ptr++) = '0' + checksum / 100;
+        if (checksum >= 10)
+            *(ptr++) = '0' + (checksum / 10) % 10;
+        *(ptr++) = '0' + checksum % 10;
+    }
+
+    *(ptr++) = '\r';
+    *(ptr++) = '\n';
+    return ptr - buffer;
+}
+
+size_t AsciiFeedbackStream::format_binary(uint8_t* buffer, uint32_t timestamp, const float* values) {
+    fibre::bufptr_t output{buffer, MAX_LINE_LENGTH};
+    write_le<uint8_t>(BINARY_PREFIX, &output);
+    write_le<uint8_t>((uint8_t)n_values_, &output);
+    write_le<uint32_t>(timestamp, &output);
+    for (size_t i = 0; i < n_values_; ++i) {
+        uint32_t raw;
+        memcpy(&raw, &values[i], sizeof(raw));
+        write_le<uint32_t>(raw, &output);
+    }
+    size_t length = output.begin() - buffer;
+    buffer[length] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, buffer, length);
+    return length + 1;
+}
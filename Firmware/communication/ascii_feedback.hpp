@@ -0,0 +1,66 @@
+#ifndef __ASCII_FEEDBACK_HPP
+#define __ASCII_FEEDBACK_HPP
+
+#include <fibre/protocol.hpp>
+
+/**
+ * @brief Periodically pushes a set of values to an ASCII protocol channel.
+ *
+ * sample() is called at the end of a control loop iteration so that all
+ * values of one line belong to the same iteration. It must run at a higher
+ * priority than the thread that owns the output stream, which calls all other
+ * functions. Like TelemetrySubscription, the sample buffer is guarded by a
+ * sequence counter so that no locks are needed on either side.
+ *
+ * Formatting and sending happens in send() on the thread of the output
+ * stream. If the output can't keep up with the configured rate, samples are
+ * skipped and only the latest one is sent. A sample is also skipped if the
+ * output has no room for it (see StreamSink::get_free_space()).
+ *
+ * Text lines have the format "F timestamp value0 value1 ...".
+ * Binary frames consist of {BINARY_PREFIX, uint8 n_values, uint32 timestamp,
+ * float32 values[n_values], crc8} (little endian). The prefix can't occur in
+ * ASCII text so hosts can tell the frames apart from command responses.
+ */
+class AsciiFeedbackStream {
+public:
+    static constexpr size_t MAX_VALUES = 8;
+    static constexpr uint8_t BINARY_PREFIX = 0xF5;
+    static constexpr size_t MAX_LINE_LENGTH = 2 + 10 + MAX_VALUES * 16 + 4 + 2;
+    static constexpr uint32_t MAX_DECIMATION = 1 << 24; // exactly representable as float
+
+    // @brief Starts sending n_sources values every decimation control loop
+    // iterations on output. sources are opaque to this class and tell the
+    // sampler which value to read (see get_sources()).
+    bool start(StreamSink* output, uint32_t decimation, const uint8_t* sources, size_t n_sources, bool binary, bool use_checksum);
+    void stop();
+
+    // @brief Returns true if a sample should be taken in this control loop
+    // iteration. Must be followed by a call to sample() if it returns true.
+    bool sample_due();
+    void sample(uint32_t timestamp, const float* values);
+    const uint8_t* get_sources(size_t* n_sources) { *n_sources = n_values_; return sources_; }
+
+    bool has_sample(StreamSink& output) { return output_ == &output && seq_ != last_read_seq_; }
+    int send(StreamSink& output);
+
+    static uint32_t rate_to_decimation(float loop_frequency, float rate);
+    static size_t format_float(char* buffer, float value);
+    size_t format_text(char* buffer, uint32_t timestamp, const float* values);
+    size_t format_binary(uint8_t* buffer, uint32_t timestamp, const float* values);
+
+private:
+    StreamSink* volatile output_ = nullptr;
+    uint8_t sources_[MAX_VALUES];
+    size_t n_values_ = 0;
+    bool binary_ = false;
+    bool use_checksum_ = false;
+    uint32_t decimation_counter_ = 0;
+    volatile uint32_t decimation_ = 0; // 0: not streaming
+    volatile uint32_t seq_ = 0; // odd while sample() is writing
+    uint32_t last_read_seq_ = 0;
+    uint32_t timestamp_ = 0;
+    float values_[MAX_VALUES];
+};
+
+#endif // __ASCII_FEEDBACK_HPP
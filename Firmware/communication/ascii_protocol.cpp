@@ -12,22 +12,27 @@
 #include "ascii_protocol.hpp"
 #include <utils.hpp>
 #include <fibre/cpp_utils.hpp>
+#include <fibre/text_parser.hpp>
+#include <atomic>
 
 #include "autogen/type_info.hpp"
 #include "communication/interface_can.hpp"
 
 /* Private macros ------------------------------------------------------------*/
 /* Private typedef -----------------------------------------------------------*/
+
 /* Global constant data ------------------------------------------------------*/
 /* Global variables ----------------------------------------------------------*/
 /* Private constant data -----------------------------------------------------*/
 
-#define MAX_LINE_LENGTH 256
 #define TO_STR_INNER(s) #s
 #define TO_STR(s) TO_STR_INNER(s)
 
 /* Private variables ---------------------------------------------------------*/
 
+// Fields that can be streamed with the "fs" command
+static const char feedback_fields[] = "pvit";
+
 #if HW_VERSION_MAJOR == 3
 static Introspectable root_obj = ODrive3TypeInfo<ODrive>::make_introspectable(odrv);
 #elif HW_VERSION_MAJOR == 4
@@ -36,20 +41,17 @@ static Introspectable root_obj = ODrive4TypeInfo<ODrive>::make_introspectable(od
 
 /* Private function prototypes -----------------------------------------------*/
 
-void cmd_set_position(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_set_position_wl(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_set_velocity(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_set_torque(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_set_trapezoid_trajectory(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_get_feedback(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_help(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_info_dump(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_system_ctrl(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_update_axis_wdg(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_unknown(char * pStr, StreamSink& response_channel, bool use_checksum);
-void cmd_encoder(char * pStr, StreamSink& response_channel, bool use_checksum);
+bool is_setpoint_command(fibre::cbufptr_t text);
+bool parse_setpoint(fibre::cbufptr_t cmd, SetpointCommand* setpoint, StreamSink& response_channel, bool use_checksum);
+void apply_setpoint(const SetpointCommand& setpoint);
+void cmd_set_setpoint(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_help(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_info_dump(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_system_ctrl(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_read_property(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_write_property(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_unknown(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
+void cmd_encoder(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum);
 
 /* Function implementations --------------------------------------------------*/
 
@@ -75,16 +77,25 @@ void respond(StreamSink& output, bool include_checksum, const char * fmt, TArgs&
 // @brief Executes an ASCII protocol command
 // @param buffer buffer of ASCII encoded characters
 // @param len size of the buffer
-void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink& response_channel) {
+void ASCII_protocol::process_line(const uint8_t* buffer, size_t len) {
     static_assert(sizeof(char) == sizeof(uint8_t));
+    StreamSink& response_channel = output_;
 
     // scan line to find beginning of checksum and prune comment
+    // A ';' that is followed by another setpoint command separates commands on
+    // a line that starts with a setpoint command. Otherwise it starts a comment.
+    bool allow_multiple = is_setpoint_command({buffer, len});
+    size_t n_separators = 0;
     uint8_t checksum = 0;
     size_t checksum_start = SIZE_MAX;
     for (size_t i = 0; i < len; ++i) {
-        if (buffer[i] == ';') { // ';' is the comment start char
-            len = i;
-            break;
+        if (buffer[i] == ';') {
+            if (allow_multiple && checksum_start > i && is_setpoint_command({buffer + i + 1, len - i - 1})) {
+                n_separators++;
+            } else { // ';' is the comment start char
+                len = i;
+                break;
+            }
         }
         if (checksum_start > i) {
             if (buffer[i] == '*') {
@@ -95,149 +106,200 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
         }
     }
 
-    // copy everything into a local buffer so we can insert null-termination
-    char cmd[MAX_LINE_LENGTH + 1];
-    if (len > MAX_LINE_LENGTH) len = MAX_LINE_LENGTH;
-    memcpy(cmd, buffer, len);
-    cmd[len] = 0; // null-terminate
-
     // optional checksum validation
     bool use_checksum = (checksum_start < len);
     if (use_checksum) {
-        unsigned int received_checksum;
-        int numscan = sscanf(&cmd[checksum_start], "%u", &received_checksum);
-        if ((numscan < 1) || (received_checksum != checksum))
+        fibre::cbufptr_t checksum_str{buffer + checksum_start, len - checksum_start};
+        std::optional<unsigned> received_checksum = parse_int<unsigned>(&checksum_str);
+        if (!received_checksum.has_value() || (*received_checksum != checksum))
             return;
         len = checksum_start - 1; // prune checksum and asterisk
-        cmd[len] = 0; // null-terminate
     }
 
+    // The commands parse their arguments directly from the line buffer
+    fibre::cbufptr_t cmd{buffer, len};
+
+    if (n_separators) {
+        cmd_set_setpoints_atomic(cmd, use_checksum);
+        return;
+    }
 
     // check incoming packet type
-    switch(cmd[0]) {
-        case 'p': cmd_set_position(cmd, response_channel, use_checksum);                break;  // position control
-        case 'q': cmd_set_position_wl(cmd, response_channel, use_checksum);             break;  // position control with limits
-        case 'v': cmd_set_velocity(cmd, response_channel, use_checksum);                break;  // velocity control
-        case 'c': cmd_set_torque(cmd, response_channel, use_checksum);                  break;  // current control
-        case 't': cmd_set_trapezoid_trajectory(cmd, response_channel, use_checksum);    break;  // trapezoidal trajectory
-        case 'f': cmd_get_feedback(cmd, response_channel, use_checksum);                break;  // feedback
+    switch(cmd.empty() ? 0 : cmd.front()) {
+        case 'p': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // position control
+        case 'q': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // position control with limits
+        case 'v': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // velocity control
+        case 'c': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // current control
+        case 't': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // trapezoidal trajectory
+        case 'f': cmd_get_feedback(cmd, use_checksum);                                  break;  // feedback
         case 'h': cmd_help(cmd, response_channel, use_checksum);                        break;  // Help
         case 'i': cmd_info_dump(cmd, response_channel, use_checksum);                   break;  // Dump device info
         case 's': cmd_system_ctrl(cmd, response_channel, use_checksum);                 break;  // System
         case 'r': cmd_read_property(cmd, response_channel,  use_checksum);              break;  // read property
         case 'w': cmd_write_property(cmd, response_channel, use_checksum);              break;  // write property
-        case 'u': cmd_update_axis_wdg(cmd, response_channel, use_checksum);             break;  // Update axis watchdog. 
+        case 'u': cmd_set_setpoint(cmd, response_channel, use_checksum);                break;  // Update axis watchdog. 
         case 'e': cmd_encoder(cmd, response_channel, use_checksum);                     break;  // Encoder commands
-        default : cmd_unknown(nullptr, response_channel, use_checksum);                 break;
+        default : cmd_unknown(cmd, response_channel, use_checksum);                 break;
     }
 }
 
-// @brief Executes the set position command
-// @param pStr buffer of ASCII encoded values
+// @brief Returns true if text (after optional whitespace) starts with a
+// setpoint command followed by a motor number
+bool is_setpoint_command(fibre::cbufptr_t text) {
+    skip_whitespace(&text);
+    if (text.empty() || !text.front() || !strchr("pqvctu", text.front()))
+        return false;
+    fibre::cbufptr_t args = text.skip(1);
+    if (args.empty() || !is_text_whitespace(args.front()))
+        return false;
+    skip_whitespace(&args);
+    return !args.empty() && text_digit_value(args.front()) < 10;
+}
+
+// @brief Parses a setpoint command without applying it
+// @param cmd buffer of ASCII encoded values, starting with the command character
+// @param setpoint the parsed command is written here
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_set_position(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-    float pos_setpoint, vel_feed_forward, torque_feed_forward;
+// @returns false if the command is invalid, in which case an error was sent
+bool parse_setpoint(fibre::cbufptr_t cmd, SetpointCommand* setpoint, StreamSink& response_channel, bool use_checksum) {
+    // Number of required and optional arguments after the motor number
+    int min_args = 1, max_args;
+    switch (cmd.empty() ? 0 : cmd.front()) {
+        case 'p': max_args = 3; break; // position, velocity_ff, torque_ff
+        case 'q': max_args = 3; break; // position, velocity_lim, torque_lim
+        case 'v': max_args = 2; break; // velocity, torque_ff
+        case 'c': max_args = 1; break; // torque
+        case 't': max_args = 1; break; // destination
+        case 'u': min_args = max_args = 0; break;
+        default:
+            respond(response_channel, use_checksum, "unknown command");
+            return false;
+    }
 
-    int numscan = sscanf(pStr, "p %u %f %f %f", &motor_number, &pos_setpoint, &vel_feed_forward, &torque_feed_forward);
-    if (numscan < 2) {
+    unsigned motor_number;
+    float args[3];
+    int numscan = parse_args(cmd.skip(1), &motor_number, &args[0], &args[1], &args[2]);
+    if (numscan < 1 + min_args) {
         respond(response_channel, use_checksum, "invalid command format");
+        return false;
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        Axis& axis = axes[motor_number];
-        axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = pos_setpoint;
-        if (numscan >= 3)
-            axis.controller_.input_vel_ = vel_feed_forward;
-        if (numscan >= 4)
-            axis.controller_.input_torque_ = torque_feed_forward;
-        axis.controller_.input_pos_updated();
-        axis.watchdog_feed();
+        return false;
     }
-}
 
-// @brief Executes the set position with current and velocity limit command
-// @param pStr buffer of ASCII encoded values
-// @param response_channel reference to the stream to respond on
-// @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_set_position_wl(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-    float pos_setpoint, vel_limit, torque_lim;
+    setpoint->cmd = cmd.front();
+    setpoint->motor_number = motor_number;
+    setpoint->n_args = std::min(numscan - 1, max_args);
+    std::copy_n(args, setpoint->n_args, setpoint->args);
+    return true;
+}
 
-    int numscan = sscanf(pStr, "q %u %f %f %f", &motor_number, &pos_setpoint, &vel_limit, &torque_lim);
-    if (numscan < 2) {
-        respond(response_channel, use_checksum, "invalid command format");
-    } else if (motor_number >= AXIS_COUNT) {
-        respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        Axis& axis = axes[motor_number];
-        axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = pos_setpoint;
-        if (numscan >= 3)
-            axis.controller_.config_.vel_limit = vel_limit;
-        if (numscan >= 4)
-            axis.motor_.config_.torque_lim = torque_lim;
-        axis.controller_.input_pos_updated();
-        axis.watchdog_feed();
+// @brief Writes a parsed setpoint command to its axis.
+// Optional arguments that were omitted leave the corresponding value unchanged.
+void apply_setpoint(const SetpointCommand& setpoint) {
+    Axis& axis = axes[setpoint.motor_number];
+    const float* args = setpoint.args;
+    switch (setpoint.cmd) {
+        case 'p': {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
+            axis.controller_.input_pos_ = args[0];
+            if (setpoint.n_args >= 2)
+                axis.controller_.input_vel_ = args[1];
+            if (setpoint.n_args >= 3)
+                axis.controller_.input_torque_ = args[2];
+            axis.controller_.input_pos_updated();
+        } break;
+        case 'q': {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
+            axis.controller_.input_pos_ = args[0];
+            if (setpoint.n_args >= 2)
+                axis.controller_.config_.vel_limit = args[1];
+            if (setpoint.n_args >= 3)
+                axis.motor_.config_.torque_lim = args[2];
+            axis.controller_.input_pos_updated();
+        } break;
+        case 'v': {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
+            axis.controller_.input_vel_ = args[0];
+            if (setpoint.n_args >= 2)
+                axis.controller_.input_torque_ = args[1];
+        } break;
+        case 'c': {
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_TORQUE_CONTROL;
+            axis.controller_.input_torque_ = args[0];
+        } break;
+        case 't': {
+            axis.controller_.config_.input_mode = Controller::INPUT_MODE_TRAP_TRAJ;
+            axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
+            axis.controller_.input_pos_ = args[0];
+            axis.controller_.input_pos_updated();
+        } break;
+        default: break; // 'u' only feeds the watchdog
     }
+    axis.watchdog_feed();
 }
 
-// @brief Executes the set velocity command
-// @param pStr buffer of ASCII encoded values
+// @brief Executes a single setpoint command (p, q, v, c, t or u) immediately
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_set_velocity(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-    float vel_setpoint, torque_feed_forward;
-    int numscan = sscanf(pStr, "v %u %f %f", &motor_number, &vel_setpoint, &torque_feed_forward);
-    if (numscan < 2) {
-        respond(response_channel, use_checksum, "invalid command format");
-    } else if (motor_number >= AXIS_COUNT) {
-        respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        Axis& axis = axes[motor_number];
-        axis.controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
-        axis.controller_.input_vel_ = vel_setpoint;
-        if (numscan >= 3)
-            axis.controller_.input_torque_ = torque_feed_forward;
-        axis.watchdog_feed();
-    }
+void cmd_set_setpoint(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    SetpointCommand setpoint;
+    if (parse_setpoint(cmd, &setpoint, response_channel, use_checksum))
+        apply_setpoint(setpoint);
 }
 
-// @brief Executes the set torque control command
-// @param pStr buffer of ASCII encoded values
+// @brief Executes several ';' separated setpoint commands in the same control
+// loop iteration. If any of the commands is invalid, none of them is applied.
+// @param cmd buffer of ASCII encoded values, starting with the first command
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_set_torque(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-    float torque_setpoint;
+void ASCII_protocol::cmd_set_setpoints_atomic(fibre::cbufptr_t cmd, bool use_checksum) {
+    StreamSink& response_channel = output_;
+    SetpointCommand setpoints[MAX_COMMANDS_PER_LINE];
+    size_t n_setpoints = 0;
+    for (;;) {
+        const uint8_t* separator = (const uint8_t*)memchr(cmd.begin(), ';', cmd.size());
+        fibre::cbufptr_t segment{cmd.begin(), separator ? separator : cmd.end()};
+        skip_whitespace(&segment);
+        if (n_setpoints >= MAX_COMMANDS_PER_LINE) {
+            respond(response_channel, use_checksum, "too many commands");
+            return;
+        }
+        if (!parse_setpoint(segment, &setpoints[n_setpoints++], response_channel, use_checksum))
+            return;
+        if (!separator)
+            break;
+        cmd = cmd.skip(separator - cmd.begin() + 1);
+    }
 
-    if (sscanf(pStr, "c %u %f", &motor_number, &torque_setpoint) < 2) {
-        respond(response_channel, use_checksum, "invalid command format");
-    } else if (motor_number >= AXIS_COUNT) {
-        respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        Axis& axis = axes[motor_number];
-        axis.controller_.config_.control_mode = Controller::CONTROL_MODE_TORQUE_CONTROL;
-        axis.controller_.input_torque_ = torque_setpoint;
-        axis.watchdog_feed();
+    // The control loop picks up staged setpoints within one iteration, so
+    // this only waits if two lines arrive back to back.
+    for (size_t i = 0; staged_setpoints_pending_ && i < 10; ++i)
+        osDelay(1);
+    if (staged_setpoints_pending_) {
+        respond(response_channel, use_checksum, "busy");
+        return;
     }
+
+    std::copy_n(setpoints, n_setpoints, staged_setpoints_);
+    n_staged_setpoints_ = n_setpoints;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    staged_setpoints_pending_ = true;
+    respond(response_channel, use_checksum, "ok");
 }
 
 // @brief Sets the encoder linear count
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_encoder(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    if (pStr[1] == 's') {
-        pStr += 2; // Substring two characters to the right (ok because we have guaranteed null termination after all chars)
-
+void cmd_encoder(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    if (cmd.size() >= 2 && cmd[1] == 's') {
         unsigned motor_number;
         int encoder_count;
 
-        if (sscanf(pStr, "l %u %i", &motor_number, &encoder_count) < 2) {
+        if (cmd.size() < 3 || cmd[2] != 'l' || parse_args(cmd.skip(3), &motor_number, &encoder_count) < 2) {
             respond(response_channel, use_checksum, "invalid command format");
         } else if (motor_number >= AXIS_COUNT) {
             respond(response_channel, use_checksum, "invalid motor %u", motor_number);
@@ -252,53 +314,84 @@ void cmd_encoder(char * pStr, StreamSink& response_channel, bool use_checksum) {
     }
 }
 
-// @brief Executes the set trapezoid trajectory command
-// @param pStr buffer of ASCII encoded values
+// @brief Executes the get position and velocity feedback command
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_set_trapezoid_trajectory(char* pStr, StreamSink& response_channel, bool use_checksum) {
+void ASCII_protocol::cmd_get_feedback(fibre::cbufptr_t cmd, bool use_checksum) {
+    StreamSink& response_channel = output_;
     unsigned motor_number;
-    float goal_point;
 
-    if (sscanf(pStr, "t %u %f", &motor_number, &goal_point) < 2) {
+    if (cmd.size() >= 2 && cmd[1] == 's') {
+        cmd_stream_feedback(cmd.skip(1), use_checksum);
+    } else if (parse_args(cmd.skip(1), &motor_number) < 1) {
         respond(response_channel, use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(response_channel, use_checksum, "invalid motor %u", motor_number);
     } else {
         Axis& axis = axes[motor_number];
-        axis.controller_.config_.input_mode = Controller::INPUT_MODE_TRAP_TRAJ;
-        axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
-        axis.controller_.input_pos_ = goal_point;
-        axis.controller_.input_pos_updated();
-        axis.watchdog_feed();
+        respond(response_channel, use_checksum, "%f %f",
+                (double)axis.encoder_.pos_estimate_.any().value_or(0.0f),
+                (double)axis.encoder_.vel_estimate_.any().value_or(0.0f));
     }
 }
 
-// @brief Executes the get position and velocity feedback command
-// @param pStr buffer of ASCII encoded values
+// @brief Starts or stops pushing feedback lines for selected axes and fields
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_get_feedback(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-
-    if (sscanf(pStr, "f %u", &motor_number) < 1) {
+void ASCII_protocol::cmd_stream_feedback(fibre::cbufptr_t cmd, bool use_checksum) {
+    StreamSink& response_channel = output_;
+    fibre::cbufptr_t args = cmd.skip(1);
+    std::optional<float> rate = parse_float(&args);
+    char axes_str[4] = {0};
+    char fields_str[AsciiFeedbackStream::MAX_VALUES + 1] = {0};
+    char format_str[2] = {0};
+    if (!parse_token(&args, axes_str, sizeof(axes_str)).has_value())
+        memcpy(axes_str, "01", AXIS_COUNT);
+    if (!parse_token(&args, fields_str, sizeof(fields_str)).has_value())
+        memcpy(fields_str, "pv", 2);
+    parse_token(&args, format_str, sizeof(format_str));
+    skip_whitespace(&args);
+
+    if (!rate.has_value() || !(*rate >= 0.0f) || !args.empty() || (format_str[0] && format_str[0] != 'b')) {
         respond(response_channel, use_checksum, "invalid command format");
-    } else if (motor_number >= AXIS_COUNT) {
-        respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        Axis& axis = axes[motor_number];
-        respond(response_channel, use_checksum, "%f %f",
-                (double)axis.encoder_.pos_estimate_.any().value_or(0.0f),
-                (double)axis.encoder_.vel_estimate_.any().value_or(0.0f));
+        return;
+    }
+    if (*rate == 0.0f) {
+        feedback_stream_.stop();
+        return;
+    }
+
+    // Each source is encoded as axis number (high nibble) and field index (low nibble)
+    uint8_t sources[AsciiFeedbackStream::MAX_VALUES];
+    size_t n_sources = 0;
+    for (char* axis = axes_str; *axis; ++axis) {
+        unsigned motor_number = *axis - '0';
+        if (motor_number >= AXIS_COUNT) {
+            respond(response_channel, use_checksum, "invalid motor %u", motor_number);
+            return;
+        }
+        for (char* field = fields_str; *field; ++field) {
+            const char* field_idx = strchr(feedback_fields, *field);
+            if (!field_idx || n_sources >= AsciiFeedbackStream::MAX_VALUES) {
+                respond(response_channel, use_checksum, "invalid command format");
+                return;
+            }
+            sources[n_sources++] = (motor_number << 4) | (field_idx - feedback_fields);
+        }
     }
+
+    uint32_t decimation = AsciiFeedbackStream::rate_to_decimation((float)current_meas_hz, *rate);
+    feedback_stream_.start(&response_channel, decimation, sources, n_sources, format_str[0] == 'b', use_checksum);
 }
 
 // @brief Shows help text
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_help(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    (void)pStr;
+void cmd_help(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    (void)cmd;
     respond(response_channel, use_checksum, "Please see documentation for more details");
     respond(response_channel, use_checksum, "");
     respond(response_channel, use_checksum, "Available commands syntax reference:");
@@ -306,6 +399,9 @@ void cmd_help(char * pStr, StreamSink& response_channel, bool use_checksum) {
     respond(response_channel, use_checksum, "Position: p axis pos vel-ff I-ff");
     respond(response_channel, use_checksum, "Velocity: v axis vel I-ff");
     respond(response_channel, use_checksum, "Torque: c axis T");
+    respond(response_channel, use_checksum, "Several at once: p 0 1.5; p 1 -2");
+    respond(response_channel, use_checksum, "Feedback: f axis");
+    respond(response_channel, use_checksum, "Feedback stream: fs rate axes fields [b]");
     respond(response_channel, use_checksum, "");
     respond(response_channel, use_checksum, "Properties start at odrive root, such as axis0.requested_state");
     respond(response_channel, use_checksum, "Read: r property");
@@ -317,10 +413,10 @@ void cmd_help(char * pStr, StreamSink& response_channel, bool use_checksum) {
 }
 
 // @brief Gets the hardware, firmware and serial details
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_info_dump(char * pStr, StreamSink& response_channel, bool use_checksum) {
+void cmd_info_dump(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
     // respond(response_channel, use_checksum, "Signature: %#x", STM_ID_GetSignature());
     // respond(response_channel, use_checksum, "Revision: %#x", STM_ID_GetRevision());
     // respond(response_channel, use_checksum, "Flash Size: %#x KiB", STM_ID_GetFlashSize());
@@ -330,11 +426,11 @@ void cmd_info_dump(char * pStr, StreamSink& response_channel, bool use_checksum)
 }
 
 // @brief Executes the system control command
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_system_ctrl(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    switch (pStr[1])
+void cmd_system_ctrl(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    switch (cmd.size() >= 2 ? cmd[1] : 0)
     {
         case 's':   odrv.save_configuration();  break;  // Save config
         case 'e':   odrv.erase_configuration(); break;  // Erase config
@@ -344,13 +440,14 @@ void cmd_system_ctrl(char * pStr, StreamSink& response_channel, bool use_checksu
 }
 
 // @brief Executes the read parameter command
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    char name[MAX_LINE_LENGTH];
+void cmd_read_property(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    char name[ASCII_protocol::MAX_LINE_LENGTH];
 
-    if (sscanf(pStr, "r %255s", name) < 1) {
+    fibre::cbufptr_t args = cmd.skip(1);
+    if (!parse_token(&args, name, sizeof(name)).has_value()) {
         respond(response_channel, use_checksum, "invalid command format");
     } else {
         Introspectable property = root_obj.get_child(name, sizeof(name));
@@ -366,16 +463,18 @@ void cmd_read_property(char * pStr, StreamSink& response_channel, bool use_check
 }
 
 // @brief Executes the set write position command
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    char name[MAX_LINE_LENGTH];
-    char value[MAX_LINE_LENGTH];
+void cmd_write_property(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    char name[ASCII_protocol::MAX_LINE_LENGTH];
+    char value[ASCII_protocol::MAX_LINE_LENGTH];
 
-    if (sscanf(pStr, "w %255s %255s", name, value) < 1) {
+    fibre::cbufptr_t args = cmd.skip(1);
+    if (!parse_token(&args, name, sizeof(name)).has_value()) {
         respond(response_channel, use_checksum, "invalid command format");
     } else {
+        parse_token(&args, value, sizeof(value));
         Introspectable property = root_obj.get_child(name, sizeof(name));
         const StringConvertibleTypeInfo* type_info = dynamic_cast<const StringConvertibleTypeInfo*>(property.get_type_info());
         if (!type_info) {
@@ -389,59 +488,70 @@ void cmd_write_property(char * pStr, StreamSink& response_channel, bool use_chec
     }
 }
 
-// @brief Executes the motor watchdog update command
-// @param pStr buffer of ASCII encoded values
-// @param response_channel reference to the stream to respond on
-// @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_update_axis_wdg(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    unsigned motor_number;
-
-    if (sscanf(pStr, "u %u", &motor_number) < 1) {
-        respond(response_channel, use_checksum, "invalid command format");
-    } else if (motor_number >= AXIS_COUNT) {
-        respond(response_channel, use_checksum, "invalid motor %u", motor_number);
-    } else {
-        axes[motor_number].watchdog_feed();
-    }
-}
-
 // @brief Sends the unknown command response
-// @param pStr buffer of ASCII encoded values
+// @param cmd buffer of ASCII encoded values, starting with the command character
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void cmd_unknown(char * pStr, StreamSink& response_channel, bool use_checksum) {
-    (void)pStr;
+void cmd_unknown(fibre::cbufptr_t cmd, StreamSink& response_channel, bool use_checksum) {
+    (void)cmd;
     respond(response_channel, use_checksum, "unknown command");
 }
 
 // @brief Parses the received ASCII char stream
 // @param buffer buffer of ASCII encoded values
-// @param response_channel reference to the stream to respond on
-// @param use_checksum bool to indicate whether a checksum is required on response
-void ASCII_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel) {
-    static uint8_t parse_buffer[MAX_LINE_LENGTH];
-    static bool read_active = true;
-    static uint32_t parse_buffer_idx = 0;
-
+// @param len size of the buffer
+void ASCII_protocol::parse_stream(const uint8_t* buffer, size_t len) {
     while (len--) {
         // if the line becomes too long, reset buffer and wait for the next line
-        if (parse_buffer_idx >= MAX_LINE_LENGTH) {
-            read_active = false;
-            parse_buffer_idx = 0;
+        if (parse_buffer_idx_ >= MAX_LINE_LENGTH) {
+            read_active_ = false;
+            parse_buffer_idx_ = 0;
         }
 
         // Fetch the next char
         uint8_t c = *(buffer++);
         bool is_end_of_line = (c == '\r' || c == '\n' || c == '!');
         if (is_end_of_line) {
-            if (read_active)
-                ASCII_protocol_process_line(parse_buffer, parse_buffer_idx, response_channel);
-            parse_buffer_idx = 0;
-            read_active = true;
+            if (read_active_)
+                process_line(parse_buffer_, parse_buffer_idx_);
+            parse_buffer_idx_ = 0;
+            read_active_ = true;
         } else {
-            if (read_active) {
-                parse_buffer[parse_buffer_idx++] = c;
+            if (read_active_) {
+                parse_buffer_[parse_buffer_idx_++] = c;
             }
         }
     }
 }
+
+// @brief Applies the setpoints of the last multi-command line, if any.
+void ASCII_protocol::apply_staged_setpoints() {
+    if (!staged_setpoints_pending_)
+        return;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < n_staged_setpoints_; ++i)
+        apply_setpoint(staged_setpoints_[i]);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    staged_setpoints_pending_ = false;
+}
+
+// @brief Captures the values of an active feedback stream.
+void ASCII_protocol::sample_feedback(uint32_t timestamp) {
+    if (!feedback_stream_.sample_due())
+        return;
+
+    size_t n_sources;
+    const uint8_t* sources = feedback_stream_.get_sources(&n_sources);
+    float values[AsciiFeedbackStream::MAX_VALUES];
+    for (size_t i = 0; i < n_sources; ++i) {
+        Axis& axis = axes[sources[i] >> 4];
+        switch (feedback_fields[sources[i] & 0xf]) {
+            case 'p': values[i] = axis.encoder_.pos_estimate_.any().value_or(0.0f); break;
+            case 'v': values[i] = axis.encoder_.vel_estimate_.any().value_or(0.0f); break;
+            case 'i': values[i] = axis.motor_.current_control_.Iq_measured_; break;
+            case 't': values[i] = axis.controller_.torque_setpoint_; break;
+            default: values[i] = 0.0f; break;
+        }
+    }
+    feedback_stream_.sample(timestamp, values);
+}
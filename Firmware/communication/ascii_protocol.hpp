@@ -4,19 +4,74 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include <fibre/protocol.hpp>
+#include "ascii_feedback.hpp"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 /* Exported types ------------------------------------------------------------*/
+
+// @brief A setpoint command (p, q, v, c, t or u) that was parsed but not yet applied
+struct SetpointCommand {
+    char cmd;
+    uint8_t motor_number;
+    uint8_t n_args; // number of valid arguments after the motor number
+    float args[3];
+};
+
+// @brief State of the ASCII protocol on one interface. USB and UART are
+// served by separate threads, so each of them owns an instance.
+class ASCII_protocol {
+public:
+    static constexpr size_t MAX_LINE_LENGTH = 256;
+    static constexpr size_t MAX_COMMANDS_PER_LINE = 8;
+
+    ASCII_protocol(StreamSink& output) : output_(output) {}
+
+    void parse_stream(const uint8_t* buffer, size_t len);
+
+    // @brief Applies the setpoints of the last multi-command line, if any.
+    // Called from the control loop before the axes are updated so that all
+    // setpoints of a line take effect in the same iteration.
+    void apply_staged_setpoints();
+
+    // @brief Captures the values of an active feedback stream.
+    // Called from the control loop after all components were updated.
+    void sample_feedback(uint32_t timestamp);
+    // @brief Returns true if there is a feedback sample to send.
+    bool has_feedback() { return feedback_stream_.has_sample(output_); }
+    // @brief Sends the latest feedback sample. Must be called from the thread
+    // that handles this interface.
+    void send_feedback() { feedback_stream_.send(output_); }
+
+private:
+    void process_line(const uint8_t* buffer, size_t len);
+    void cmd_set_setpoints_atomic(fibre::cbufptr_t cmd, bool use_checksum);
+    void cmd_get_feedback(fibre::cbufptr_t cmd, bool use_checksum);
+    void cmd_stream_feedback(fibre::cbufptr_t cmd, bool use_checksum);
+
+    StreamSink& output_;
+    uint8_t parse_buffer_[MAX_LINE_LENGTH];
+    bool read_active_ = true;
+    uint32_t parse_buffer_idx_ = 0;
+
+    // Setpoints of the last multi-command line. They are written by the
+    // protocol thread while staged_setpoints_pending_ is false and applied by
+    // the control loop, which then clears the flag.
+    SetpointCommand staged_setpoints_[MAX_COMMANDS_PER_LINE];
+    size_t n_staged_setpoints_ = 0;
+    volatile bool staged_setpoints_pending_ = false;
+
+    AsciiFeedbackStream feedback_stream_;
+};
+
 /* Exported constants --------------------------------------------------------*/
 /* Exported variables --------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
 /* Exported functions --------------------------------------------------------*/
-void ASCII_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel);
 
 
 #endif /* __ASCII_PROTOCOL_H */
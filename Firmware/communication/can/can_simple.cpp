@@ -140,6 +140,13 @@ void CANSimple::do_command(Axis& axis, const can_Message_t& msg) {
         case MSG_CLEAR_ERRORS:
             clear_errors_callback(axis, msg);
             break;
+        case MSG_SET_SCHEDULED_INPUT_POS:
+            set_scheduled_input_pos_callback(axis, msg);
+            break;
+        case MSG_GET_CONTROL_LOOP_TIMESTAMP:
+            if (msg.rtr)
+                get_control_loop_timestamp_callback(axis);
+            break;
         default:
             break;
     }
@@ -248,6 +255,12 @@ void CANSimple::set_input_pos_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.input_pos_updated();
 }
 
+void CANSimple::set_scheduled_input_pos_callback(Axis& axis, const can_Message_t& msg) {
+    // There is no room for feedforward terms. Setpoints that can't be
+    // scheduled are dropped.
+    axis.controller_.schedule_input(can_getSignal<uint32_t>(msg, 0, 32, true), can_getSignal<float>(msg, 32, 32, true), 0.0f, 0.0f);
+}
+
 void CANSimple::set_input_vel_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.input_vel_ = can_getSignal<float>(msg, 0, 32, true);
     axis.controller_.input_torque_ = can_getSignal<float>(msg, 32, 32, true);
@@ -322,6 +335,20 @@ bool CANSimple::get_vbus_voltage_callback(const Axis& axis) {
     return canbus_->send_message(txmsg);
 }
 
+bool CANSimple::get_control_loop_timestamp_callback(const Axis& axis) {
+    can_Message_t txmsg;
+
+    txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
+    txmsg.id += MSG_GET_CONTROL_LOOP_TIMESTAMP;
+    txmsg.isExt = axis.config_.can.is_extended;
+    txmsg.len = 8;
+
+    can_setSignal<uint32_t>(txmsg, odrv.last_update_timestamp_, 0, 32, true);
+    can_setSignal<uint32_t>(txmsg, odrv.control_loop_timestamp_increment_, 32, 32, true);
+
+    return canbus_->send_message(txmsg);
+}
+
 void CANSimple::clear_errors_callback(Axis& axis, const can_Message_t& msg) {
     odrv.clear_errors(); // TODO: might want to clear axis errors only
 }
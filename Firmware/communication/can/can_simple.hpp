@@ -32,6 +32,9 @@ class CANSimple {
         MSG_RESET_ODRIVE,
         MSG_GET_VBUS_VOLTAGE,
         MSG_CLEAR_ERRORS,
+        MSG_SET_LINEAR_COUNT,
+        MSG_SET_SCHEDULED_INPUT_POS,
+        MSG_GET_CONTROL_LOOP_TIMESTAMP,
         MSG_CO_HEARTBEAT_CMD = 0x700,  // CANOpen NMT Heartbeat  SEND
     };
 
@@ -59,6 +62,7 @@ class CANSimple {
     bool get_iq_callback(const Axis& axis);
     bool get_sensorless_estimates_callback(const Axis& axis);
     bool get_vbus_voltage_callback(const Axis& axis);
+    bool get_control_loop_timestamp_callback(const Axis& axis);
 
     // Set functions
     static void set_axis_nodeid_callback(Axis& axis, const can_Message_t& msg);
@@ -67,6 +71,7 @@ class CANSimple {
     static void set_input_pos_callback(Axis& axis, const can_Message_t& msg);
     static void set_input_vel_callback(Axis& axis, const can_Message_t& msg);
     static void set_input_torque_callback(Axis& axis, const can_Message_t& msg);
+    static void set_scheduled_input_pos_callback(Axis& axis, const can_Message_t& msg);
     static void set_controller_modes_callback(Axis& axis, const can_Message_t& msg);
     static void set_vel_limit_callback(Axis& axis, const can_Message_t& msg);
     static void set_traj_vel_limit_callback(Axis& axis, const can_Message_t& msg);
@@ -7,6 +7,7 @@
 #include "interface_uart.h"
 #include "interface_can.hpp"
 #include "interface_i2c.h"
+#include "multidrop.hpp"
 
 #include "odrive_main.h"
 #include "freertos_vars.h"
@@ -43,6 +44,14 @@ void init_communication(void) {
         odrv.misconfigured_ = true;
     }
 
+    uint8_t rs485_address = odrv.config_.uart_rs485_address;
+    if (rs485_address && !MultidropPacketFilter::is_valid_address(rs485_address)) {
+        odrv.misconfigured_ = true;
+        rs485_address = 0;
+    }
+    configure_uart_multidrop(rs485_address, get_gpio(odrv.config_.uart_rs485_de_gpio_pin),
+            odrv.config_.uart_rs485_turnaround_us);
+
     if (odrv.config_.enable_uart_a && uart_a) {
         start_uart_server(uart_a);
     } else if (odrv.config_.enable_uart_b && uart_b) {
@@ -0,0 +1,52 @@
+
+#include "i2c_register_map.hpp"
+
+bool I2CRegisterMap::configure(fibre::cbufptr_t endpoint_ids) {
+    n_registers_ = 0;
+    size_t n_registers = 0;
+    while (endpoint_ids.size() >= 2) {
+        uint16_t endpoint_id = *read_le<uint16_t>(&endpoint_ids);
+        if (n_registers >= MAX_REGISTERS || !fibre::is_property_endpoint(endpoint_id)) {
+            return false;
+        }
+
+        // Read the value once to find out its width
+        uint8_t value[8];
+        fibre::cbufptr_t input{value, (size_t)0};
+        fibre::bufptr_t output{value, sizeof(value)};
+        fibre::endpoint_handler(endpoint_id, &input, &output);
+        size_t width = sizeof(value) - output.size();
+        if (width == 0) {
+            return false;
+        }
+
+        endpoint_ids_[n_registers] = endpoint_id;
+        widths_[n_registers] = (uint8_t)width;
+        n_registers++;
+    }
+    n_registers_ = n_registers;
+    return n_registers_ > 0;
+}
+
+size_t I2CRegisterMap::read(size_t first_register, fibre::bufptr_t output) {
+    uint8_t* begin = output.begin();
+    for (size_t i = first_register; i < n_registers_ && output.size() >= widths_[i]; ++i) {
+        fibre::cbufptr_t input{output.begin(), (size_t)0};
+        fibre::bufptr_t value = output.take(widths_[i]);
+        fibre::endpoint_handler(endpoint_ids_[i], &input, &value);
+        output = output.skip(widths_[i]);
+    }
+    return output.begin() - begin;
+}
+
+size_t I2CRegisterMap::write(size_t first_register, fibre::cbufptr_t input) {
+    size_t i = first_register;
+    for (; i < n_registers_ && input.size() >= widths_[i]; ++i) {
+        fibre::cbufptr_t value = input.take(widths_[i]);
+        uint8_t discarded[8]; // some endpoints return the old value
+        fibre::bufptr_t output{discarded};
+        fibre::endpoint_handler(endpoint_ids_[i], &value, &output);
+        input = input.skip(widths_[i]);
+    }
+    return i > first_register ? i - first_register : 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __I2C_REGISTER_MAP_HPP
+#define __I2C_REGISTER_MAP_HPP
+
+#include <fibre/protocol.hpp>
+
+/**
+ * @brief Maps a list of property endpoints onto consecutive I2C registers.
+ *
+ * Register i holds the value of the i-th endpoint in the same little endian
+ * encoding that fibre uses, so an I2C master can read or write a block of
+ * registers in one bus transaction. The width of each register is found by
+ * reading the endpoint once when the map is configured.
+ */
+class I2CRegisterMap {
+public:
+    static constexpr size_t MAX_REGISTERS = 32;
+
+    // @brief Replaces the map with the given list of little endian uint16
+    // endpoint ids. If any of them is not a property, the map is cleared.
+    bool configure(fibre::cbufptr_t endpoint_ids);
+    size_t get_register_count() { return n_registers_; }
+
+    // @brief Reads the registers starting at first_register until the end of
+    // the map or until the next value doesn't fit into output.
+    // @returns The number of bytes written to output.
+    size_t read(size_t first_register, fibre::bufptr_t output);
+
+    // @brief Writes the registers starting at first_register. Stops at the
+    // end of the map or at the first incomplete value.
+    // @returns The number of registers that were written.
+    size_t write(size_t first_register, fibre::cbufptr_t input);
+
+private:
+    uint16_t endpoint_ids_[MAX_REGISTERS];
+    uint8_t widths_[MAX_REGISTERS];
+    size_t n_registers_ = 0;
+};
+
+#endif // __I2C_REGISTER_MAP_HPP
@@ -1,5 +1,6 @@
 
 #include "interface_i2c.h"
+#include "i2c_register_map.hpp"
 #include "fibre/protocol.hpp"
 
 #include <i2c.h>
@@ -8,6 +9,12 @@
 #define I2C_RX_BUFFER_PREAMBLE_SIZE   4
 #define I2C_TX_BUFFER_SIZE 128
 
+// A write transaction that starts with a 16-bit word with the MSB set is a
+// register access (see I2CRegisterMap). Fibre endpoint ids never have the MSB
+// set. The lower bits select the first register, 0xFFFF configures the map.
+#define I2C_REGISTER_FLAG       0x8000
+#define I2C_REGISTER_MAP_CONFIG 0xFFFF
+
 I2CStats_t i2c_stats_;
 
 static uint8_t i2c_rx_buffer[I2C_RX_BUFFER_PREAMBLE_SIZE + I2C_RX_BUFFER_SIZE];
@@ -22,7 +29,13 @@ public:
     }
     size_t get_free_space() { return SIZE_MAX; }
 } i2c1_packet_output;
-BidirectionalPacketBasedChannel i2c1_channel(i2c1_packet_output);
+static uint8_t i2c1_tx_packet_buf[TX_BUF_SIZE];
+BidirectionalPacketBasedChannel i2c1_channel(i2c1_packet_output,
+        i2c1_tx_packet_buf, sizeof(i2c1_tx_packet_buf), sizeof(i2c_rx_buffer));
+
+static I2CRegisterMap i2c_register_map;
+static size_t i2c_first_register = 0;
+static bool i2c_register_mode = false; // true if the last write was a register access
 
 void start_i2c_server() {
     // CAN H = SDA
@@ -30,10 +43,35 @@ void start_i2c_server() {
     HAL_I2C_EnableListen_IT(&hi2c1);
 }
 
+// @brief Handles a write transaction in register mode.
+// The request is {uint16 0x8000 | first_register, values...} or
+// {uint16 0xFFFF, uint16 json_crc, uint16 endpoint_ids[]}.
+void i2c_handle_register_access(fibre::cbufptr_t request) {
+    uint16_t address = *read_le<uint16_t>(&request);
+    if (address == I2C_REGISTER_MAP_CONFIG) {
+        // Only accept endpoint ids that refer to this firmware's interface
+        if (read_le<uint16_t>(&request) == fibre::json_crc_)
+            i2c_register_map.configure(request);
+        i2c_first_register = 0;
+    } else {
+        i2c_first_register = address & ~I2C_REGISTER_FLAG;
+        i2c_register_map.write(i2c_first_register, request);
+    }
+    i2c_register_mode = true;
+}
+
 void i2c_handle_packet(I2C_HandleTypeDef *hi2c) {
     size_t received = sizeof(i2c_rx_buffer) - hi2c->XferCount;
-    if (received > I2C_RX_BUFFER_PREAMBLE_SIZE) {
+    if (received >= I2C_RX_BUFFER_PREAMBLE_SIZE + 2 && (i2c_rx_buffer[5] & 0x80)) {
+        i2c_stats_.rx_cnt++;
+        i2c_handle_register_access({i2c_rx_buffer + I2C_RX_BUFFER_PREAMBLE_SIZE, received - I2C_RX_BUFFER_PREAMBLE_SIZE});
+
+        // reset receive buffer
+        hi2c->pBuffPtr = I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer;
+        hi2c->XferCount = sizeof(i2c_rx_buffer) - I2C_RX_BUFFER_PREAMBLE_SIZE;
+    } else if (received > I2C_RX_BUFFER_PREAMBLE_SIZE) {
         i2c_stats_.rx_cnt++;
+        i2c_register_mode = false;
         
         write_le<uint16_t>(0, i2c_rx_buffer); // hallucinate seq-no (not needed for I2C)
         i2c_rx_buffer[2] = i2c_rx_buffer[4]; // endpoint-id = I2C register address
@@ -70,6 +108,12 @@ void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, ui
             I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer,
             sizeof(i2c_rx_buffer) - I2C_RX_BUFFER_PREAMBLE_SIZE, I2C_FIRST_AND_LAST_FRAME);
     } else {
+        // In register mode the values are read when the master starts reading
+        // so that repeated reads without a new write return fresh values.
+        if (i2c_register_mode) {
+            size_t length = i2c_register_map.read(i2c_first_register, i2c_tx_buffer);
+            memset(i2c_tx_buffer + length, 0xff, sizeof(i2c_tx_buffer) - length);
+        }
         HAL_I2C_Slave_Sequential_Transmit_IT(hi2c, i2c_tx_buffer, sizeof(i2c_tx_buffer), I2C_FIRST_AND_LAST_FRAME);
     }
 }
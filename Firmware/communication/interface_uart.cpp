@@ -2,6 +2,8 @@
 #include "interface_uart.h"
 
 #include "ascii_protocol.hpp"
+#include "multidrop.hpp"
+#include "ring_buffer.hpp"
 
 #include <MotorControl/utils.hpp>
 
@@ -9,12 +11,27 @@
 #include <usart.h>
 #include <cmsis_os.h>
 #include <freertos_vars.h>
+#include <Drivers/STM32/stm32_system.h>
 
-#define UART_TX_BUFFER_SIZE 64
-#define UART_RX_BUFFER_SIZE 64
+// Must be a power of two. Holds a few large fibre responses so that the DMA
+// can keep sending while the next one is being prepared.
+#define UART_TX_BUFFER_SIZE 2048
+// Must hold all requests that a host can pipeline while a long response is
+// being sent (see BidirectionalPacketBasedChannel::MAX_WINDOW_SIZE) and all
+// data that arrives while the UART thread is blocked by higher priority work.
+// Can be overridden with CONFIG_UART_RX_BUFFER_SIZE.
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 1024
+#endif
 
-// DMA open loop continous circular buffer
-// 1ms delay periodic, chase DMA ptr around
+// Largest fibre packets that are exchanged over UART once the host negotiated
+// large packets. Requests are small, responses (e.g. buffer reads) are large.
+#define UART_MAX_RX_PACKET_SIZE 256
+#define UART_MAX_TX_PACKET_SIZE 512
+
+// The DMA receives into this circular buffer forever. The UART thread chases
+// the DMA write pointer whenever the idle line, half transfer or transfer
+// complete interrupt signals new data.
 static uint8_t dma_rx_buffer[UART_RX_BUFFER_SIZE];
 static uint32_t dma_last_rcv_idx;
 
@@ -23,99 +40,240 @@ static UART_HandleTypeDef* huart_ = nullptr;
 const uint32_t stack_size_uart_thread = 4096;  // Bytes
 
 
+// Outgoing data is queued in a ring buffer. The DMA transfers one contiguous
+// block of the buffer at a time and the TX complete interrupt chains the next
+// block right away, so the line stays busy as long as there is data.
+// Only the UART thread writes to the stream.
+//
+// On a half-duplex bus the sender drives the transceiver's driver enable pin
+// for as long as it is sending. The TX complete interrupt only fires after
+// the stop bit of the last byte, so the pin is released right when the line
+// is done.
 class UARTSender : public StreamSink {
 public:
+    // @brief Enables driver enable control on de_gpio. Before the driver is
+    // enabled, the sender waits until turnaround_us have passed since
+    // mark_rx() was called, so that the other side can release the bus.
+    void enable_direction_control(Stm32Gpio de_gpio, uint32_t turnaround_us) {
+        de_gpio_ = de_gpio;
+        turnaround_us_ = turnaround_us;
+        de_gpio_.config(GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_FREQ_VERY_HIGH);
+        de_gpio_.write(false);
+    }
+
+    // @brief Called by the UART thread when it received data
+    void mark_rx() { last_rx_us_ = micros(); }
+
+    // @brief Queues as many bytes as currently fit into the TX buffer.
+    // Never blocks. Use get_free_space() to check beforehand.
+    // @returns The number of bytes that were queued.
+    size_t write_nonblocking(const uint8_t* buffer, size_t length) {
+        if (de_gpio_ && !tx_len_) {
+            uint32_t elapsed = micros() - last_rx_us_;
+            if (elapsed < turnaround_us_)
+                delay_us(turnaround_us_ - elapsed);
+        }
+        size_t queued = tx_buf_.write(buffer, length);
+        restart_if_idle(); // even if nothing fit, a full buffer must drain
+        return queued;
+    }
+
+    // @brief Queues all bytes, waiting for DMA transfers to free up space as needed
     int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) {
-        // Loop to ensure all bytes get sent
         while (length) {
-            size_t chunk = length < UART_TX_BUFFER_SIZE ? length : UART_TX_BUFFER_SIZE;
-            // wait for USB interface to become ready
-            // TODO: implement ring buffer to get a more continuous stream of data
-            if (osSemaphoreWait(sem_uart_dma, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
-                return -1;
-            // transmit chunk
-            memcpy(tx_buf_, buffer, chunk);
-            if (HAL_UART_Transmit_DMA(huart_, tx_buf_, chunk) != HAL_OK)
-                return -1;
+            size_t chunk = write_nonblocking(buffer, length);
             buffer += chunk;
             length -= chunk;
             if (processed_bytes)
                 *processed_bytes += chunk;
+            // Wait for a DMA transfer to free up space. If the HAL was busy
+            // and no transfer is running, retry soon instead.
+            if (length && osSemaphoreWait(sem_uart_dma, tx_len_ ? PROTOCOL_SERVER_TIMEOUT_MS : 1) != osOK && tx_len_)
+                return -1;
         }
         return 0;
     }
 
-    size_t get_free_space() { return SIZE_MAX; }
+    // @brief Starts the DMA if there is queued data but no transfer running.
+    // HAL_UART_Transmit_DMA() fails with HAL_BUSY while the UART thread holds
+    // the HAL lock to restart the receive DMA, so the UART thread calls this
+    // on every iteration to pick up data that was left behind.
+    void restart_if_idle() {
+        CRITICAL_SECTION() {
+            if (!tx_len_ && tx_buf_.get_used())
+                start_next_transfer();
+        }
+    }
+
+    size_t get_free_space() { return tx_buf_.get_free_space(); }
+
+    // @brief Called from the TX complete interrupt
+    void on_transfer_complete() {
+        tx_buf_.consume(tx_len_);
+        start_next_transfer();
+        osSemaphoreRelease(sem_uart_dma);
+    }
+
 private:
-    uint8_t tx_buf_[UART_TX_BUFFER_SIZE];
+    // Must be called with interrupts disabled or from the UART interrupt
+    void start_next_transfer() {
+        const uint8_t* data;
+        size_t length = tx_buf_.get_contiguous(&data);
+        if (length)
+            de_gpio_.write(true);
+        if (length && HAL_UART_Transmit_DMA(huart_, const_cast<uint8_t*>(data), length) == HAL_OK) {
+            tx_len_ = length;
+        } else {
+            tx_len_ = 0; // idle, restart_if_idle() restarts the DMA
+            de_gpio_.write(false);
+        }
+    }
+
+    RingBuffer<UART_TX_BUFFER_SIZE> tx_buf_;
+    volatile size_t tx_len_ = 0; // length of the running DMA transfer, 0 if idle
+    Stm32Gpio de_gpio_; // driver enable pin of an RS-485 transceiver (optional)
+    uint32_t turnaround_us_ = 0;
+    uint32_t last_rx_us_ = 0;
 } uart_stream_output;
 StreamSink* uart_stream_output_ptr = &uart_stream_output;
 
-StreamBasedPacketSink uart_packet_output(uart_stream_output);
-BidirectionalPacketBasedChannel uart_channel(uart_packet_output);
-StreamToPacketSegmenter uart_stream_input(uart_channel);
+static uint8_t uart_rx_packet_buf[UART_MAX_RX_PACKET_SIZE + 2];
+static uint8_t uart_tx_packet_buf[UART_MAX_TX_PACKET_SIZE];
+// Holds an outgoing packet plus its bus address (multi-drop mode only)
+static uint8_t uart_tx_addressed_packet_buf[UART_MAX_TX_PACKET_SIZE + 1];
+// Holds an entire outgoing frame so that it is passed to the DMA in one go
+static uint8_t uart_tx_frame_buf[UART_MAX_TX_PACKET_SIZE + 1 + MAX_FRAME_OVERHEAD];
+
+static TelemetrySubscription uart_telemetry;
+ASCII_protocol uart_ascii_protocol(uart_stream_output);
+
+// In multi-drop mode packets carry a bus address (see MultidropPacketFilter).
+// Otherwise the filter and the sink pass all packets through unchanged.
+StreamBasedPacketSink uart_packet_output(uart_stream_output, uart_tx_frame_buf, sizeof(uart_tx_frame_buf));
+extern MultidropPacketFilter uart_multidrop_filter;
+MultidropPacketSink uart_multidrop_output(uart_packet_output, uart_multidrop_filter,
+        uart_tx_addressed_packet_buf, sizeof(uart_tx_addressed_packet_buf));
+BidirectionalPacketBasedChannel uart_channel(uart_multidrop_output,
+        uart_tx_packet_buf, sizeof(uart_tx_packet_buf), UART_MAX_RX_PACKET_SIZE, &uart_telemetry);
+MultidropPacketFilter uart_multidrop_filter(uart_channel);
+StreamToPacketSegmenter uart_stream_input(uart_multidrop_filter, uart_rx_packet_buf, sizeof(uart_rx_packet_buf));
+
+static void start_rx_dma() {
+    HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
+    dma_last_rcv_idx = 0;
+    // The DMA only interrupts when the buffer is half or entirely full. The idle
+    // line interrupt catches the end of every burst that is shorter than that.
+    __HAL_UART_CLEAR_IDLEFLAG(huart_);
+    __HAL_UART_ENABLE_IT(huart_, UART_IT_IDLE);
+}
 
 static void uart_server_thread(void * ctx) {
     (void) ctx;
 
     for (;;) {
+        // Woken up by the RX interrupts, by a receive error and by the control
+        // loop if there is telemetry to send. The timeout is only a fallback
+        // in case an interrupt was missed.
+        osSemaphoreWait(sem_uart_rx, 100);
+
         // Check for UART errors and restart receive DMA transfer if required
         if (huart_->RxState != HAL_UART_STATE_BUSY_RX) {
             HAL_UART_AbortReceive(huart_);
-            HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
-            dma_last_rcv_idx = 0;
+            start_rx_dma();
         }
+        uart_stream_output.restart_if_idle();
         // Fetch the circular buffer "write pointer", where it would write next
         uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart_->hdmarx->Instance->NDTR;
         if (new_rcv_idx > UART_RX_BUFFER_SIZE) { // defensive programming
             continue;
         }
 
+        if (new_rcv_idx != dma_last_rcv_idx) {
+            uart_stream_output.mark_rx();
+        }
+
+        // On a shared bus only addressed fibre requests are answered. The
+        // ASCII protocol and unsolicited data would collide with other nodes.
+        bool multidrop = uart_multidrop_filter.get_address() != 0;
+
         // Process bytes in one or two chunks (two in case there was a wrap)
         if (new_rcv_idx < dma_last_rcv_idx) {
             uart_stream_input.process_bytes(dma_rx_buffer + dma_last_rcv_idx,
                     UART_RX_BUFFER_SIZE - dma_last_rcv_idx, nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer + dma_last_rcv_idx,
-                    UART_RX_BUFFER_SIZE - dma_last_rcv_idx, uart_stream_output);
+            if (!multidrop)
+                uart_ascii_protocol.parse_stream(dma_rx_buffer + dma_last_rcv_idx,
+                        UART_RX_BUFFER_SIZE - dma_last_rcv_idx);
             dma_last_rcv_idx = 0;
         }
         if (new_rcv_idx > dma_last_rcv_idx) {
             uart_stream_input.process_bytes(dma_rx_buffer + dma_last_rcv_idx,
                     new_rcv_idx - dma_last_rcv_idx, nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer + dma_last_rcv_idx,
-                    new_rcv_idx - dma_last_rcv_idx, uart_stream_output);
+            if (!multidrop)
+                uart_ascii_protocol.parse_stream(dma_rx_buffer + dma_last_rcv_idx,
+                        new_rcv_idx - dma_last_rcv_idx);
             dma_last_rcv_idx = new_rcv_idx;
         }
 
-        // The thread is woken up by the control loop at 8kHz. This should be
-        // enough for most applications.
-        // At 1Mbaud/s that corresponds to at most 12.5 bytes which can arrive
-        // during the sleep period.
-        osThreadSuspend(nullptr);
+        if (!multidrop) {
+            uart_channel.send_telemetry();
+            uart_ascii_protocol.send_feedback();
+        }
+    }
+}
+
+// Must be called before start_uart_server()
+void configure_uart_multidrop(uint8_t address, Stm32Gpio de_gpio, uint32_t turnaround_us) {
+    uart_multidrop_filter.set_address(address);
+    if (de_gpio) {
+        uart_stream_output.enable_direction_control(de_gpio, turnaround_us);
     }
 }
 
 // TODO: allow multiple UART server instances
 void start_uart_server(UART_HandleTypeDef* huart) {
     huart_ = huart;
-
-    // DMA is set up to receive in a circular buffer forever.
-    // We dont use interrupts to fetch the data, instead we periodically read
-    // data out of the circular buffer into a parse buffer, controlled by a state machine
-    HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
-    dma_last_rcv_idx = 0;
+    start_rx_dma();
 
     // Start UART communication thread
     osThreadDef(uart_server_thread_def, uart_server_thread, osPriorityNormal, 0, stack_size_uart_thread / sizeof(StackType_t) /* the ascii protocol needs considerable stack space */);
     uart_thread = osThreadCreate(osThread(uart_server_thread_def), NULL);
 }
 
-void uart_poll() {
-    if (uart_thread) { // the thread is only started if UART is enabled
-        osThreadResume(uart_thread);
+// Called from the control loop after all components were updated. Wakes up
+// the UART thread if there is a new telemetry or ASCII feedback sample to send.
+void uart_sample_telemetry(uint32_t timestamp) {
+    uart_telemetry.sample(timestamp);
+    uart_ascii_protocol.sample_feedback(timestamp);
+    if (uart_thread && (uart_telemetry.has_sample() || uart_ascii_protocol.has_feedback())) {
+        osSemaphoreRelease(sem_uart_rx);
+    }
+}
+
+// Called from the UART interrupt handler before HAL_UART_IRQHandler()
+void uart_irq_handler(UART_HandleTypeDef* huart) {
+    if (huart == huart_ && __HAL_UART_GET_FLAG(huart, UART_FLAG_IDLE) && __HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE)) {
+        __HAL_UART_CLEAR_IDLEFLAG(huart);
+        osSemaphoreRelease(sem_uart_rx);
     }
 }
 
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        osSemaphoreRelease(sem_uart_rx);
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        osSemaphoreRelease(sem_uart_rx);
+}
+
+// The HAL stops the receive DMA on errors. The thread restarts it.
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart) {
+    if (huart == huart_)
+        osSemaphoreRelease(sem_uart_rx);
+}
+
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart) {
-    osSemaphoreRelease(sem_uart_dma);
+    if (huart == huart_)
+        uart_stream_output.on_transfer_complete();
 }
@@ -3,7 +3,12 @@
 
 #ifdef __cplusplus
 #include "fibre/protocol.hpp"
+#include <Drivers/STM32/stm32_gpio.hpp>
 extern StreamSink* uart_stream_output_ptr;
+class ASCII_protocol;
+extern ASCII_protocol uart_ascii_protocol;
+
+void configure_uart_multidrop(uint8_t address, Stm32Gpio de_gpio, uint32_t turnaround_us);
 
 extern "C" {
 #endif
@@ -15,7 +20,8 @@ extern osThreadId uart_thread;
 extern const uint32_t stack_size_uart_thread;
 
 void start_uart_server(UART_HandleTypeDef* huart);
-void uart_poll(void);
+void uart_irq_handler(UART_HandleTypeDef* huart);
+void uart_sample_telemetry(uint32_t timestamp);
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,7 @@
 #include <usb_device.h>
 #include <cmsis_os.h>
 #include <freertos_vars.h>
+#include <Drivers/STM32/stm32_system.h>
 
 #include <odrive_main.h>
 
@@ -17,52 +18,96 @@ osThreadId usb_thread;
 const uint32_t stack_size_usb_thread = 4096; // Bytes
 USBStats_t usb_stats_;
 
+// Number of packets that can be queued per IN endpoint. While one packet is
+// being transferred, the next ones wait in the queue so that they are sent on
+// the host's next IN token instead of after a round trip through the thread.
+#define USB_TX_QUEUE_LENGTH 4
+
+// Each IN endpoint has its own queue and completion semaphore so that a busy
+// CDC interface doesn't hold up the native interface and vice versa.
 class USBSender : public PacketSink {
 public:
-    USBSender(uint8_t endpoint_pair, const osSemaphoreId& sem_usb_tx)
-            : endpoint_pair_(endpoint_pair), sem_usb_tx_(sem_usb_tx) {}
+    USBSender(uint8_t endpoint_pair, uint8_t* queue_buf, size_t mtu, const osSemaphoreId& sem_usb_tx)
+            : endpoint_pair_(endpoint_pair), queue_buf_(queue_buf), mtu_(mtu), sem_usb_tx_(sem_usb_tx) {}
 
     int process_packet(const uint8_t* buffer, size_t length) {
         // cannot send partial packets
-        if (length > USB_TX_DATA_SIZE)
+        if (length > mtu_)
             return -1;
-        // wait for USB interface to become ready
-        if (osSemaphoreWait(sem_usb_tx_, PROTOCOL_SERVER_TIMEOUT_MS) != osOK) {
-            // If the host resets the device it might be that the TX-complete handler is never called
-            // and the sem_usb_tx_ semaphore is never released. To handle this we just override the
-            // TX buffer if this wait times out. The implication is that the channel is no longer lossless.
-            // TODO: handle endpoint reset properly
-            usb_stats_.tx_overrun_cnt++;
+        // wait for a free slot in the queue
+        while (n_queued_ >= USB_TX_QUEUE_LENGTH) {
+            if (osSemaphoreWait(sem_usb_tx_, PROTOCOL_SERVER_TIMEOUT_MS) != osOK) {
+                // If the host resets the device it might be that the TX-complete handler is never called
+                // and the queue never drains. To handle this we drop the queued packets if this wait
+                // times out. The implication is that the channel is no longer lossless.
+                // TODO: handle endpoint reset properly
+                usb_stats_.tx_overrun_cnt++;
+                CRITICAL_SECTION() {
+                    head_ = tail_;
+                    n_queued_ = 0;
+                    in_flight_ = false;
+                }
+            }
         }
-        // transmit packet
-#if HW_VERSION_MAJOR == 3 // TODO: remove preprocessor switch
-        uint8_t status = CDC_Transmit_FS(
-#elif HW_VERSION_MAJOR == 4
-        uint8_t status = CDC_Transmit_HS(
-#else
-#error "not supported"
-#endif
-                const_cast<uint8_t*>(buffer) /* casting this const away is safe because...
-                well... it's not actually. Stupid STM. */, length, endpoint_pair_);
-        if (status != USBD_OK) {
-            osSemaphoreRelease(sem_usb_tx_);
-            return -1;
+
+        // The slot at tail_ is owned by this thread until it is queued
+        memcpy(queue_buf_ + tail_ * mtu_, buffer, length);
+        lengths_[tail_] = length;
+        tail_ = (tail_ + 1) % USB_TX_QUEUE_LENGTH;
+        CRITICAL_SECTION() {
+            n_queued_ = n_queued_ + 1;
+            if (!in_flight_)
+                start_next_transfer();
         }
         usb_stats_.tx_cnt++;
         return 0;
     }
+
+    // @brief Called from the USB interrupt when the IN transfer of this endpoint is done
+    void on_transfer_complete() {
+        if (in_flight_) {
+            head_ = (head_ + 1) % USB_TX_QUEUE_LENGTH;
+            n_queued_ = n_queued_ - 1;
+        }
+        start_next_transfer();
+        osSemaphoreRelease(sem_usb_tx_);
+    }
+
+    uint8_t get_endpoint_pair() { return endpoint_pair_; }
+
+    // @brief Number of bytes that can be sent without waiting, in full packets
+    size_t get_free_space() { return (USB_TX_QUEUE_LENGTH - n_queued_) * mtu_; }
+
 private:
+    // Must be called with interrupts disabled or from the USB interrupt
+    void start_next_transfer() {
+        in_flight_ = false;
+        if (!n_queued_ || !usb_dev_handle.pClassData)
+            return;
+        USBD_CDC_SetTxBuffer(&usb_dev_handle, queue_buf_ + head_ * mtu_, lengths_[head_], endpoint_pair_);
+        // If this fails (e.g. not configured yet), the next call to process_packet() retries
+        in_flight_ = (USBD_CDC_TransmitPacket(&usb_dev_handle, endpoint_pair_) == USBD_OK);
+    }
+
     uint8_t endpoint_pair_;
+    uint8_t* queue_buf_; // USB_TX_QUEUE_LENGTH slots of mtu_ bytes
+    size_t mtu_;
     const osSemaphoreId& sem_usb_tx_;
+    size_t lengths_[USB_TX_QUEUE_LENGTH];
+    size_t head_ = 0; // next slot to transfer, owned by the interrupt
+    size_t tail_ = 0; // next free slot, owned by the thread
+    volatile size_t n_queued_ = 0;
+    volatile bool in_flight_ = false;
 };
 
-// Note we could have independent semaphores here to allow concurrent transmission
-USBSender usb_packet_output_cdc(CDC_OUT_EP, sem_usb_tx);
-USBSender usb_packet_output_native(ODRIVE_OUT_EP, sem_usb_tx);
+static uint8_t usb_cdc_tx_queue_buf[USB_TX_QUEUE_LENGTH][USB_TX_DATA_SIZE];
+static uint8_t usb_native_tx_queue_buf[USB_TX_QUEUE_LENGTH][USB_NATIVE_TX_DATA_SIZE];
+USBSender usb_packet_output_cdc(CDC_OUT_EP, &usb_cdc_tx_queue_buf[0][0], USB_TX_DATA_SIZE, sem_usb_tx_cdc);
+USBSender usb_packet_output_native(ODRIVE_OUT_EP, &usb_native_tx_queue_buf[0][0], USB_NATIVE_TX_DATA_SIZE, sem_usb_tx_native);
 
 class TreatPacketSinkAsStreamSink : public StreamSink {
 public:
-    TreatPacketSinkAsStreamSink(PacketSink& output) : output_(output) {}
+    TreatPacketSinkAsStreamSink(USBSender& output) : output_(output) {}
     int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) {
         // Loop to ensure all bytes get sent
         while (length) {
@@ -76,21 +121,35 @@ public:
         }
         return 0;
     }
-    size_t get_free_space() { return SIZE_MAX; }
+    size_t get_free_space() { return output_.get_free_space(); }
 private:
-    PacketSink& output_;
+    USBSender& output_;
 } usb_stream_output(usb_packet_output_cdc);
 
 // This is used by the printf feature. Hence the above statics, and below seemingly random ptr (it's externed)
 // TODO: less spaghetti code
 StreamSink* usb_stream_output_ptr = &usb_stream_output;
 
+static TelemetrySubscription usb_telemetry;
+ASCII_protocol usb_ascii_protocol(usb_stream_output);
+
 #if defined(USB_PROTOCOL_NATIVE)
-BidirectionalPacketBasedChannel usb_channel(usb_packet_output_native);
+// Incoming packets are limited to a single USB packet, outgoing packets can
+// span multiple USB packets.
+static uint8_t usb_tx_packet_buf[USB_NATIVE_TX_DATA_SIZE];
+BidirectionalPacketBasedChannel usb_channel(usb_packet_output_native,
+        usb_tx_packet_buf, sizeof(usb_tx_packet_buf), USB_RX_DATA_SIZE, &usb_telemetry);
 #elif defined(USB_PROTOCOL_NATIVE_STREAM_BASED)
-StreamBasedPacketSink usb_packetized_output(usb_stream_output);
-BidirectionalPacketBasedChannel usb_channel(usb_packetized_output);
-StreamToPacketSegmenter usb_native_stream_input(usb_channel);
+#define USB_MAX_RX_PACKET_SIZE 256
+#define USB_MAX_TX_PACKET_SIZE 512
+static uint8_t usb_rx_packet_buf[USB_MAX_RX_PACKET_SIZE + 2];
+static uint8_t usb_tx_packet_buf[USB_MAX_TX_PACKET_SIZE];
+// Holds an entire outgoing frame so that it is sent in as few USB packets as possible
+static uint8_t usb_tx_frame_buf[USB_MAX_TX_PACKET_SIZE + MAX_FRAME_OVERHEAD];
+StreamBasedPacketSink usb_packetized_output(usb_stream_output, usb_tx_frame_buf, sizeof(usb_tx_frame_buf));
+BidirectionalPacketBasedChannel usb_channel(usb_packetized_output,
+        usb_tx_packet_buf, sizeof(usb_tx_packet_buf), USB_MAX_RX_PACKET_SIZE, &usb_telemetry);
+StreamToPacketSegmenter usb_native_stream_input(usb_channel, usb_rx_packet_buf, sizeof(usb_rx_packet_buf));
 #endif
 
 struct USBInterface {
@@ -128,14 +187,12 @@ static void usb_server_thread(void * ctx) {
         // const uint32_t usb_check_timeout = 1; // ms
         osStatus sem_stat = osSemaphoreWait(sem_usb_rx, osWaitForever);
         if (sem_stat == osOK) {
-            usb_stats_.rx_cnt++;
-
             // CDC Interface
             if (CDC_interface.data_pending) {
+                usb_stats_.rx_cnt++;
                 CDC_interface.data_pending = false;
                 if (odrv.config_.enable_ascii_protocol_on_usb) {
-                    ASCII_protocol_parse_stream(CDC_interface.rx_buf,
-                            CDC_interface.rx_len, usb_stream_output);
+                    usb_ascii_protocol.parse_stream(CDC_interface.rx_buf, CDC_interface.rx_len);
                 } else {
 #if defined(USB_PROTOCOL_NATIVE)
                     usb_channel.process_packet(CDC_interface.rx_buf, CDC_interface.rx_len);
@@ -149,6 +206,7 @@ static void usb_server_thread(void * ctx) {
 
             // Native Interface
             if (ODrive_interface.data_pending) {
+                usb_stats_.rx_cnt++;
                 ODrive_interface.data_pending = false;
 #if defined(USB_PROTOCOL_NATIVE)
                 usb_channel.process_packet(ODrive_interface.rx_buf, ODrive_interface.rx_len);
@@ -158,6 +216,11 @@ static void usb_server_thread(void * ctx) {
 #endif
                 USBD_CDC_ReceivePacket(&usb_dev_handle, ODrive_interface.out_ep);  // Allow next packet
             }
+
+#if defined(USB_PROTOCOL_NATIVE) || defined(USB_PROTOCOL_NATIVE_STREAM_BASED)
+            usb_channel.send_telemetry();
+#endif
+            usb_ascii_protocol.send_feedback();
         }
     }
 }
@@ -182,6 +245,25 @@ void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair) {
     osSemaphoreRelease(sem_usb_rx);
 }
 
+// Called from the control loop after all components were updated. Wakes up
+// the USB thread if there is a new telemetry or ASCII feedback sample to send.
+void usb_sample_telemetry(uint32_t timestamp) {
+    usb_telemetry.sample(timestamp);
+    usb_ascii_protocol.sample_feedback(timestamp);
+    if (usb_telemetry.has_sample() || usb_ascii_protocol.has_feedback()) {
+        osSemaphoreRelease(sem_usb_rx);
+    }
+}
+
+// Called from the USB interrupt when an IN transfer is complete
+void usb_tx_complete(uint8_t endpoint_pair) {
+    if (endpoint_pair == usb_packet_output_cdc.get_endpoint_pair()) {
+        usb_packet_output_cdc.on_transfer_complete();
+    } else if (endpoint_pair == usb_packet_output_native.get_endpoint_pair()) {
+        usb_packet_output_native.on_transfer_complete();
+    }
+}
+
 void start_usb_server() {
     // Start USB communication thread
     osThreadDef(usb_server_thread_def, usb_server_thread, osPriorityNormal, 0, stack_size_usb_thread / sizeof(StackType_t));
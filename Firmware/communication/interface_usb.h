@@ -4,6 +4,8 @@
 #ifdef __cplusplus
 #include "fibre/protocol.hpp"
 extern StreamSink* usb_stream_output_ptr;
+class ASCII_protocol;
+extern ASCII_protocol usb_ascii_protocol;
 
 extern "C" {
 #endif
@@ -23,7 +25,9 @@ typedef struct {
 extern USBStats_t usb_stats_;
 
 void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair);
+void usb_tx_complete(uint8_t endpoint_pair);
 void start_usb_server(void);
+void usb_sample_telemetry(uint32_t timestamp);
 
 #ifdef __cplusplus
 }
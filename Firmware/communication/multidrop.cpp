@@ -0,0 +1,37 @@
+
+#include "multidrop.hpp"
+
+#include <string.h>
+
+int MultidropPacketFilter::process_packet(const uint8_t* buffer, size_t length) {
+    if (!address_) {
+        return output_.process_packet(buffer, length);
+    } else if (length < 1) {
+        return 0;
+    }
+
+    if (buffer[0] == address_) {
+        return output_.process_packet(buffer + 1, length - 1);
+    } else if (buffer[0] == BROADCAST_ADDRESS) {
+        // The output processes the request synchronously, so the response
+        // (if any) is sent while muted_ is set.
+        muted_ = true;
+        int result = output_.process_packet(buffer + 1, length - 1);
+        muted_ = false;
+        return result;
+    }
+    return 0;
+}
+
+int MultidropPacketSink::process_packet(const uint8_t* buffer, size_t length) {
+    if (!filter_.get_address()) {
+        return output_.process_packet(buffer, length);
+    } else if (filter_.is_muted()) {
+        return 0;
+    } else if (length + 1 > buffer_size_) {
+        return -1;
+    }
+    buffer_[0] = filter_.get_address() | MultidropPacketFilter::RESPONSE_FLAG;
+    memcpy(buffer_ + 1, buffer, length);
+    return output_.process_packet(buffer_, length + 1);
+}
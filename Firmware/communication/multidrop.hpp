@@ -0,0 +1,71 @@
+#ifndef __MULTIDROP_HPP
+#define __MULTIDROP_HPP
+
+#include <fibre/protocol.hpp>
+
+/**
+ * @brief Addressing for fibre packets on a shared (e.g. RS-485) bus.
+ *
+ * Every packet on the bus starts with an address byte. Requests from the host
+ * carry the address of the node (1...126) or BROADCAST_ADDRESS. Responses
+ * carry the address of the sender with RESPONSE_FLAG set, so nodes neither
+ * mistake each other's responses for requests nor react to their own echo.
+ * The address is part of the framed packet and thus covered by its CRC16.
+ *
+ * Broadcast requests are executed by all nodes but answered by none, since
+ * the responses would collide. This is meant for setpoints that all nodes
+ * should apply at the same time.
+ *
+ * Address 0 disables the addressing: all packets are passed on unchanged.
+ */
+class MultidropPacketFilter : public PacketSink {
+public:
+    static constexpr uint8_t BROADCAST_ADDRESS = 0x7f;
+    static constexpr uint8_t RESPONSE_FLAG = 0x80;
+
+    MultidropPacketFilter(PacketSink& output, uint8_t address = 0) :
+        output_(output), address_(address) {}
+
+    static bool is_valid_address(uint8_t address) {
+        return address >= 1 && address < BROADCAST_ADDRESS;
+    }
+
+    // @brief Must not be called while packets are being processed
+    void set_address(uint8_t address) { address_ = address; }
+
+    // @brief Passes packets that are addressed to this node to the output
+    // without the address byte. Drops all others.
+    int process_packet(const uint8_t* buffer, size_t length) override;
+
+    uint8_t get_address() const { return address_; }
+
+    // @brief True while a broadcast request is being processed
+    bool is_muted() const { return muted_; }
+
+private:
+    PacketSink& output_;
+    uint8_t address_;
+    bool muted_ = false;
+};
+
+/**
+ * @brief Prepends the response address to all packets that are sent while
+ * the filter is not muted.
+ *
+ * Packets of up to buffer_size - 1 bytes can be sent.
+ */
+class MultidropPacketSink : public PacketSink {
+public:
+    MultidropPacketSink(PacketSink& output, const MultidropPacketFilter& filter, uint8_t* buffer, size_t buffer_size) :
+        output_(output), filter_(filter), buffer_(buffer), buffer_size_(buffer_size) {}
+
+    int process_packet(const uint8_t* buffer, size_t length) override;
+
+private:
+    PacketSink& output_;
+    const MultidropPacketFilter& filter_;
+    uint8_t* buffer_;
+    size_t buffer_size_;
+};
+
+#endif // __MULTIDROP_HPP
@@ -0,0 +1,62 @@
+#ifndef __RING_BUFFER_HPP
+#define __RING_BUFFER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+/**
+ * @brief Byte FIFO for one producer and one consumer, which may run in
+ * different contexts (e.g. a thread and an interrupt).
+ *
+ * The consumer reads the data in place: get_contiguous() returns the longest
+ * block that can be handed to a DMA transfer and consume() releases it once
+ * the transfer is done.
+ *
+ * The indices run freely and wrap around at 2^32, which is why SIZE must be a
+ * power of two.
+ */
+template<size_t SIZE>
+class RingBuffer {
+    static_assert(SIZE && !(SIZE & (SIZE - 1)), "SIZE must be a power of two");
+
+public:
+    size_t get_used() const { return (uint32_t)(write_idx_ - read_idx_); }
+    size_t get_free_space() const { return SIZE - get_used(); }
+
+    // @brief Copies as many bytes as fit into the buffer. Producer side.
+    // @returns The number of bytes that were copied.
+    size_t write(const uint8_t* data, size_t length) {
+        length = std::min(length, get_free_space());
+        size_t offset = write_idx_ % SIZE;
+        size_t first = std::min(length, SIZE - offset);
+        memcpy(buffer_ + offset, data, first);
+        memcpy(buffer_, data + first, length - first);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        write_idx_ = write_idx_ + length;
+        return length;
+    }
+
+    // @brief Returns the oldest data that is stored in one piece. Consumer side.
+    // @returns The length of the block at *data (0 if the buffer is empty).
+    size_t get_contiguous(const uint8_t** data) const {
+        size_t offset = read_idx_ % SIZE;
+        *data = buffer_ + offset;
+        return std::min(get_used(), SIZE - offset);
+    }
+
+    // @brief Releases length bytes that were returned by get_contiguous().
+    void consume(size_t length) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        read_idx_ = read_idx_ + length;
+    }
+
+private:
+    volatile uint32_t write_idx_ = 0;
+    volatile uint32_t read_idx_ = 0;
+    uint8_t buffer_[SIZE];
+};
+
+#endif // __RING_BUFFER_HPP
@@ -10,18 +10,39 @@
 
 class TypeInfo;
 class Introspectable;
-using introspectable_storage_t = std::aligned_storage<16, 4>::type;
+// Large enough for a Property<T> with custom getter and setter (16 bytes on ARM)
+using introspectable_storage_t = std::aligned_storage<4 * sizeof(void*), alignof(void*)>::type;
 
 struct PropertyInfo {
     const char * name;
     const TypeInfo* type_info;
 };
 
+/**
+ * @brief Returns true if the names are sorted in strcmp() order. Used by the
+ * generated code to check the order of the property tables at compile time.
+ */
+template<size_t N>
+constexpr bool is_sorted_by_name(const char* const (&names)[N]) {
+    for (size_t i = 1; i < N; ++i) {
+        const char* a = names[i - 1];
+        const char* b = names[i];
+        while (*a && *a == *b) {
+            ++a;
+            ++b;
+        }
+        if ((unsigned char)*a >= (unsigned char)*b)
+            return false;
+    }
+    return true;
+}
+
 /**
  * @brief Contains runtime accessible type information.
  * 
  * Specifically, this information consists of a list of PropertyInfo items which
- * enable accessing attributes of an object by a runtime string.
+ * enable accessing attributes of an object by a runtime string. The list must
+ * be sorted by name (in strcmp() order) so that it can be binary searched.
  * 
  * Typically, for each combination of C++ type and Fibre interface implemented
  * by this type, one (static constant) TypeInfo object will exist.
@@ -67,10 +88,15 @@ public:
      * 
      * If the attribute does not exist, an invalid Introspectable is returned.
      * 
+     * The result references the attribute directly and can be kept by the
+     * caller to access the attribute again without resolving the path.
+     * Caching is left to the caller: the ASCII r/w commands resolve the path
+     * of every command again.
+     * 
      * @param path: The name or path of the attribute.
      * @param length: The maximum length of the name.
      */
-    Introspectable get_child(const char * path, size_t length) {
+    Introspectable get_child(const char * path, size_t length) const {
         Introspectable current = *this;
 
         const char * begin = path;
@@ -85,18 +111,33 @@ public:
         return current;
     };
 
-    bool is_valid() {
+    bool is_valid() const {
         return type_info_;
     }
 
-    const TypeInfo* get_type_info() {
+    const TypeInfo* get_type_info() const {
         return type_info_;
     }
 
 private:
+    // Compares the (not null-terminated) name to a null-terminated string in
+    // the same order as strcmp().
+    static int compare_name(const char * name, size_t length, const char * str) {
+        int cmp = strncmp(name, str, length);
+        return cmp ? cmp : -(int)(unsigned char)str[length];
+    }
+
     Introspectable get_direct_child(const char * name, size_t length) const {
-        for (size_t i = 0; i < type_info_->property_table_length_; ++i) {
-            if (!strncmp(name, type_info_->property_table_[i].name, length) && (length == strlen(type_info_->property_table_[i].name))) {
+        // The property table is sorted by name (see type_info_template.j2)
+        size_t lo = 0, hi = type_info_->property_table_length_;
+        while (lo < hi) {
+            size_t i = lo + (hi - lo) / 2;
+            int cmp = compare_name(name, length, type_info_->property_table_[i].name);
+            if (cmp < 0) {
+                hi = i;
+            } else if (cmp > 0) {
+                lo = i + 1;
+            } else {
                 Introspectable result;
                 result.storage_ = type_info_->get_child(storage_, i);
                 result.type_info_ = type_info_->property_table_[i].type_info;
@@ -0,0 +1,43 @@
+#ifndef __FIBRE_POSIX_REACTOR_HPP
+#define __FIBRE_POSIX_REACTOR_HPP
+
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * @brief Single-threaded event loop based on epoll.
+ *
+ * File descriptors are registered together with a callback which is invoked
+ * by run() whenever one of the requested events (EPOLLIN, EPOLLOUT, ...)
+ * occurs. All callbacks run on the thread that calls run(), so the objects
+ * that they operate on need no locking.
+ */
+class PosixReactor {
+public:
+    using callback_t = std::function<void(uint32_t events)>;
+
+    PosixReactor() {}
+    PosixReactor(const PosixReactor&) = delete;
+    ~PosixReactor();
+
+    int init();
+
+    // These may also be called from within a callback
+    int add(int fd, uint32_t events, callback_t callback);
+    int modify(int fd, uint32_t events);
+    int remove(int fd);
+
+    // @brief Dispatches events until stop() is called.
+    int run();
+
+    // @brief Makes run() return. Can be called from any thread.
+    void stop();
+
+private:
+    int epoll_fd_ = -1;
+    int stop_fd_ = -1;
+    std::unordered_map<int, callback_t> callbacks_;
+};
+
+#endif // __FIBRE_POSIX_REACTOR_HPP
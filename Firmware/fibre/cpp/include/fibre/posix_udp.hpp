@@ -1,4 +1,11 @@
 
 #include "protocol.hpp"
 
+class PosixReactor;
+
+// @brief Serves fibre requests on the given UDP port. The server runs
+// within the reactor's thread until the reactor is destroyed.
+int serve_on_udp(PosixReactor& reactor, unsigned int port);
+
+// @brief Runs a reactor that only serves UDP. Blocks forever.
 int serve_on_udp(unsigned int port);
@@ -8,6 +8,8 @@ see protocol.md for the protocol specification
 // TODO: resolve assert
 #define assert(expr)
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <limits>
 #include <cmath>
@@ -20,6 +22,7 @@ see protocol.md for the protocol specification
 #include "cpp_utils.hpp"
 #include "bufptr.hpp"
 #include "simple_serdes.hpp"
+#include "text_parser.hpp"
 
 // Note that this option cannot be used to debug UART because it prints on UART
 //#define DEBUG_FIBRE
@@ -70,9 +73,79 @@ struct ReceiverState {
 
 constexpr uint16_t PROTOCOL_VERSION = 1;
 
+// Packet size limits that a channel uses as long as the host did not
+// negotiate larger packets (see BidirectionalPacketBasedChannel).
 // This value must not be larger than USB_TX_DATA_SIZE defined in usbd_cdc_if.h
 constexpr uint16_t TX_BUF_SIZE = 32; // does not work with 64 for some reason
-constexpr uint16_t RX_BUF_SIZE = 128; // larger values than 128 have currently no effect because of protocol limitations
+constexpr uint16_t RX_BUF_SIZE = 128;
+
+// The length in a stream frame header is encoded as varint. Lengths below 128
+// take one byte, which makes these frames identical to the original framing.
+// Three bytes allow for packets up to 2 MiB.
+constexpr size_t MAX_FRAME_LENGTH_BYTES = 3;
+// Largest number of bytes that the framing adds to a packet:
+// {prefix, length (varint), crc8} + payload + {crc16}
+constexpr size_t MAX_FRAME_OVERHEAD = 2 + MAX_FRAME_LENGTH_BYTES + 2;
+
+// Special offset on endpoint 0 to negotiate the packet sizes of a channel.
+// Request: {uint32 offset, uint32 max packet length the host can receive}
+// Response: {uint32 max packet length the device can receive,
+//            uint32 max packet length the device will send}
+// Devices without support for this send an empty response.
+constexpr uint32_t ENDPOINT0_NEGOTIATE_PACKET_SIZE = 0xfffffffe;
+
+// Special offset on endpoint 0 to run several endpoint operations at once.
+// Request: {uint32 offset, uint16 json_crc, entries...}
+//  with each entry {uint16 endpoint_id, uint8 input_length,
+//                   uint8 output_length, input}
+// Response: for each entry {uint8 actual output length, output}
+// The entries are executed in order. Processing stops at the first entry
+// whose output doesn't fit into the response anymore. Devices without support
+// for this send an empty response.
+constexpr uint32_t ENDPOINT0_BATCH = 0xfffffffd;
+
+// Special offset on endpoint 0 to subscribe to periodic telemetry.
+// Request: {uint32 offset, uint16 json_crc, uint32 decimation, uint16 endpoint_ids...}
+// Response: {uint8 value length for each endpoint}
+// The endpoints are sampled every `decimation` control loop iterations and sent
+// as unsolicited packets with the sequence number TELEMETRY_SEQ_NO:
+// {uint16 seq_no, uint32 timestamp, values...}
+// A decimation of 0 cancels the subscription. If the subscription is rejected
+// or not supported by the device, the response is empty.
+constexpr uint32_t ENDPOINT0_SUBSCRIBE = 0xfffffffc;
+
+// Special offset on endpoint 0 to read the zlib compressed JSON descriptor.
+// Request: {uint32 offset, uint32 position in the compressed descriptor}
+// Response: the compressed descriptor starting at that position, empty if the
+// position is beyond the end. Devices without support for this also send an
+// empty response.
+constexpr uint32_t ENDPOINT0_COMPRESSED_JSON = 0xfffffffb;
+
+// Special offset on endpoint 0 to allow several requests in flight at once.
+// Request: {uint32 offset, uint8 window size requested by the host}
+// Response: {uint8 window size granted by the device}
+// From then on the device remembers the responses to the last `window`
+// requests. A retransmitted request (same seq_no and same content) is answered
+// from this history instead of being executed again. The request also clears
+// the history. Devices without support for this send an empty response.
+constexpr uint32_t ENDPOINT0_NEGOTIATE_WINDOW = 0xfffffffa;
+
+// Special offset on endpoint 0 to write several properties in the same
+// control loop iteration.
+// Request: {uint32 offset, uint16 json_crc, uint8 flags, entries...}
+//  with each entry {uint16 endpoint_id, uint8 input_length, input}
+//  and flags a combination of TRANSACTION_BEGIN and TRANSACTION_COMMIT
+// Response: {uint8 status} (see TransactionBuffer::Status)
+// The entries are staged and only applied at the start of the next control
+// loop iteration after the commit. A transaction can span several requests.
+// Devices without support for this send an empty response.
+constexpr uint32_t ENDPOINT0_TRANSACTION = 0xfffffff9;
+constexpr uint8_t TRANSACTION_BEGIN = 0x01;
+constexpr uint8_t TRANSACTION_COMMIT = 0x02;
+
+// Clients hardwire bit 7 of their sequence number to 1 so this never collides
+// with the response to a request.
+constexpr uint16_t TELEMETRY_SEQ_NO = 0xff00;
 
 // Maximum time we allocate for processing and responding to a request
 constexpr uint32_t PROTOCOL_SERVER_TIMEOUT_MS = 10;
@@ -88,11 +161,15 @@ namespace fibre {
 // These symbols are defined in the autogenerated endpoints.hpp
 extern const unsigned char embedded_json[];
 extern const size_t embedded_json_length;
+extern const unsigned char embedded_json_compressed[];
+extern const size_t embedded_json_compressed_length;
 extern const uint16_t json_crc_;
 extern const uint32_t json_version_id_;
 bool endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer);
 bool endpoint0_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
 bool is_endpoint_ref_valid(endpoint_ref_t endpoint_ref);
+bool is_property_endpoint(int idx);
+bool is_transactional_endpoint(int idx);
 bool set_endpoint_from_float(endpoint_ref_t endpoint_ref, float value);
 }
 
@@ -194,21 +271,39 @@ public:
     //virtual size_t get_free_space() = 0;
 };
 
+// @brief Splits a stream into packets.
+// Frame format: {0xAA, varint length, crc8(header), payload, crc16(payload)}
+// Frames with a payload that doesn't fit into packet_buffer are dropped.
 class StreamToPacketSegmenter : public StreamSink {
 public:
-    explicit StreamToPacketSegmenter(PacketSink& output) :
+    StreamToPacketSegmenter(PacketSink& output, uint8_t* packet_buffer, size_t packet_buffer_size) :
+        packet_buffer_(packet_buffer),
+        packet_buffer_size_(packet_buffer_size),
         output_(output)
     {
     };
 
+    // @brief Splits the stream into packets.
+    // Frames that are entirely contained in the input buffer are validated in
+    // place and handed to the output without being copied into packet_buffer.
+    // This relies on the output processing the packet synchronously.
+    // Frames that span several calls are reassembled in packet_buffer.
     int process_bytes(const uint8_t *buffer, size_t length, size_t* processed_bytes) override;
     
     size_t get_free_space() { return SIZE_MAX; }
 
+    // @brief Largest packet (excluding framing) that can be received.
+    size_t get_max_packet_length() { return packet_buffer_size_ - 2; }
+
 private:
-    uint8_t header_buffer_[3] = {0};
+    void reset() { header_index_ = header_length_ = packet_index_ = packet_length_ = 0; }
+    size_t process_contiguous_frame(const uint8_t* buffer, size_t length, int* result);
+
+    uint8_t header_buffer_[2 + MAX_FRAME_LENGTH_BYTES] = {0};
     size_t header_index_ = 0;
-    uint8_t packet_buffer_[RX_BUF_SIZE] = {0};
+    size_t header_length_ = 0; // 0 until the length field is complete
+    uint8_t* packet_buffer_;
+    size_t packet_buffer_size_;
     size_t packet_index_ = 0;
     size_t packet_length_ = 0;
     PacketSink& output_;
@@ -217,8 +312,15 @@ private:
 
 class StreamBasedPacketSink : public PacketSink {
 public:
-    explicit StreamBasedPacketSink(StreamSink& output) :
-        output_(output)
+    // @param frame_buffer: Optional scratch buffer. Packets of up to
+    //        frame_buffer_size - MAX_FRAME_OVERHEAD bytes are assembled in
+    //        this buffer and passed to the output with a single process_bytes
+    //        call. Larger packets (or all packets if no buffer is given) are
+    //        passed on as header, payload and CRC in three separate calls.
+    explicit StreamBasedPacketSink(StreamSink& output, uint8_t* frame_buffer = nullptr, size_t frame_buffer_size = 0) :
+        output_(output),
+        frame_buffer_(frame_buffer),
+        frame_buffer_size_(frame_buffer_size)
     {
     };
     
@@ -227,6 +329,8 @@ public:
 
 private:
     StreamSink& output_;
+    uint8_t* frame_buffer_;
+    size_t frame_buffer_size_;
 };
 
 // @brief: Represents a stream sink that's based on an underlying packet sink.
@@ -413,26 +517,155 @@ template<> struct Codec<endpoint_ref_t> {
 }
 
 
+/*
+* Holds the endpoints that a client subscribed to (see ENDPOINT0_SUBSCRIBE)
+* and the most recent sample of their values.
+*
+* sample() is meant to be called at the end of a control loop iteration so
+* that all values of one sample belong to the same iteration. It must run at a
+* higher priority than the thread that owns the channel, which calls all other
+* functions. The sample buffer is guarded by a sequence counter so that no
+* locks are needed on either side.
+*/
+class TelemetrySubscription {
+public:
+    static constexpr size_t MAX_ENDPOINTS = 16;
+    static constexpr size_t MAX_SAMPLE_SIZE = 64;
+
+    bool subscribe(fibre::cbufptr_t endpoint_ids, uint32_t decimation, fibre::bufptr_t* value_lengths);
+    void sample(uint32_t timestamp);
+    bool has_sample() { return seq_ != last_read_seq_; }
+    size_t get_sample(uint8_t* buffer, size_t length);
+
+private:
+    uint16_t endpoint_ids_[MAX_ENDPOINTS];
+    uint8_t value_lengths_[MAX_ENDPOINTS];
+    size_t n_endpoints_ = 0;
+    size_t sample_size_ = 0;
+    uint32_t decimation_counter_ = 0;
+    volatile uint32_t decimation_ = 0; // 0: no active subscription
+    volatile uint32_t seq_ = 0; // odd while sample() is writing
+    uint32_t last_read_seq_ = 0;
+    uint8_t sample_[4 + MAX_SAMPLE_SIZE];
+};
+
+/*
+* Holds the property writes of a transaction (see ENDPOINT0_TRANSACTION)
+* until the control loop applies them.
+*
+* Writes are staged in one of two buffers. A commit hands the staged buffer
+* over to the control loop, which calls apply() at the start of every
+* iteration, and the next transaction is staged in the other buffer. apply()
+* must run at a higher priority than the threads that stage writes so it
+* never sees a half written buffer, and no locks are needed on either side.
+*
+* Only one channel (identified by the owner pointer) can have a transaction
+* open at a time. apply() also serves as the clock for abandoned transactions:
+* once the owner sent no request for STALE_TIMEOUT calls, another channel can
+* take the transaction over with begin().
+*/
+class TransactionBuffer {
+public:
+    static constexpr size_t MAX_SIZE = 128;
+    static constexpr uint32_t STALE_TIMEOUT = 1000; // apply() calls, 125 ms at an 8 kHz control loop
+
+    enum Status : uint8_t {
+        kOk = 0,
+        kRejected = 1, // invalid entry or too many entries, the transaction was discarded
+        kBusy = 2, // retry later: another channel has a transaction open or the previous commit wasn't applied yet
+    };
+
+    Status begin(const void* owner);
+    Status stage(const void* owner, fibre::cbufptr_t entries);
+    Status commit(const void* owner);
+    void apply();
+
+private:
+    void discard() { length_ = 0; owner_ = nullptr; }
+
+    uint8_t buffers_[2][MAX_SIZE];
+    size_t lengths_[2] = {0, 0};
+    size_t staging_ = 0; // index of the buffer that is being staged
+    size_t length_ = 0; // length of the staged entries
+    volatile int pending_ = -1; // index of the committed buffer, -1 if none
+    std::atomic<const void*> owner_{nullptr};
+    volatile uint32_t idle_count_ = 0; // apply() calls since the last request of the owner
+};
+
+namespace fibre {
+extern TransactionBuffer transaction_buffer;
+}
+
 /* @brief Handles the communication protocol on one channel.
 *
 * When instantiated with a list of endpoints and an output packet sink,
 * objects of this class will handle packets passed into process_packet,
 * pass the relevant data to the corresponding endpoints and dispatch response
 * packets on the output.
+*
+* Responses are limited to TX_BUF_SIZE until the host negotiates a larger
+* size with a ENDPOINT0_NEGOTIATE_PACKET_SIZE request. This keeps old hosts,
+* which drop packets of 128 bytes or more, working.
+*
+* @param tx_buf: Buffer for outgoing packets. Its size is the largest packet
+*        this channel can send.
+* @param max_rx_packet_length: Largest packet the underlying transport can
+*        deliver to this channel. Reported to the host during negotiation.
 */
 class BidirectionalPacketBasedChannel : public PacketSink {
 public:
-    explicit BidirectionalPacketBasedChannel(PacketSink& output) :
-        output_(output)
+    BidirectionalPacketBasedChannel(PacketSink& output, uint8_t* tx_buf, size_t tx_buf_size, size_t max_rx_packet_length,
+            TelemetrySubscription* telemetry = nullptr) :
+        output_(output),
+        tx_buf_(tx_buf),
+        tx_buf_size_(tx_buf_size),
+        max_rx_packet_length_(max_rx_packet_length),
+        max_tx_packet_length_(std::min(tx_buf_size, (size_t)TX_BUF_SIZE)),
+        telemetry_(telemetry)
     { }
 
     //size_t get_mtu() {
     //    return SIZE_MAX;
     //}
     int process_packet(const uint8_t* buffer, size_t length) override;
+
+    // @brief Sends the latest telemetry sample if there is a new one.
+    // Must be called from the same thread as process_packet().
+    int send_telemetry();
+
+    // Largest window that the device grants (see ENDPOINT0_NEGOTIATE_WINDOW)
+    static constexpr size_t MAX_WINDOW_SIZE = 8;
+    // Longer responses (e.g. JSON chunks) are not remembered. Retransmitted
+    // requests for them are executed again.
+    static constexpr size_t MAX_REMEMBERED_RESPONSE_LENGTH = 16;
+
 private:
+    struct RememberedResponse {
+        bool valid;
+        bool replayable;
+        uint16_t seq_no;
+        uint16_t request_crc; // over everything after the seq_no
+        uint8_t length;
+        uint8_t payload[MAX_REMEMBERED_RESPONSE_LENGTH];
+    };
+
+    bool negotiate_window(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer);
+    void remember_response(uint16_t seq_no, uint16_t request_crc, const uint8_t* payload, size_t length);
+    const RememberedResponse* find_response(uint16_t seq_no, uint16_t request_crc);
+    bool negotiate_packet_size(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer);
+    bool process_batch(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer);
+    bool subscribe(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer);
+    bool process_transaction(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer);
+
     PacketSink& output_;
-    uint8_t tx_buf_[TX_BUF_SIZE] = {0};
+    uint8_t* tx_buf_;
+    size_t tx_buf_size_;
+    size_t max_rx_packet_length_;
+    size_t max_tx_packet_length_;
+    TelemetrySubscription* telemetry_;
+    size_t window_size_ = 0; // 0 until negotiated
+    size_t next_response_slot_ = 0;
+    RememberedResponse responses_[MAX_WINDOW_SIZE] = {};
 };
 
 
@@ -452,40 +685,34 @@ struct format_traits_t;
 //     static constexpr const char * fmtp = "%f";
 // };
 template<> struct format_traits_t<int64_t> { using type = void;
-    static constexpr const char * fmt = "%lld";
     static constexpr const char * fmtp = "%lld";
 };
 template<> struct format_traits_t<uint64_t> { using type = void;
-    static constexpr const char * fmt = "%llu";
     static constexpr const char * fmtp = "%llu";
 };
 template<> struct format_traits_t<int32_t> { using type = void;
-    static constexpr const char * fmt = "%ld";
     static constexpr const char * fmtp = "%ld";
 };
 template<> struct format_traits_t<uint32_t> { using type = void;
-    static constexpr const char * fmt = "%lu";
     static constexpr const char * fmtp = "%lu";
 };
 // TODO: change all overloads to fundamental int type space
-template<> struct format_traits_t<unsigned int> { using type = void;
-    static constexpr const char * fmt = "%ud";
+// unsigned int is a distinct type from uint32_t on ARM but not on most hosts.
+struct no_distinct_unsigned_int_t;
+using distinct_unsigned_int_t = std::conditional_t<std::is_same<unsigned int, uint32_t>::value, no_distinct_unsigned_int_t, unsigned int>;
+template<> struct format_traits_t<distinct_unsigned_int_t> { using type = void;
     static constexpr const char * fmtp = "%ud";
 };
 template<> struct format_traits_t<int16_t> { using type = void;
-    static constexpr const char * fmt = "%hd";
     static constexpr const char * fmtp = "%hd";
 };
 template<> struct format_traits_t<uint16_t> { using type = void;
-    static constexpr const char * fmt = "%hu";
     static constexpr const char * fmtp = "%hu";
 };
 template<> struct format_traits_t<int8_t> { using type = void;
-    static constexpr const char * fmt = "%hhd";
     static constexpr const char * fmtp = "%d";
 };
 template<> struct format_traits_t<uint8_t> { using type = void;
-    static constexpr const char * fmt = "%hhu";
     static constexpr const char * fmtp = "%u";
 };
 
@@ -513,29 +740,29 @@ static bool to_string(const T& value, char * buffer, size_t length, ...) {
 
 template<typename T, typename = typename format_traits_t<T>::type>
 static bool from_string(const char * buffer, size_t length, T* property, int) {
-    // Note for T == uint8_t: Even though we supposedly use the correct format
-    // string sscanf treats our pointer as pointer-to-int instead of
-    // pointer-to-uint8_t. To avoid an unexpected memory access we first read
-    // into a union.
-    union { T t; int i; } val;
-    if (sscanf(buffer, format_traits_t<T>::fmt, &val.t) == 1) {
-        *property = val.t;
-        return true;
-    } else {
+    fibre::cbufptr_t str{reinterpret_cast<const unsigned char*>(buffer), strnlen(buffer, length)};
+    std::optional<T> val = parse_int<T>(&str);
+    if (!val.has_value())
         return false;
-    }
+    *property = *val;
+    return true;
 }
-// Special case for float because printf promotes float to double, and we get warnings
 template<typename T = float>
 static bool from_string(const char * buffer, size_t length, float* property, int) {
-    return sscanf(buffer, "%f", property) == 1;
+    fibre::cbufptr_t str{reinterpret_cast<const unsigned char*>(buffer), strnlen(buffer, length)};
+    std::optional<float> val = parse_float(&str);
+    if (!val.has_value())
+        return false;
+    *property = *val;
+    return true;
 }
 template<typename T = bool>
 static bool from_string(const char * buffer, size_t length, bool* property, int) {
-    int val;
-    if (sscanf(buffer, "%d", &val) != 1)
+    fibre::cbufptr_t str{reinterpret_cast<const unsigned char*>(buffer), strnlen(buffer, length)};
+    std::optional<int> val = parse_int<int>(&str);
+    if (!val.has_value())
         return false;
-    *property = val;
+    *property = *val;
     return true;
 }
 template<typename T>
@@ -0,0 +1,239 @@
+#ifndef __FIBRE_TEXT_PARSER_HPP
+#define __FIBRE_TEXT_PARSER_HPP
+
+#include <stdint.h>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+#include "bufptr.hpp"
+
+/**
+ * @brief Number and token parsers for human readable text.
+ *
+ * These work directly on a (not null-terminated) buffer and accept the same
+ * input as the corresponding sscanf conversions (%u, %d, %i, %f, %s) but
+ * don't pull in the scanf machinery of the C library and are much faster.
+ *
+ * Like sscanf conversions, all parsers skip leading whitespace. On success
+ * the buffer is advanced past the parsed text. On failure std::nullopt is
+ * returned and the buffer is left where the value was expected.
+ */
+
+inline bool is_text_whitespace(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline void skip_whitespace(fibre::cbufptr_t* buffer) {
+    while (!buffer->empty() && is_text_whitespace(buffer->front()))
+        (*buffer) += 1;
+}
+
+// Returns the value of a digit in bases up to 36 or 36 if c is not a digit
+inline unsigned int text_digit_value(unsigned char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20; // lower case
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 10;
+    return 36;
+}
+
+/**
+ * @brief Parses an integer.
+ * @param base: 10 behaves like %d and %u, 0 behaves like %i (0x prefix for hex,
+ *        0 prefix for octal).
+ * Out-of-range values saturate like strtol/strtoul. Negative values are
+ * accepted for unsigned types and wrap around.
+ */
+template<typename T>
+inline std::optional<T> parse_int(fibre::cbufptr_t* buffer, unsigned int base = 10) {
+    static_assert(std::is_integral<T>::value, "T must be an integer type");
+    skip_whitespace(buffer);
+    const unsigned char* it = buffer->begin();
+    const unsigned char* end = buffer->end();
+
+    bool negative = false;
+    if (it < end && (*it == '+' || *it == '-'))
+        negative = (*(it++) == '-');
+
+    if ((base == 0 || base == 16) && (end - it) >= 3 && it[0] == '0' && (it[1] | 0x20) == 'x' && text_digit_value(it[2]) < 16) {
+        it += 2;
+        base = 16;
+    } else if (base == 0) {
+        base = (it < end && *it == '0') ? 8 : 10;
+    }
+
+    // Saturate at the width of long (for types of up to 32 bits) or long long
+    using unsigned_wide_t = std::conditional_t<(sizeof(T) > 4), uint64_t, uint32_t>;
+    using signed_wide_t = std::make_signed_t<unsigned_wide_t>;
+    constexpr uint64_t max_magnitude = std::numeric_limits<unsigned_wide_t>::max();
+
+    const unsigned char* digits_begin = it;
+    uint64_t magnitude = 0;
+    unsigned int digit;
+    while (it < end && (digit = text_digit_value(*it)) < base) {
+        if (magnitude > (max_magnitude - digit) / base)
+            magnitude = max_magnitude;
+        else
+            magnitude = magnitude * base + digit;
+        it++;
+    }
+    if (it == digits_begin)
+        return std::nullopt;
+    buffer->begin() = it;
+
+    if (std::is_unsigned<T>::value) {
+        unsigned_wide_t value = (unsigned_wide_t)magnitude;
+        return (T)(negative && magnitude != max_magnitude ? (unsigned_wide_t)(0 - value) : value);
+    } else {
+        constexpr uint64_t max_positive = (uint64_t)std::numeric_limits<signed_wide_t>::max();
+        signed_wide_t value;
+        if (negative)
+            value = magnitude > max_positive ? std::numeric_limits<signed_wide_t>::min() : -(signed_wide_t)magnitude;
+        else
+            value = magnitude > max_positive ? std::numeric_limits<signed_wide_t>::max() : (signed_wide_t)magnitude;
+        return (T)value;
+    }
+}
+
+// Consumes word (case insensitive) if the buffer starts with it
+inline bool parse_word(fibre::cbufptr_t* buffer, const char* word) {
+    const unsigned char* it = buffer->begin();
+    for (; *word; ++word, ++it) {
+        if (it >= buffer->end() || (*it | 0x20) != *word)
+            return false;
+    }
+    buffer->begin() = it;
+    return true;
+}
+
+/**
+ * @brief Parses a decimal floating point number, including "inf" and "nan".
+ *
+ * Numbers with up to 7 significant digits and a decimal exponent of at most
+ * 10 (which covers all typical setpoints) are converted with a single float
+ * multiplication or division, which is exact and correctly rounded. Other
+ * numbers go through double precision and may in rare cases differ from
+ * strtof in the last bit.
+ */
+inline std::optional<float> parse_float(fibre::cbufptr_t* buffer) {
+    static constexpr float pow10f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    static constexpr double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    skip_whitespace(buffer);
+    fibre::cbufptr_t text = *buffer;
+
+    bool negative = false;
+    if (!text.empty() && (text.front() == '+' || text.front() == '-'))
+        negative = ((text++).front() == '-');
+
+    if (parse_word(&text, "inf")) {
+        parse_word(&text, "inity");
+        *buffer = text;
+        return negative ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::infinity();
+    } else if (parse_word(&text, "nan")) {
+        *buffer = text;
+        return negative ? -std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::quiet_NaN();
+    }
+
+    // Digits beyond what fits into the mantissa only affect the exponent
+    constexpr uint64_t max_mantissa = 100000000000000000ULL;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    while (!text.empty() && text.front() >= '0' && text.front() <= '9') {
+        if (mantissa < max_mantissa)
+            mantissa = mantissa * 10 + ((text++).front() - '0');
+        else
+            (text++, exponent++);
+        has_digits = true;
+    }
+    if (!text.empty() && text.front() == '.') {
+        text += 1;
+        while (!text.empty() && text.front() >= '0' && text.front() <= '9') {
+            if (mantissa < max_mantissa)
+                (mantissa = mantissa * 10 + (text.front() - '0'), exponent--);
+            text += 1;
+            has_digits = true;
+        }
+    }
+    if (!has_digits)
+        return std::nullopt;
+
+    // The exponent is only consumed if it contains digits
+    if (!text.empty() && (text.front() | 0x20) == 'e') {
+        fibre::cbufptr_t exponent_text = text.skip(1);
+        size_t sign_length = (!exponent_text.empty() && (exponent_text.front() == '+' || exponent_text.front() == '-')) ? 1 : 0;
+        if (exponent_text.size() > sign_length && text_digit_value(exponent_text[sign_length]) < 10) {
+            int32_t exp10 = *parse_int<int32_t>(&exponent_text);
+            exponent += exp10 < -1000 ? -1000 : exp10 > 1000 ? 1000 : (int)exp10;
+            text = exponent_text;
+        }
+    }
+    *buffer = text;
+
+    float result;
+    if (mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10) {
+        result = exponent < 0 ? (float)mantissa / pow10f[-exponent] : (float)mantissa * pow10f[exponent];
+    } else if (mantissa == 0) {
+        result = 0.0f;
+    } else {
+        double value = (double)mantissa;
+        for (; exponent > 22; exponent -= 22)
+            value *= 1e22;
+        for (; exponent < -22; exponent += 22)
+            value /= 1e22;
+        result = (float)(exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent]);
+    }
+    return negative ? -result : result;
+}
+
+/**
+ * @brief Copies the next whitespace delimited token into a null-terminated
+ * string, like %s. At most size - 1 characters are copied, the rest of a
+ * longer token remains in the buffer.
+ * @returns The length of the token or std::nullopt if there is no token.
+ */
+inline std::optional<size_t> parse_token(fibre::cbufptr_t* buffer, char* output, size_t size) {
+    skip_whitespace(buffer);
+    size_t length = 0;
+    while (!buffer->empty() && !is_text_whitespace(buffer->front()) && length + 1 < size)
+        output[length++] = (char)((*buffer)++).front();
+    if (size)
+        output[length] = 0;
+    if (!length)
+        return std::nullopt;
+    return length;
+}
+
+inline bool parse_arg(fibre::cbufptr_t* buffer, float* arg) {
+    std::optional<float> val = parse_float(buffer);
+    return val.has_value() && (*arg = *val, true);
+}
+
+// int arguments accept the same prefixes as %i
+inline bool parse_arg(fibre::cbufptr_t* buffer, int* arg) {
+    std::optional<int> val = parse_int<int>(buffer, 0);
+    return val.has_value() && (*arg = *val, true);
+}
+
+inline bool parse_arg(fibre::cbufptr_t* buffer, unsigned* arg) {
+    std::optional<unsigned> val = parse_int<unsigned>(buffer);
+    return val.has_value() && (*arg = *val, true);
+}
+
+/**
+ * @brief Parses whitespace separated arguments in the given order.
+ * Like sscanf, this stops at the first argument that can't be parsed.
+ * @returns The number of arguments that were parsed.
+ */
+template<typename ... TArgs>
+inline int parse_args(fibre::cbufptr_t buffer, TArgs* ... args) {
+    int n_parsed = 0;
+    (void)((parse_arg(&buffer, args) && ++n_parsed) && ...);
+    return n_parsed;
+}
+
+#endif // __FIBRE_TEXT_PARSER_HPP
@@ -0,0 +1,95 @@
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <fibre/posix_reactor.hpp>
+
+#define REACTOR_MAX_EVENTS	64
+
+PosixReactor::~PosixReactor() {
+    // Destroy the callbacks (and the objects they own) before closing the
+    // epoll instance they are registered with. They are moved out first
+    // because the objects may call remove() while being destroyed.
+    std::unordered_map<int, callback_t> callbacks = std::move(callbacks_);
+    callbacks_.clear();
+    callbacks.clear();
+    if (stop_fd_ != -1)
+        close(stop_fd_);
+    if (epoll_fd_ != -1)
+        close(epoll_fd_);
+}
+
+int PosixReactor::init() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1)
+        return -1;
+
+    stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd_ == -1)
+        return -1;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd_;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &ev);
+}
+
+int PosixReactor::add(int fd, uint32_t events, callback_t callback) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+    callbacks_[fd] = callback;
+    return 0;
+}
+
+int PosixReactor::modify(int fd, uint32_t events) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int PosixReactor::remove(int fd) {
+    callbacks_.erase(fd);
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int PosixReactor::run() {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    for (;;) {
+        int n_events = epoll_wait(epoll_fd_, events, REACTOR_MAX_EVENTS, -1);
+        if (n_events == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (int i = 0; i < n_events; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == stop_fd_) {
+                uint64_t val;
+                (void) !read(stop_fd_, &val, sizeof(val));
+                return 0;
+            }
+
+            // The fd may have been removed by a previous callback in this batch
+            auto it = callbacks_.find(fd);
+            if (it == callbacks_.end())
+                continue;
+
+            // Copy because the callback may remove itself
+            callback_t callback = it->second;
+            callback(events[i].events);
+        }
+    }
+}
+
+void PosixReactor::stop() {
+    uint64_t val = 1;
+    (void) !write(stop_fd_, &val, sizeof(val));
+}
@@ -1,108 +1,200 @@
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
-#include <thread>
-#include <future>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <fibre/protocol.hpp>
+#include <fibre/posix_reactor.hpp>
+#include <fibre/posix_tcp.hpp>
 
 
 #define TCP_RX_BUF_LEN	512
+#define TCP_MAX_PACKET_SIZE	4096
+// A connection stops reading requests while more than this number of bytes
+// is waiting to be sent to the client.
+#define TCP_TX_QUEUE_LIMIT	(16 * TCP_MAX_PACKET_SIZE)
 
-class TCPStreamSink : public StreamSink {
+
+class TCPConnection : public StreamSink {
 public:
-    TCPStreamSink(int socket_fd) :
-        socket_fd_(socket_fd)
+    TCPConnection(PosixReactor& reactor, int socket_fd) :
+        reactor_(reactor),
+        socket_fd_(socket_fd),
+        rx_packet_buf_(TCP_MAX_PACKET_SIZE + 2),
+        tx_packet_buf_(TCP_MAX_PACKET_SIZE),
+        tx_frame_buf_(TCP_MAX_PACKET_SIZE + MAX_FRAME_OVERHEAD),
+        packet2stream_(*this, tx_frame_buf_.data(), tx_frame_buf_.size()),
+        channel_(packet2stream_, tx_packet_buf_.data(), tx_packet_buf_.size(), TCP_MAX_PACKET_SIZE),
+        stream2packet_(channel_, rx_packet_buf_.data(), rx_packet_buf_.size())
     {}
 
-    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) {
-        int bytes_sent = send(socket_fd_, buffer, length, 0);
-        if (processed_bytes)
-            *processed_bytes = (bytes_sent == -1) ? 0 : bytes_sent;
-        return (bytes_sent == -1) ? -1 : 0;
+    ~TCPConnection() {
+        reactor_.remove(socket_fd_);
+        close(socket_fd_);
     }
 
-    size_t get_free_space() { return SIZE_MAX; }
+    // Queues the bytes and sends as much as possible without blocking.
+    // TCP_TX_QUEUE_LIMIT is only enforced by not reading further requests so
+    // that a response is never cut off in the middle.
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        tx_queue_.insert(tx_queue_.end(), buffer, buffer + length);
+        if (processed_bytes)
+            *processed_bytes += length;
+        return flush() ? 0 : -1;
+    }
 
-private:
-    int socket_fd_;
-};
+    size_t get_free_space() override {
+        size_t queued = tx_queue_.size() - tx_queue_pos_;
+        return queued < TCP_TX_QUEUE_LIMIT ? TCP_TX_QUEUE_LIMIT - queued : 0;
+    }
 
+    // @brief Handles the events reported by the reactor.
+    // Returns false if the connection should be closed.
+    bool on_event(uint32_t events) {
+        if (events & (EPOLLERR | EPOLLHUP))
+            return false;
+        if ((events & EPOLLOUT) && !flush())
+            return false;
+        if (events & EPOLLIN) {
+            // Only read as long as there is room for the responses
+            while (get_free_space() >= TCP_MAX_PACKET_SIZE) {
+                uint8_t buf[TCP_RX_BUF_LEN];
+                ssize_t n_received = recv(socket_fd_, buf, sizeof(buf), 0);
+                // -1 indicates error and 0 means that the client gracefully terminated
+                if (n_received == -1)
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                if (n_received == 0)
+                    return false;
+                stream2packet_.process_bytes(buf, n_received, nullptr);
+            }
+        }
+        update_events();
+        return true;
+    }
 
-int serve_client(int sock_fd) {
-    uint8_t buf[TCP_RX_BUF_LEN];
+private:
+    bool flush() {
+        while (tx_queue_pos_ < tx_queue_.size()) {
+            ssize_t n_sent = send(socket_fd_, tx_queue_.data() + tx_queue_pos_, tx_queue_.size() - tx_queue_pos_, MSG_NOSIGNAL);
+            if (n_sent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    break;
+                return false;
+            }
+            tx_queue_pos_ += n_sent;
+        }
+        if (tx_queue_pos_ == tx_queue_.size()) {
+            tx_queue_.clear();
+            tx_queue_pos_ = 0;
+        }
+        update_events();
+        return true;
+    }
 
-    // initialize output stack for this client
-    TCPStreamSink tcp_packet_output(sock_fd);
-    StreamBasedPacketSink packet2stream(tcp_packet_output);
-    BidirectionalPacketBasedChannel channel(packet2stream);
+    // Waits for the socket to become writable while there is data queued and
+    // stops reading while the queue is full.
+    void update_events() {
+        uint32_t events = 0;
+        if (get_free_space() >= TCP_MAX_PACKET_SIZE)
+            events |= EPOLLIN;
+        if (tx_queue_pos_ < tx_queue_.size())
+            events |= EPOLLOUT;
+        if (events != events_) {
+            reactor_.modify(socket_fd_, events);
+            events_ = events;
+        }
+    }
 
-    StreamToPacketSegmenter stream2packet(channel);
+    PosixReactor& reactor_;
+    int socket_fd_;
+    uint32_t events_ = EPOLLIN;
+    std::vector<uint8_t> tx_queue_;
+    size_t tx_queue_pos_ = 0;
+    std::vector<uint8_t> rx_packet_buf_;
+    std::vector<uint8_t> tx_packet_buf_;
+    std::vector<uint8_t> tx_frame_buf_;
+    StreamBasedPacketSink packet2stream_;
+    BidirectionalPacketBasedChannel channel_;
+    StreamToPacketSegmenter stream2packet_;
+};
 
-    // now listen for it
-    for (;;) {
-        memset(buf, 0, sizeof(buf));
-        // returns as soon as there is some data
-        ssize_t n_received = recv(sock_fd, buf, sizeof(buf), 0);
+struct TCPServer {
+    ~TCPServer() {
+        connections.clear();
+        close(listen_fd);
+    }
 
-        // -1 indicates error and 0 means that the client gracefully terminated
-        if (n_received == -1 || n_received == 0) {
-            close(sock_fd);
-            return n_received;
+    void on_accept() {
+        for (;;) {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd == -1)
+                return; // no more pending connections (or an error)
+
+            // Requests and responses are small, don't wait to fill a segment
+            int one = 1;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            TCPConnection* connection = new TCPConnection(*reactor, client_fd);
+            connections[client_fd].reset(connection);
+            reactor->add(client_fd, EPOLLIN, [this, client_fd, connection](uint32_t events) {
+                if (!connection->on_event(events))
+                    connections.erase(client_fd);
+            });
         }
-
-        // input processing stack
-        size_t processed = 0;
-        stream2packet.process_bytes(buf, n_received, &processed);
     }
-}
 
-// function to check if a worker thread handling a single client is done
-template<typename T>
-bool future_is_ready(std::future<T>& t){
-    return t.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
-}
+    PosixReactor* reactor;
+    int listen_fd;
+    std::unordered_map<int, std::unique_ptr<TCPConnection>> connections;
+};
 
-int serve_on_tcp(unsigned int port) {
-    struct sockaddr_in6 si_me, si_other;
+int serve_on_tcp(PosixReactor& reactor, unsigned int port) {
+    struct sockaddr_in6 si_me;
     int s;
 
-
-    if ((s=socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+    if ((s=socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
         return -1;
     }
 
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
     memset((char *) &si_me, 0, sizeof(si_me));
     si_me.sin6_family = AF_INET6;
     si_me.sin6_port = htons(port);
     si_me.sin6_flowinfo = 0;
     si_me.sin6_addr = in6addr_any;
     if (bind(s, reinterpret_cast<struct sockaddr *>(&si_me), sizeof(si_me)) == -1) {
+        close(s);
         return -1;
     }
 
-    listen(s, 128); // make this socket a passive socket
-    std::vector<std::future<int>> serv_pool;
-    for (;;) {
-        memset(&si_other, 0, sizeof(si_other));
-
-        socklen_t silen = sizeof(si_other);
-        // TODO: Add a limit on accepting connections
-        int client_portal_fd = accept(s, reinterpret_cast<sockaddr *>(&si_other), &silen); // blocking call
-        serv_pool.push_back(std::async(std::launch::async, serve_client, client_portal_fd));
-        // do a little clean up on the pool
-        for (std::vector<std::future<int>>::iterator it = serv_pool.end()-1; it >= serv_pool.begin(); --it) {
-            if (future_is_ready(*it)) {
-                // we can erase this thread
-                serv_pool.erase(it);
-            }
-        }
+    if (listen(s, 128) == -1) { // make this socket a passive socket
+        close(s);
+        return -1;
     }
 
-    close(s);
+    // The server lives as long as the listening socket is registered with
+    // the reactor
+    auto server = std::make_shared<TCPServer>();
+    server->reactor = &reactor;
+    server->listen_fd = s;
+    return reactor.add(s, EPOLLIN, [server](uint32_t events) {
+        server->on_accept();
+    });
 }
 
+int serve_on_tcp(unsigned int port) {
+    PosixReactor reactor;
+    if (reactor.init() || serve_on_tcp(reactor, port))
+        return -1;
+    return reactor.run();
+}
@@ -1,19 +1,29 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 #include <fibre/protocol.hpp>
+#include <fibre/posix_reactor.hpp>
+#include <fibre/posix_udp.hpp>
 
 #define UDP_RX_BUF_LEN	512
 #define UDP_TX_BUF_LEN	512
+// The state of the least recently active peer is dropped when this number of
+// peers is exceeded.
+#define UDP_MAX_PEERS	256
+#define UDP_SOCKET_RCVBUF	(1024 * 1024)
 
 
 class UDPPacketSender : public PacketSink {
 public:
-    UDPPacketSender(int socket_fd, struct sockaddr_in6 *si_other) :
+    UDPPacketSender(int socket_fd, const struct sockaddr_in6& si_other) :
         _socket_fd(socket_fd),
         _si_other(si_other)
     {}
@@ -25,46 +35,104 @@ public:
         if (length > get_mtu())
             return -1;
 
-        int status = sendto(_socket_fd, buffer, length, 0, reinterpret_cast<struct sockaddr*>(_si_other), sizeof(*_si_other));
+        // Never block. If the socket buffer is full the response is dropped
+        // like on any other lossy link and the client resends the request.
+        int status = sendto(_socket_fd, buffer, length, MSG_DONTWAIT, reinterpret_cast<const struct sockaddr*>(&_si_other), sizeof(_si_other));
         return (status == -1) ? -1 : 0;
     }
 
 private:
     int _socket_fd;
-    struct sockaddr_in6 *_si_other;
+    struct sockaddr_in6 _si_other;
 };
 
+// The channel state (negotiated packet size, request history, ...) is kept
+// for each peer.
+struct UDPPeer {
+    UDPPeer(int socket_fd, const struct sockaddr_in6& si_other) :
+        output(socket_fd, si_other),
+        channel(output, tx_buf, sizeof(tx_buf), UDP_RX_BUF_LEN)
+    {}
 
+    uint8_t tx_buf[UDP_TX_BUF_LEN];
+    UDPPacketSender output;
+    BidirectionalPacketBasedChannel channel;
+    uint64_t last_active = 0;
+};
 
-int serve_on_udp(unsigned int port) {
-    struct sockaddr_in6 si_me, si_other;
+struct UDPServer {
+    ~UDPServer() {
+        close(socket_fd);
+    }
+
+    void on_receive() {
+        for (;;) {
+            struct sockaddr_in6 si_other;
+            socklen_t slen = sizeof(si_other);
+            uint8_t buf[UDP_RX_BUF_LEN];
+            ssize_t n_received = recvfrom(socket_fd, buf, sizeof(buf), MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&si_other), &slen);
+            if (n_received == -1)
+                return; // no more pending packets (or an error)
+
+            get_peer(si_other).channel.process_packet(buf, n_received);
+        }
+    }
+
+    UDPPeer& get_peer(const struct sockaddr_in6& si_other) {
+        std::string key(reinterpret_cast<const char*>(&si_other), sizeof(si_other));
+        auto it = peers.find(key);
+        if (it == peers.end()) {
+            if (peers.size() >= UDP_MAX_PEERS) {
+                auto oldest = peers.begin();
+                for (auto peer = peers.begin(); peer != peers.end(); ++peer) {
+                    if (peer->second->last_active < oldest->second->last_active)
+                        oldest = peer;
+                }
+                peers.erase(oldest);
+            }
+            it = peers.emplace(key, std::make_unique<UDPPeer>(socket_fd, si_other)).first;
+        }
+        it->second->last_active = ++n_packets;
+        return *it->second;
+    }
+
+    int socket_fd;
+    uint64_t n_packets = 0;
+    std::unordered_map<std::string, std::unique_ptr<UDPPeer>> peers;
+};
+
+int serve_on_udp(PosixReactor& reactor, unsigned int port) {
+    struct sockaddr_in6 si_me;
     int s;
-    socklen_t slen = sizeof(si_other);
-    uint8_t buf[UDP_RX_BUF_LEN];
 
-    if ((s=socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+    if ((s=socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP)) == -1)
         return -1;
 
+    // Requests from many peers can arrive while the reactor is busy
+    int rcvbuf = UDP_SOCKET_RCVBUF;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
     memset((char *) &si_me, 0, sizeof(si_me));
     si_me.sin6_family = AF_INET6;
     si_me.sin6_port = htons(port);
     si_me.sin6_flowinfo = 0;
     si_me.sin6_addr= in6addr_any;
-    if (bind(s, reinterpret_cast<struct sockaddr *>(&si_me), sizeof(si_me)) == -1) 
+    if (bind(s, reinterpret_cast<struct sockaddr *>(&si_me), sizeof(si_me)) == -1) {
+        close(s);
         return -1;
-
-    for (;;) {
-        ssize_t n_received = recvfrom(s, buf, sizeof(buf), 0, reinterpret_cast<struct sockaddr *>(&si_other), &slen);
-        if (n_received == -1)
-            return -1;
-        //printf("Received packet from %s:%d\nData: %s\n\n",
-        //    inet_ntoa(si_other.sin_addr), ntohs(si_other.sin_port), buf);
-
-        UDPPacketSender udp_packet_output(s, &si_other);
-        BidirectionalPacketBasedChannel udp_channel(udp_packet_output);
-        udp_channel.process_packet(buf, n_received);
     }
 
-    close(s);
+    // The server lives as long as the socket is registered with the reactor
+    auto server = std::make_shared<UDPServer>();
+    server->socket_fd = s;
+    return reactor.add(s, EPOLLIN, [server](uint32_t events) {
+        server->on_receive();
+    });
 }
 
+int serve_on_udp(unsigned int port) {
+    PosixReactor reactor;
+    if (reactor.init() || serve_on_udp(reactor, port))
+        return -1;
+    return reactor.run();
+}
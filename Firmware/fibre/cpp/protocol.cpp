@@ -1,8 +1,10 @@
 
 /* Includes ------------------------------------------------------------------*/
 
+#include <algorithm>
 #include <memory>
 #include <stdlib.h>
+#include <string.h>
 
 #include <fibre/protocol.hpp>
 #include <fibre/crc.hpp>
@@ -39,56 +41,137 @@ void hexdump(const uint8_t* buf, size_t len) {
 
 
 
+// @brief Handles a frame that starts at buffer[0] and is entirely contained
+// in the buffer without copying it.
+// Returns the number of bytes consumed or 0 if the frame is incomplete or
+// invalid. In that case the byte-wise state machine takes over.
+size_t StreamToPacketSegmenter::process_contiguous_frame(const uint8_t* buffer, size_t length, int* result) {
+    size_t header_length = 0;
+    size_t payload_length = 0;
+    for (size_t i = 1; i <= MAX_FRAME_LENGTH_BYTES && i < length; ++i) {
+        payload_length |= (size_t)(buffer[i] & 0x7f) << (7 * (i - 1));
+        if (!(buffer[i] & 0x80)) {
+            header_length = i + 2; // followed by CRC8
+            break;
+        }
+    }
+    if (!header_length || header_length > length)
+        return 0;
+    if (calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, buffer, header_length))
+        return 0;
+
+    size_t packet_length = payload_length + 2;
+    if (packet_length > packet_buffer_size_ || header_length + packet_length > length)
+        return 0;
+
+    const uint8_t* packet = buffer + header_length;
+    if (calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet, packet_length) == 0) {
+        *result |= output_.process_packet(packet, payload_length);
+    }
+    return header_length + packet_length;
+}
+
 int StreamToPacketSegmenter::process_bytes(const uint8_t *buffer, size_t length, size_t* processed_bytes) {
     int result = 0;
 
-    while (length--) {
-        if (header_index_ < sizeof(header_buffer_)) {
+    while (length) {
+        size_t chunk = 1;
+
+        if (!header_index_) {
+            // Skip everything up to the next frame and try to handle the frame in place
+            const uint8_t* prefix = static_cast<const uint8_t*>(memchr(buffer, CANONICAL_PREFIX, length));
+            chunk = prefix ? prefix - buffer : length;
+            if (!chunk)
+                chunk = process_contiguous_frame(buffer, length, &result);
+            if (chunk) {
+                buffer += chunk;
+                length -= chunk;
+                if (processed_bytes)
+                    (*processed_bytes) += chunk;
+                continue;
+            }
+            chunk = 1;
+        }
+
+        if (!header_length_ || header_index_ < header_length_) {
             // Process header byte
             header_buffer_[header_index_++] = *buffer;
-            if (header_index_ == 1 && header_buffer_[0] != CANONICAL_PREFIX) {
-                header_index_ = 0;
-            } else if (header_index_ == 2 && (header_buffer_[1] & 0x80)) {
-                header_index_ = 0; // TODO: support packets larger than 128 bytes
-            } else if (header_index_ == 3 && calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buffer_, 3)) {
-                header_index_ = 0;
-            } else if (header_index_ == 3) {
-                packet_length_ = header_buffer_[1] + 2;
+            if (header_index_ == 1) {
+                if (header_buffer_[0] != CANONICAL_PREFIX)
+                    reset();
+            } else if (!header_length_) {
+                // Length field (varint)
+                if (!(*buffer & 0x80)) {
+                    header_length_ = header_index_ + 1; // followed by CRC8
+                } else if (header_index_ - 1 >= MAX_FRAME_LENGTH_BYTES) {
+                    reset();
+                }
+            } else if (calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buffer_, header_length_)) {
+                reset();
+            } else {
+                size_t payload_length = 0;
+                for (size_t i = header_length_ - 2; i >= 1; --i)
+                    payload_length = (payload_length << 7) | (header_buffer_[i] & 0x7f);
+                packet_length_ = payload_length + 2;
+                if (packet_length_ > packet_buffer_size_)
+                    reset(); // TODO: report oversized packets
             }
-        } else if (packet_index_ < sizeof(packet_buffer_)) {
-            // Process payload byte
-            packet_buffer_[packet_index_++] = *buffer;
+        } else if (packet_index_ < packet_length_) {
+            // Process as many payload bytes as are available
+            chunk = std::min(length, packet_length_ - packet_index_);
+            memcpy(packet_buffer_ + packet_index_, buffer, chunk);
+            packet_index_ += chunk;
         }
 
         // If both header and packet are fully received, hand it on to the packet processor
-        if (header_index_ == 3 && packet_index_ == packet_length_) {
+        if (header_length_ && header_index_ == header_length_ && packet_index_ == packet_length_) {
             if (calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet_buffer_, packet_length_) == 0) {
                 result |= output_.process_packet(packet_buffer_, packet_length_ - 2);
             }
-            header_index_ = packet_index_ = packet_length_ = 0;
+            reset();
         }
-        buffer++;
+        buffer += chunk;
+        length -= chunk;
         if (processed_bytes)
-            (*processed_bytes)++;
+            (*processed_bytes) += chunk;
     }
 
     return result;
 }
 
 int StreamBasedPacketSink::process_packet(const uint8_t *buffer, size_t length) {
-    // TODO: support buffer size >= 128
-    if (length >= 128)
+    if (length >= ((size_t)1 << (7 * MAX_FRAME_LENGTH_BYTES)))
         return -1;
 
     LOG_FIBRE("send header\r\n");
-    uint8_t header[] = {
-        CANONICAL_PREFIX,
-        static_cast<uint8_t>(length),
-        0
+    uint8_t header[2 + MAX_FRAME_LENGTH_BYTES];
+    size_t header_length = 0;
+    header[header_length++] = CANONICAL_PREFIX;
+    size_t remaining = length;
+    do {
+        header[header_length++] = (remaining & 0x7f) | (remaining >= 0x80 ? 0x80 : 0x00);
+        remaining >>= 7;
+    } while (remaining);
+    header[header_length] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, header_length);
+    header_length++;
+
+    uint16_t crc16 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, buffer, length);
+    uint8_t crc16_buffer[] = {
+        (uint8_t)((crc16 >> 8) & 0xff),
+        (uint8_t)((crc16 >> 0) & 0xff)
     };
-    header[2] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header, 2);
 
-    if (output_.process_bytes(header, sizeof(header), nullptr))
+    // Gather the frame so that the output sees a single write
+    if (frame_buffer_ && header_length + length + 2 <= frame_buffer_size_) {
+        memcpy(frame_buffer_, header, header_length);
+        if (length) // buffer may be null for empty packets
+            memcpy(frame_buffer_ + header_length, buffer, length);
+        memcpy(frame_buffer_ + header_length + length, crc16_buffer, 2);
+        LOG_FIBRE("send frame\r\n");
+        return output_.process_bytes(frame_buffer_, header_length + length + 2, nullptr) ? -1 : 0;
+    }
+
+    if (output_.process_bytes(header, header_length, nullptr))
         return -1;
     LOG_FIBRE("send payload:\r\n");
     hexdump(buffer, length);
@@ -96,11 +179,6 @@ int StreamBasedPacketSink::process_packet(const uint8_t *buffer, size_t length)
         return -1;
 
     LOG_FIBRE("send crc16\r\n");
-    uint16_t crc16 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, buffer, length);
-    uint8_t crc16_buffer[] = {
-        (uint8_t)((crc16 >> 8) & 0xff),
-        (uint8_t)((crc16 >> 0) & 0xff)
-    };
     if (output_.process_bytes(crc16_buffer, 2, nullptr))
         return -1;
     LOG_FIBRE("sent!\r\n");
@@ -119,6 +197,16 @@ bool fibre::endpoint0_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* o
     } else if (offset.value() == 0xffffffff) {
         // If the offset is special value 0xFFFFFFFF, send back the JSON version ID instead
         return write_le<uint32_t>(json_version_id_, output_buffer);
+    } else if (offset.value() == ENDPOINT0_COMPRESSED_JSON) {
+        // Return part of the compressed json file
+        std::optional<uint32_t> position = read_le<uint32_t>(input_buffer);
+        if (!position.has_value() || *position >= embedded_json_compressed_length) {
+            return true;
+        }
+        size_t n_copy = std::min(output_buffer->size(), embedded_json_compressed_length - (size_t)*position);
+        memcpy(output_buffer->begin(), embedded_json_compressed + *position, n_copy);
+        *output_buffer = output_buffer->skip(n_copy);
+        return true;
     } else if (offset.value() >= embedded_json_length) {
         // Attempt to read beyond the buffer end - return empty response
         return true;
@@ -131,6 +219,335 @@ bool fibre::endpoint0_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* o
     }
 }
 
+// Handles a ENDPOINT0_NEGOTIATE_PACKET_SIZE request. Returns false if the
+// request is something else.
+bool BidirectionalPacketBasedChannel::negotiate_packet_size(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    fibre::cbufptr_t request = *input_buffer;
+    std::optional<uint32_t> offset = read_le<uint32_t>(&request);
+    std::optional<uint32_t> host_max_rx_packet_length = read_le<uint32_t>(&request);
+    if (offset != ENDPOINT0_NEGOTIATE_PACKET_SIZE || !host_max_rx_packet_length.has_value()) {
+        return false;
+    }
+
+    // Every client accepts packets of the size that is used before
+    // negotiation, so smaller values are raised to that. This also keeps
+    // room for the sequence number of a response.
+    size_t min_tx_packet_length = std::min(tx_buf_size_, (size_t)TX_BUF_SIZE);
+    max_tx_packet_length_ = std::clamp((size_t)*host_max_rx_packet_length, min_tx_packet_length, tx_buf_size_);
+    write_le<uint32_t>(max_rx_packet_length_, output_buffer);
+    write_le<uint32_t>(max_tx_packet_length_, output_buffer);
+    return true;
+}
+
+// Handles a ENDPOINT0_NEGOTIATE_WINDOW request. Returns false if the request
+// is something else.
+bool BidirectionalPacketBasedChannel::negotiate_window(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    fibre::cbufptr_t request = *input_buffer;
+    std::optional<uint32_t> offset = read_le<uint32_t>(&request);
+    std::optional<uint8_t> host_window_size = read_le<uint8_t>(&request);
+    if (offset != ENDPOINT0_NEGOTIATE_WINDOW || !host_window_size.has_value()) {
+        return false;
+    }
+
+    window_size_ = std::min((size_t)*host_window_size, MAX_WINDOW_SIZE);
+    next_response_slot_ = 0;
+    for (auto& response : responses_) {
+        response.valid = false;
+    }
+    write_le<uint8_t>((uint8_t)window_size_, output_buffer);
+    return true;
+}
+
+void BidirectionalPacketBasedChannel::remember_response(uint16_t seq_no, uint16_t request_crc, const uint8_t* payload, size_t length) {
+    RememberedResponse& response = responses_[next_response_slot_];
+    next_response_slot_ = (next_response_slot_ + 1) % window_size_;
+    response.valid = true;
+    response.replayable = length <= sizeof(response.payload);
+    response.seq_no = seq_no;
+    response.request_crc = request_crc;
+    response.length = response.replayable ? length : 0;
+    memcpy(response.payload, payload, response.length);
+}
+
+// Returns the remembered response to an earlier request with the same seq_no
+// and content. All requests to endpoint 0 share the endpoint ID, so the
+// endpoint alone is not enough to tell a retransmission from a new request.
+const BidirectionalPacketBasedChannel::RememberedResponse* BidirectionalPacketBasedChannel::find_response(uint16_t seq_no, uint16_t request_crc) {
+    for (size_t i = 0; i < window_size_; ++i) {
+        const RememberedResponse& response = responses_[i];
+        if (response.valid && response.seq_no == seq_no && response.request_crc == request_crc) {
+            return &response;
+        }
+    }
+    return nullptr;
+}
+
+// Handles a ENDPOINT0_BATCH request. Returns false if the request is
+// something else or refers to a different JSON descriptor.
+bool BidirectionalPacketBasedChannel::process_batch(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    fibre::cbufptr_t request = *input_buffer;
+    std::optional<uint32_t> offset = read_le<uint32_t>(&request);
+    std::optional<uint16_t> json_crc = read_le<uint16_t>(&request);
+    if (offset != ENDPOINT0_BATCH || json_crc != fibre::json_crc_) {
+        return false;
+    }
+
+    while (request.size() >= 4) {
+        uint16_t endpoint_id = *read_le<uint16_t>(&request);
+        uint8_t input_length = *read_le<uint8_t>(&request);
+        uint8_t output_length = *read_le<uint8_t>(&request);
+        if (input_length > request.size() || 1 + (size_t)output_length > output_buffer->size()) {
+            break;
+        }
+
+        fibre::cbufptr_t entry_input = request.take(input_length);
+        fibre::bufptr_t entry_output{output_buffer->begin() + 1, output_length};
+        request = request.skip(input_length);
+        if (endpoint_id != 0) {
+            fibre::endpoint_handler(endpoint_id, &entry_input, &entry_output);
+        }
+
+        size_t actual_output_length = output_length - entry_output.size();
+        *output_buffer->begin() = (uint8_t)actual_output_length;
+        *output_buffer = output_buffer->skip(1 + actual_output_length);
+    }
+    return true;
+}
+
+bool TelemetrySubscription::subscribe(fibre::cbufptr_t endpoint_ids, uint32_t decimation, fibre::bufptr_t* value_lengths) {
+    // Stop sampling while the endpoint list is modified
+    decimation_ = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    n_endpoints_ = 0;
+    sample_size_ = 0;
+    while (endpoint_ids.size() >= 2) {
+        uint16_t endpoint_id = *read_le<uint16_t>(&endpoint_ids);
+        if (n_endpoints_ >= MAX_ENDPOINTS || !fibre::is_property_endpoint(endpoint_id)) {
+            return false;
+        }
+
+        // Read the value once to find out its length
+        fibre::cbufptr_t input{sample_, (size_t)0};
+        fibre::bufptr_t output{sample_ + 4 + sample_size_, MAX_SAMPLE_SIZE - sample_size_};
+        fibre::endpoint_handler(endpoint_id, &input, &output);
+        size_t length = MAX_SAMPLE_SIZE - sample_size_ - output.size();
+        if (length == 0) {
+            return false;
+        }
+
+        endpoint_ids_[n_endpoints_] = endpoint_id;
+        value_lengths_[n_endpoints_] = (uint8_t)length;
+        n_endpoints_++;
+        sample_size_ += length;
+    }
+    if (!n_endpoints_ || value_lengths->size() < n_endpoints_) {
+        return false;
+    }
+
+    memcpy(value_lengths->begin(), value_lengths_, n_endpoints_);
+    *value_lengths = value_lengths->skip(n_endpoints_);
+    last_read_seq_ = seq_;
+    decimation_counter_ = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    decimation_ = decimation;
+    return true;
+}
+
+void TelemetrySubscription::sample(uint32_t timestamp) {
+    uint32_t decimation = decimation_;
+    if (!decimation || ++decimation_counter_ < decimation) {
+        return;
+    }
+    decimation_counter_ = 0;
+
+    seq_ = seq_ + 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    write_le<uint32_t>(timestamp, sample_);
+    uint8_t* ptr = sample_ + 4;
+    for (size_t i = 0; i < n_endpoints_; ++i) {
+        fibre::cbufptr_t input{ptr, (size_t)0};
+        fibre::bufptr_t output{ptr, value_lengths_[i]};
+        fibre::endpoint_handler(endpoint_ids_[i], &input, &output);
+        ptr += value_lengths_[i];
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    seq_ = seq_ + 1;
+}
+
+// Copies the latest sample into buffer. Returns the length of the sample or 0
+// if there is no new sample.
+size_t TelemetrySubscription::get_sample(uint8_t* buffer, size_t length) {
+    size_t sample_length = 4 + sample_size_;
+    if (sample_length > length) {
+        last_read_seq_ = seq_; // drop sample
+        return 0;
+    }
+
+    // Retry if sample() preempted us while copying
+    for (size_t attempt = 0; attempt < 3; ++attempt) {
+        uint32_t seq = seq_;
+        if (seq == last_read_seq_ || (seq & 1)) {
+            return 0;
+        }
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        memcpy(buffer, sample_, sample_length);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (seq_ == seq) {
+            last_read_seq_ = seq;
+            return sample_length;
+        }
+    }
+    return 0;
+}
+
+// Handles a ENDPOINT0_SUBSCRIBE request. Returns false if the request is
+// something else or the channel doesn't support telemetry.
+bool BidirectionalPacketBasedChannel::subscribe(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    fibre::cbufptr_t request = *input_buffer;
+    std::optional<uint32_t> offset = read_le<uint32_t>(&request);
+    std::optional<uint16_t> json_crc = read_le<uint16_t>(&request);
+    std::optional<uint32_t> decimation = read_le<uint32_t>(&request);
+    if (offset != ENDPOINT0_SUBSCRIBE || json_crc != fibre::json_crc_ || !decimation.has_value() || !telemetry_) {
+        return false;
+    }
+
+    if (*decimation) {
+        telemetry_->subscribe(request, *decimation, output_buffer);
+    } else {
+        telemetry_->subscribe({}, 0, output_buffer);
+    }
+    return true;
+}
+
+TransactionBuffer fibre::transaction_buffer;
+
+// Starts a new transaction. Writes that were staged but not committed are
+// discarded, as is the transaction of another channel that went stale.
+TransactionBuffer::Status TransactionBuffer::begin(const void* owner) {
+    const void* expected = nullptr;
+    if (!owner_.compare_exchange_strong(expected, owner) && expected != owner) {
+        if (idle_count_ < STALE_TIMEOUT || !owner_.compare_exchange_strong(expected, owner)) {
+            return kBusy;
+        }
+    }
+    idle_count_ = 0;
+    length_ = 0;
+    return kOk;
+}
+
+// Appends {uint16 endpoint_id, uint8 input_length, input} entries to the open
+// transaction. Only writable properties without side effects in their setter
+// can be written because the control loop interrupt applies the transaction.
+TransactionBuffer::Status TransactionBuffer::stage(const void* owner, fibre::cbufptr_t entries) {
+    if (owner_ != owner) {
+        return kRejected;
+    }
+    idle_count_ = 0;
+
+    uint8_t* buffer = buffers_[staging_];
+    while (entries.size()) {
+        fibre::cbufptr_t entry = entries;
+        std::optional<uint16_t> endpoint_id = read_le<uint16_t>(&entry);
+        std::optional<uint8_t> input_length = read_le<uint8_t>(&entry);
+        if (!input_length.has_value() || *input_length > entry.size()
+                || !fibre::is_transactional_endpoint(*endpoint_id)) {
+            discard();
+            return kRejected;
+        }
+        size_t entry_length = 3 + *input_length;
+        if (length_ + entry_length > MAX_SIZE) {
+            discard();
+            return kRejected;
+        }
+        memcpy(buffer + length_, entries.begin(), entry_length);
+        length_ += entry_length;
+        entries = entries.skip(entry_length);
+    }
+    return kOk;
+}
+
+// Hands the staged writes over to the control loop.
+TransactionBuffer::Status TransactionBuffer::commit(const void* owner) {
+    if (owner_ != owner) {
+        return kRejected;
+    }
+    if (pending_ >= 0) {
+        return kBusy; // the control loop didn't apply the previous transaction yet
+    }
+
+    lengths_[staging_] = length_;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    pending_ = (int)staging_;
+    staging_ ^= 1;
+    discard();
+    return kOk;
+}
+
+// Applies the committed writes, if any. Called by the control loop.
+void TransactionBuffer::apply() {
+    if (owner_.load() && idle_count_ < STALE_TIMEOUT) {
+        idle_count_ = idle_count_ + 1;
+    }
+
+    int pending = pending_;
+    if (pending < 0) {
+        return;
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    fibre::cbufptr_t entries{buffers_[pending], lengths_[pending]};
+    while (entries.size()) {
+        uint16_t endpoint_id = *read_le<uint16_t>(&entries);
+        uint8_t input_length = *read_le<uint8_t>(&entries);
+        fibre::cbufptr_t input = entries.take(input_length);
+        uint8_t discarded[8]; // some endpoints return the old value
+        fibre::bufptr_t output{discarded};
+        fibre::endpoint_handler(endpoint_id, &input, &output);
+        entries = entries.skip(input_length);
+    }
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    pending_ = -1;
+}
+
+// Handles a ENDPOINT0_TRANSACTION request. Returns false if the request is
+// something else or refers to a different JSON descriptor.
+bool BidirectionalPacketBasedChannel::process_transaction(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    fibre::cbufptr_t request = *input_buffer;
+    std::optional<uint32_t> offset = read_le<uint32_t>(&request);
+    std::optional<uint16_t> json_crc = read_le<uint16_t>(&request);
+    std::optional<uint8_t> flags = read_le<uint8_t>(&request);
+    if (offset != ENDPOINT0_TRANSACTION || json_crc != fibre::json_crc_ || !flags.has_value()) {
+        return false;
+    }
+
+    TransactionBuffer::Status status = TransactionBuffer::kOk;
+    if (*flags & TRANSACTION_BEGIN) {
+        status = fibre::transaction_buffer.begin(this);
+    }
+    if (status == TransactionBuffer::kOk) {
+        status = fibre::transaction_buffer.stage(this, request);
+    }
+    if (status == TransactionBuffer::kOk && (*flags & TRANSACTION_COMMIT)) {
+        status = fibre::transaction_buffer.commit(this);
+    }
+    write_le<uint8_t>(status, output_buffer);
+    return true;
+}
+
+int BidirectionalPacketBasedChannel::send_telemetry() {
+    if (!telemetry_ || !telemetry_->has_sample()) {
+        return 0;
+    }
+    size_t length = telemetry_->get_sample(tx_buf_ + 2, max_tx_packet_length_ - 2);
+    if (!length) {
+        return 0;
+    }
+    write_le<uint16_t>(TELEMETRY_SEQ_NO, tx_buf_);
+    return output_.process_packet(tx_buf_, length + 2);
+}
+
 int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_t length) {
     LOG_FIBRE("got packet of length %d: \r\n", length);
     hexdump(buffer, length);
@@ -138,6 +555,8 @@ int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_
         return -1;
 
     uint16_t seq_no = read_le<uint16_t>(&buffer, &length);
+    const uint8_t* request = buffer;
+    size_t request_length = length;
 
     if (seq_no & 0x8000) {
         // TODO: ack handling
@@ -164,17 +583,43 @@ int BidirectionalPacketBasedChannel::process_packet(const uint8_t* buffer, size_
 
         uint16_t expected_response_length = read_le<uint16_t>(&buffer, &length);
 
-        // Limit response length according to our local TX buffer size
-        if (expected_response_length > sizeof(tx_buf_) - 2)
-            expected_response_length = sizeof(tx_buf_) - 2;
+        // Limit response length according to our local TX buffer size and
+        // the negotiated packet size
+        if (expected_response_length > max_tx_packet_length_ - 2)
+            expected_response_length = max_tx_packet_length_ - 2;
 
         fibre::cbufptr_t input_buffer{buffer, length - 2};
         fibre::bufptr_t output_buffer{tx_buf_ + 2, expected_response_length};
-        fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+
+        // The window negotiation clears the history, so it's handled before
+        // the lookup and never answered from the history.
+        bool is_window_negotiation = endpoint_id == 0 && negotiate_window(&input_buffer, &output_buffer);
+
+        // Answer retransmitted requests without executing them again
+        bool remember = window_size_ && expect_response && !is_window_negotiation;
+        uint16_t request_crc = remember ? calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, request, request_length) : 0;
+        const RememberedResponse* previous_response = remember ? find_response(seq_no, request_crc) : nullptr;
+        if (previous_response && previous_response->replayable) {
+            LOG_FIBRE("replay response to seq %04x\r\n", seq_no);
+            write_le<uint16_t>(seq_no | 0x8000, tx_buf_);
+            memcpy(tx_buf_ + 2, previous_response->payload, previous_response->length);
+            output_.process_packet(tx_buf_, previous_response->length + 2);
+            return 0;
+        }
+
+        if (!is_window_negotiation && (endpoint_id != 0 || !(negotiate_packet_size(&input_buffer, &output_buffer)
+                                                             || process_batch(&input_buffer, &output_buffer)
+                                                             || subscribe(&input_buffer, &output_buffer)
+                                                             || process_transaction(&input_buffer, &output_buffer)))) {
+            fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+        }
 
         // Send response
         if (expect_response) {
             size_t actual_response_length = expected_response_length - output_buffer.size() + 2;
+            if (remember && !previous_response) {
+                remember_response(seq_no, request_crc, tx_buf_ + 2, actual_response_length - 2);
+            }
             write_le<uint16_t>(seq_no | 0x8000, tx_buf_);
 
             LOG_FIBRE("send packet:\r\n");
@@ -15,6 +15,7 @@ from fibre.utils import Event, Logger
 from fibre.protocol import ChannelBrokenException, TimeoutError
 import appdirs
 import os
+import zlib
 
 # Load all installed transport layers
 
@@ -71,6 +72,22 @@ def find_all(path, serial_number,
             cache_dir = appdirs.user_cache_dir("odrivetool")
             cache_path = None
 
+            # Use large packets if the device supports them
+            try:
+                channel.negotiate_packet_size()
+            except ChannelBrokenException:
+                raise
+            except:
+                logger.debug("Failed to negotiate packet size")
+
+            # Allow several requests in flight if the device supports it
+            try:
+                channel.negotiate_window()
+            except ChannelBrokenException:
+                raise
+            except:
+                logger.debug("Failed to negotiate request window")
+
             # Fetch the json version tag to check cache (only supported on firmware v0.5 or later)
             try:
                 json_version_tag = channel.remote_endpoint_operation(0, struct.pack("<I", 0xffffffff), True, 4)
@@ -96,7 +113,17 @@ def find_all(path, serial_number,
             if json_data is None:
                 # Downloading json data
                 logger.info("Downloading json data from ODrive... (this might take a while)")
-                json_bytes = channel.remote_endpoint_read_buffer(0)
+                json_bytes = None
+                try:
+                    compressed_json = channel.remote_endpoint_read_buffer(0, struct.pack("<I", fibre.protocol.ENDPOINT0_COMPRESSED_JSON))
+                    if len(compressed_json):
+                        json_bytes = zlib.decompress(compressed_json)
+                except ChannelBrokenException:
+                    raise
+                except:
+                    logger.debug("Failed to load compressed JSON")
+                if json_bytes is None:
+                    json_bytes = channel.remote_endpoint_read_buffer(0)
                 try:
                     json_string = json_bytes.decode("ascii")
                 except UnicodeDecodeError:
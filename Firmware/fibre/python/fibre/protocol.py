@@ -2,6 +2,7 @@
 
 import time
 import struct
+import random
 import sys
 import threading
 import traceback
@@ -26,7 +27,27 @@ PROTOCOL_VERSION = 1
 CRC8_DEFAULT = 0x37 # this must match the polynomial in the C++ implementation
 CRC16_DEFAULT = 0x3d65 # this must match the polynomial in the C++ implementation
 
-MAX_PACKET_SIZE = 128
+MAX_PACKET_SIZE = 128 # packet size limit of devices that don't support negotiation
+MAX_FRAME_LENGTH_BYTES = 3 # max size of the varint length in the frame header
+MAX_RX_PACKET_LENGTH = 4096 # largest packet that this host accepts
+MAX_WINDOW_SIZE = 16 # max number of requests in flight at the same time
+
+ENDPOINT0_NEGOTIATE_PACKET_SIZE = 0xfffffffe
+ENDPOINT0_BATCH = 0xfffffffd
+ENDPOINT0_SUBSCRIBE = 0xfffffffc
+ENDPOINT0_COMPRESSED_JSON = 0xfffffffb
+ENDPOINT0_NEGOTIATE_WINDOW = 0xfffffffa
+ENDPOINT0_TRANSACTION = 0xfffffff9
+TRANSACTION_BEGIN = 0x01
+TRANSACTION_COMMIT = 0x02
+TRANSACTION_OK = 0
+TRANSACTION_REJECTED = 1
+TRANSACTION_BUSY = 2
+TRANSACTION_ATTEMPTS = 10
+TELEMETRY_SEQ_NO = 0xff00
+
+MULTIDROP_BROADCAST_ADDRESS = 0x7f
+MULTIDROP_RESPONSE_FLAG = 0x80
 
 # For more information on the CRC algorithm refer to protocol.md
 
@@ -43,14 +64,18 @@ def calc_crc(remainder, value, polynomial, bitwidth):
 
     return remainder & ((1 << bitwidth) - 1)
 
+# Lookup tables for byte-wise CRC calculation
+CRC8_TABLE = [calc_crc(0, i, CRC8_DEFAULT, 8) for i in range(256)]
+CRC16_TABLE = [calc_crc(0, i, CRC16_DEFAULT, 16) for i in range(256)]
+
 def calc_crc8(remainder, value):
     if isinstance(value, bytearray) or isinstance(value, bytes) or isinstance(value, list):
         for byte in value:
             if not isinstance(byte,int):
                 byte = ord(byte)
-            remainder = calc_crc(remainder, byte, CRC8_DEFAULT, 8)
+            remainder = CRC8_TABLE[remainder ^ byte]
     else:
-        remainder = calc_crc(remainder, byte, CRC8_DEFAULT, 8)
+        remainder = CRC8_TABLE[remainder ^ value]
     return remainder
 
 def calc_crc16(remainder, value):
@@ -58,9 +83,9 @@ def calc_crc16(remainder, value):
         for byte in value:
             if not isinstance(byte, int):
                 byte = ord(byte)
-            remainder = calc_crc(remainder, byte, CRC16_DEFAULT, 16)
+            remainder = ((remainder << 8) & 0xffff) ^ CRC16_TABLE[(remainder >> 8) ^ byte]
     else:
-        remainder = calc_crc(remainder, value, CRC16_DEFAULT, 16)
+        remainder = ((remainder << 8) & 0xffff) ^ CRC16_TABLE[(remainder >> 8) ^ value]
     return remainder
 
 
@@ -102,13 +127,36 @@ class PacketSink(ABC):
         pass
 
 
+def encode_varint(value):
+    result = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        result.append(byte | (0x80 if value else 0x00))
+        if not value:
+            return result
+
+def decode_varint(data):
+    value = 0
+    for i, byte in enumerate(data):
+        value |= (byte & 0x7f) << (7 * i)
+    return value
+
+
 class StreamToPacketSegmenter(StreamSink):
     def __init__(self, output):
         self._header = []
+        self._header_length = 0 # 0 until the length field is complete
         self._packet = []
         self._packet_length = 0
         self._output = output
 
+    def _reset(self):
+        self._header = []
+        self._header_length = 0
+        self._packet = []
+        self._packet_length = 0
+
     def process_bytes(self, bytes):
         """
         Processes an arbitrary number of bytes. If one or more full packets are
@@ -117,28 +165,31 @@ class StreamToPacketSegmenter(StreamSink):
         """
 
         for byte in bytes:
-            if (len(self._header) < 3):
+            if (self._header_length == 0) or (len(self._header) < self._header_length):
                 # Process header byte
                 self._header.append(byte)
-                if (len(self._header) == 1) and (self._header[0] != SYNC_BYTE):
-                    self._header = []
-                elif (len(self._header) == 2) and (self._header[1] & 0x80):
-                    self._header = [] # TODO: support packets larger than 128 bytes
-                elif (len(self._header) == 3) and calc_crc8(CRC8_INIT, self._header):
-                    self._header = []
-                elif (len(self._header) == 3):
-                    self._packet_length = self._header[1] + 2
+                if (len(self._header) == 1):
+                    if (self._header[0] != SYNC_BYTE):
+                        self._reset()
+                elif (self._header_length == 0):
+                    # Length field (varint)
+                    if not (byte & 0x80):
+                        self._header_length = len(self._header) + 1
+                    elif (len(self._header) - 1 >= MAX_FRAME_LENGTH_BYTES):
+                        self._reset()
+                elif calc_crc8(CRC8_INIT, self._header):
+                    self._reset()
+                else:
+                    self._packet_length = decode_varint(self._header[1:-1]) + 2
             else:
                 # Process payload byte
                 self._packet.append(byte)
 
             # If both header and packet are fully received, hand it on to the packet processor
-            if (len(self._header) == 3) and (len(self._packet) == self._packet_length):
+            if (self._header_length != 0) and (len(self._header) == self._header_length) and (len(self._packet) == self._packet_length):
                 if calc_crc16(CRC16_INIT, self._packet) == 0:
                     self._output.process_packet(self._packet[:-2])
-                self._header = []
-                self._packet = []
-                self._packet_length = 0
+                self._reset()
 
 
 class StreamBasedPacketSink(PacketSink):
@@ -146,12 +197,12 @@ class StreamBasedPacketSink(PacketSink):
         self._output = output
 
     def process_packet(self, packet):
-        if (len(packet) >= MAX_PACKET_SIZE):
-            raise NotImplementedError("packet larger than 127 currently not supported")
+        if (len(packet) >= (1 << (7 * MAX_FRAME_LENGTH_BYTES))):
+            raise NotImplementedError("packet too large")
 
         header = bytearray()
         header.append(SYNC_BYTE)
-        header.append(len(packet))
+        header += encode_varint(len(packet))
         header.append(calc_crc8(CRC8_INIT, header))
 
         self._output.process_bytes(header)
@@ -180,17 +231,20 @@ class PacketFromStreamConverter(PacketSource):
                 #print("sync byte mismatch")
                 continue
 
+            # Length field (varint)
             header = header + self._input.get_bytes_or_fail(1, deadline)
-            if (header[1] & 0x80):
-                #print("packet too large")
-                continue # TODO: support packets larger than 128 bytes
+            while (header[-1] & 0x80) and (len(header) - 1 < MAX_FRAME_LENGTH_BYTES):
+                header = header + self._input.get_bytes_or_fail(1, deadline)
+            if (header[-1] & 0x80):
+                #print("length field too long")
+                continue
 
             header = header + self._input.get_bytes_or_fail(1, deadline)
             if calc_crc8(CRC8_INIT, header) != 0:
                 #print("crc8 mismatch")
                 continue
 
-            packet_length = header[1] + 2
+            packet_length = decode_varint(header[1:-1]) + 2
             #print("wait for {} bytes".format(packet_length))
             packet = self._input.get_bytes_or_fail(packet_length, deadline)
             if calc_crc16(CRC16_INIT, packet) != 0:
@@ -199,25 +253,78 @@ class PacketFromStreamConverter(PacketSource):
             return packet[:-2]
 
 
+class MultidropPacketSink(PacketSink):
+    """
+    Prepends the node address to every packet for devices on a multi-drop
+    (RS-485) bus. Packets to MULTIDROP_BROADCAST_ADDRESS are executed by all
+    devices but never answered.
+    """
+    def __init__(self, output, address):
+        self._output = output
+        self._address = address
+
+    def process_packet(self, packet):
+        self._output.process_packet(bytes([self._address]) + bytes(packet))
+
+class MultidropPacketSource(PacketSource):
+    """
+    Returns only the responses of the device with the given address on a
+    multi-drop bus and strips the address byte.
+    """
+    def __init__(self, input, address):
+        self._input = input
+        self._address = address
+
+    def get_packet(self, deadline):
+        while True:
+            packet = self._input.get_packet(deadline)
+            if packet is None:
+                return None
+            if len(packet) >= 1 and packet[0] == (self._address | MULTIDROP_RESPONSE_FLAG):
+                return packet[1:]
+
+
+class _PendingRequest():
+    def __init__(self, seq_no, packet):
+        self.seq_no = seq_no
+        self.packet = packet
+        self.ack_event = Event()
+        self.attempts = 0
+        self.deadline = 0
+        self.fast_resent = False
+
+
 class Channel(PacketSink):
     # Choose these parameters to be sensible for a specific transport layer
     _resend_timeout = 5.0     # [s]
     _send_attempts = 5
 
-    def __init__(self, name, input, output, cancellation_token, logger):
+    def __init__(self, name, input, output, cancellation_token, logger, broadcast_output=None):
         """
         Params:
         input: A PacketSource where this channel will source packets from on
                demand. Alternatively packets can be provided to this channel
                directly by calling process_packet on this instance.
         output: A PacketSink where this channel will put outgoing packets.
+        broadcast_output: On a multi-drop bus, a PacketSink that reaches all
+               devices (see remote_endpoint_broadcast).
         """
         self._name = name
         self._input = input
         self._output = output
+        self._broadcast_output = broadcast_output
         self._logger = logger
-        self._outbound_seq_no = 0
+        # Start at a random sequence number so that a device which still
+        # remembers the requests of a previous session doesn't mistake the
+        # first requests of this session for retransmissions.
+        self._outbound_seq_no = random.getrandbits(15)
         self._interface_definition_crc = 0
+        self._max_tx_packet_length = MAX_PACKET_SIZE - 1 # until negotiated
+        self._max_rx_packet_length = MAX_RX_PACKET_LENGTH
+        self._max_response_length = 30 # until negotiated
+        self._window_size = 1 # until negotiated
+        self._batch_supported = None # unknown until the first batch request
+        self._telemetry_callback = None
         self._expected_acks = {}
         self._responses = {}
         self._my_lock = threading.Lock()
@@ -258,11 +365,11 @@ class Channel(PacketSink):
         t.daemon = True
         t.start()
 
-    def remote_endpoint_operation(self, endpoint_id, input, expect_ack, output_length):
+    def _make_request(self, endpoint_id, input, expect_ack, output_length):
         if input is None:
             input = bytearray(0)
-        if (len(input) >= 128):
-            raise Exception("packet larger than 127 currently not supported")
+        if (len(input) + 8 > self._max_tx_packet_length):
+            raise Exception("packet larger than {} bytes not supported by the device".format(self._max_tx_packet_length))
 
         if (expect_ack):
             endpoint_id |= 0x8000
@@ -277,62 +384,272 @@ class Channel(PacketSink):
         packet = struct.pack('<HHH', seq_no, endpoint_id, output_length)
         packet = packet + input
 
-        crc16 = calc_crc16(CRC16_INIT, packet)
         if (endpoint_id & 0x7fff == 0):
             trailer = PROTOCOL_VERSION
         else:
             trailer = self._interface_definition_crc
         #print("append trailer " + trailer)
         packet = packet + struct.pack('<H', trailer)
+        return seq_no, packet
 
+    def remote_endpoint_operation(self, endpoint_id, input, expect_ack, output_length):
         if (expect_ack):
-            ack_event = Event()
-            self._expected_acks[seq_no] = ack_event
-            try:
-                attempt = 0
-                while (attempt < self._send_attempts):
-                    self._my_lock.acquire()
-                    try:
-                        self._output.process_packet(packet)
-                    except ChannelDamagedException:
-                        attempt += 1
-                        continue # resend
-                    except TimeoutError:
-                        attempt += 1
-                        continue # resend
-                    finally:
-                        self._my_lock.release()
-                    # Wait for ACK until the resend timeout is exceeded
-                    try:
-                        if wait_any(self._resend_timeout, ack_event, self._channel_broken) != 0:
-                            raise ChannelBrokenException()
-                    except TimeoutError:
-                        attempt += 1
-                        continue # resend
-                    return self._responses.pop(seq_no)
-                    # TODO: record channel statistics
-                raise ChannelBrokenException() # Too many resend attempts
-            finally:
-                self._expected_acks.pop(seq_no)
-                self._responses.pop(seq_no, None)
+            return self.remote_endpoint_operations([(endpoint_id, input, output_length)])[0]
         else:
             # fire and forget
+            seq_no, packet = self._make_request(endpoint_id, input, False, output_length)
             self._output.process_packet(packet)
             return None
-    
-    def remote_endpoint_read_buffer(self, endpoint_id):
+
+    def remote_endpoint_broadcast(self, endpoint_id, input):
+        """
+        Sends a write to all devices on the multi-drop bus of this channel.
+        The devices execute it at the same time but don't answer, so it is
+        sent without the expect-response flag and nothing confirms that it
+        arrived. All devices must have the same interface definition as the
+        device of this channel.
+        """
+        if self._broadcast_output is None:
+            raise Exception("broadcasts are only available on multi-drop channels")
+        if len(input) + 8 > MAX_PACKET_SIZE - 1:
+            raise Exception("broadcasts are limited to the default packet size")
+        seq_no, packet = self._make_request(endpoint_id, input, False, 0)
+        self._broadcast_output.process_packet(packet)
+
+    def remote_endpoint_operations(self, operations):
+        """
+        Runs several endpoint operations and returns the output of each.
+        operations: list of (endpoint_id, input, output_length) tuples
+
+        Up to _window_size requests are in flight at the same time. The window
+        only advances once the oldest request was answered. A request is
+        resent on its own if its response doesn't arrive within the resend
+        timeout or if a later request was already answered (the device
+        answers in order). The operations should therefore be independent
+        of each other.
+        """
+        results = [None] * len(operations)
+        in_flight = {} # index => _PendingRequest
+        next_index = 0
+        base_index = 0
+
+        try:
+            while base_index < len(operations):
+                # Fill the window
+                while next_index < len(operations) and next_index < base_index + self._window_size:
+                    endpoint_id, input, output_length = operations[next_index]
+                    seq_no, packet = self._make_request(endpoint_id, input, True, output_length)
+                    request = _PendingRequest(seq_no, packet)
+                    self._expected_acks[seq_no] = request.ack_event
+                    in_flight[next_index] = request
+                    self._send_request(request)
+                    next_index += 1
+
+                # Wait for the oldest request or for any later request
+                oldest = in_flight[base_index]
+                later = [r.ack_event for i, r in in_flight.items() if i != base_index and not r.ack_event.is_set()]
+                try:
+                    if wait_any(max(oldest.deadline - time.monotonic(), 0), self._channel_broken, oldest.ack_event, *later) == 0:
+                        raise ChannelBrokenException()
+                except TimeoutError:
+                    # Resend all requests that timed out
+                    for request in in_flight.values():
+                        if not request.ack_event.is_set() and request.deadline <= time.monotonic():
+                            self._send_request(request)
+                    continue
+
+                if not oldest.ack_event.is_set():
+                    # A later request overtook the oldest one, so the oldest
+                    # request or its response was probably lost
+                    if not oldest.fast_resent:
+                        self._send_request(oldest)
+                        oldest.fast_resent = True
+                    continue
+
+                # Advance the window past all answered requests
+                while base_index < next_index and in_flight[base_index].ack_event.is_set():
+                    request = in_flight.pop(base_index)
+                    self._expected_acks.pop(request.seq_no)
+                    results[base_index] = self._responses.pop(request.seq_no)
+                    base_index += 1
+        finally:
+            for request in in_flight.values():
+                self._expected_acks.pop(request.seq_no, None)
+                self._responses.pop(request.seq_no, None)
+
+        return results
+
+    def _send_request(self, request):
+        if request.attempts >= self._send_attempts:
+            raise ChannelBrokenException() # Too many resend attempts
+        request.attempts += 1
+        request.fast_resent = False
+        request.deadline = time.monotonic() + self._resend_timeout
+        self._my_lock.acquire()
+        try:
+            self._output.process_packet(request.packet)
+        except ChannelDamagedException:
+            request.deadline = 0 # resend
+        except TimeoutError:
+            request.deadline = 0 # resend
+        finally:
+            self._my_lock.release()
+
+    def negotiate_window(self):
+        """
+        Asks the device to answer retransmitted requests without executing
+        them again. This allows several requests to be in flight at the same
+        time. Devices that don't support this keep working with one request
+        at a time.
+        """
+        response = self.remote_endpoint_operation(0, struct.pack("<IB", ENDPOINT0_NEGOTIATE_WINDOW, MAX_WINDOW_SIZE), True, 1)
+        if len(response) >= 1 and response[0] >= 1:
+            self._window_size = response[0]
+            self._logger.debug("negotiated window of {} requests".format(self._window_size))
+        else:
+            self._logger.debug("device doesn't support windowed requests")
+
+    def negotiate_packet_size(self):
+        """
+        Asks the device for larger packets than the default of 127 bytes.
+        Devices that don't support this keep working with small packets.
+        """
+        response = self.remote_endpoint_operation(0, struct.pack("<II", ENDPOINT0_NEGOTIATE_PACKET_SIZE, MAX_RX_PACKET_LENGTH), True, 8)
+        if len(response) >= 8:
+            device_max_rx, device_max_tx = struct.unpack("<II", response[:8])
+            self._max_tx_packet_length = device_max_rx
+            self._max_response_length = device_max_tx - 2
+            self._logger.debug("negotiated packet sizes: {} bytes to device, {} bytes from device".format(device_max_rx, device_max_tx))
+        else:
+            self._logger.debug("device doesn't support packet size negotiation")
+
+    def remote_endpoint_batch(self, operations):
+        """
+        Runs several endpoint operations with as few requests as possible.
+        operations: list of (endpoint_id, input, output_length) tuples
+        Returns a list with the output of each operation.
+        On devices without batch support each operation is sent separately.
+        """
+        results = []
+        while len(results) < len(operations):
+            pending = operations[len(results):]
+
+            # Take as many operations as fit into one request and one response
+            request = struct.pack("<IH", ENDPOINT0_BATCH, self._interface_definition_crc)
+            response_length = 0
+            n_entries = 0
+            for (endpoint_id, input, output_length) in pending:
+                input = input or bytes()
+                if (len(input) > 255 or output_length > 255
+                        or len(request) + 4 + len(input) + 8 > self._max_tx_packet_length
+                        or response_length + 1 + output_length > self._max_response_length):
+                    break
+                request += struct.pack("<HBB", endpoint_id, len(input), output_length) + input
+                response_length += 1 + output_length
+                n_entries += 1
+
+            if n_entries == 0 or self._batch_supported == False:
+                (endpoint_id, input, output_length) = pending[0]
+                results.append(self.remote_endpoint_operation(endpoint_id, input, True, output_length))
+                continue
+
+            response = self.remote_endpoint_operation(0, request, True, response_length)
+            if len(response) == 0:
+                self._logger.debug("device doesn't support batch requests")
+                self._batch_supported = False
+                continue
+            self._batch_supported = True
+
+            # The device stops early if the response is full
+            while len(response) > 0:
+                length = response[0]
+                results.append(response[1:1 + length])
+                response = response[1 + length:]
+
+        return results
+
+    def subscribe(self, endpoint_ids, decimation, callback):
+        """
+        Asks the device to periodically send the values of the specified
+        endpoints. All values of one sample are taken in the same control loop
+        iteration.
+        decimation: Sample every n-th control loop iteration.
+        callback: Called on the receiver thread for each sample with the
+                  arguments (timestamp, payload) where timestamp is the
+                  timestamp of the control loop iteration (the same time base
+                  as last_update_timestamp) and payload holds the concatenated
+                  values.
+        Returns the length of each value.
+        """
+        self._telemetry_callback = callback
+        request = struct.pack("<IHI", ENDPOINT0_SUBSCRIBE, self._interface_definition_crc, decimation)
+        request += b''.join(struct.pack("<H", endpoint_id) for endpoint_id in endpoint_ids)
+        response = self.remote_endpoint_operation(0, request, True, len(endpoint_ids))
+        if len(response) != len(endpoint_ids):
+            self._telemetry_callback = None
+            raise Exception("the device rejected the subscription or doesn't support telemetry")
+        return list(response)
+
+    def remote_transaction(self, writes):
+        """
+        Writes several properties such that the device applies all of them at
+        the start of the same control loop iteration.
+        writes: list of (endpoint_id, input) tuples
+        Transactions that don't fit into one request are staged over several
+        requests. While the device is busy (another channel has a transaction
+        open or the previous commit wasn't applied yet) the transaction is
+        retried.
+        """
+        header = struct.pack("<IHB", ENDPOINT0_TRANSACTION, self._interface_definition_crc, 0)
+        requests = [b'']
+        for (endpoint_id, input) in writes:
+            entry = struct.pack("<HB", endpoint_id, len(input)) + input
+            if len(requests[-1]) and len(header) + len(requests[-1]) + len(entry) + 8 > self._max_tx_packet_length:
+                requests.append(b'')
+            requests[-1] += entry
+
+        for attempt in range(TRANSACTION_ATTEMPTS):
+            for (i, entries) in enumerate(requests):
+                flags = (TRANSACTION_BEGIN if i == 0 else 0) | (TRANSACTION_COMMIT if i == len(requests) - 1 else 0)
+                request = struct.pack("<IHB", ENDPOINT0_TRANSACTION, self._interface_definition_crc, flags) + entries
+                response = self.remote_endpoint_operation(0, request, True, 1)
+                if len(response) < 1:
+                    raise Exception("the device doesn't support transactions")
+                status = response[0]
+                if status != TRANSACTION_OK:
+                    break
+            if status == TRANSACTION_OK:
+                return
+            if status != TRANSACTION_BUSY:
+                raise Exception("the device rejected the transaction")
+            time.sleep(0.001)
+        raise Exception("the device was busy for too long")
+
+    def unsubscribe(self):
+        self.remote_endpoint_operation(0, struct.pack("<IHI", ENDPOINT0_SUBSCRIBE, self._interface_definition_crc, 0), True, 0)
+        self._telemetry_callback = None
+
+    def remote_endpoint_read_buffer(self, endpoint_id, prefix=b''):
         """
         Handles reads from long endpoints
+        prefix: Sent in front of the offset in each request
         """
         # TODO: handle device that could (maliciously) send infinite stream
         buffer = bytes()
+        chunk_length = self._max_rx_packet_length - 2
         while True:
-            chunk_length = 512
-            chunk = self.remote_endpoint_operation(endpoint_id, struct.pack("<I", len(buffer)), True, chunk_length)
-            if (len(chunk) == 0):
-                break
-            buffer += chunk
-        return buffer
+            # Read ahead as many chunks as fit into the window
+            operations = [(endpoint_id, prefix + struct.pack("<I", len(buffer) + i * chunk_length), chunk_length)
+                          for i in range(self._window_size)]
+            for chunk in self.remote_endpoint_operations(operations):
+                if (len(chunk) == 0):
+                    return buffer
+                buffer += chunk
+                if (len(chunk) < chunk_length):
+                    # The device sent less than requested so the following
+                    # chunks were read at the wrong offset
+                    chunk_length = len(chunk)
+                    break
 
     def process_packet(self, packet):
         #print("process packet")
@@ -342,7 +659,12 @@ class Channel(PacketSink):
 
         seq_no = struct.unpack('<H', packet[0:2])[0]
 
-        if (seq_no & 0x8000):
+        if (seq_no == TELEMETRY_SEQ_NO):
+            callback = self._telemetry_callback
+            if callback and len(packet) >= 6:
+                callback(struct.unpack('<I', packet[2:6])[0], packet[6:])
+
+        elif (seq_no & 0x8000):
             seq_no &= 0x7fff
             ack_signal = self._expected_acks.get(seq_no, None)
             if (ack_signal):
@@ -214,6 +214,97 @@ class RemoteObject(object):
         self.__sealed__ = True
         channel._channel_broken.subscribe(self._tear_down)
 
+    def _get_property(self, path):
+        obj = self
+        names = path.split('.')
+        for name in names[:-1]:
+            obj = obj._remote_attributes.get(name, None)
+            if not isinstance(obj, RemoteObject):
+                raise AttributeError("Object {} not found".format(name))
+        attr = obj._remote_attributes.get(names[-1], None)
+        if not isinstance(attr, RemoteProperty):
+            raise AttributeError("Property {} not found".format(path))
+        return attr
+
+    def _get_values(self, *paths):
+        """
+        Reads several properties with a single request, e.g.
+        odrv0._get_values('vbus_voltage', 'axis0.encoder.pos_estimate')
+        """
+        props = [self._get_property(path) for path in paths]
+        for prop in props:
+            if not prop._can_read:
+                raise Exception("Cannot read from property {}".format(prop._name))
+        outputs = self.__channel__.remote_endpoint_batch(
+            [(prop._id, None, prop._codec.get_length()) for prop in props])
+        return [prop._codec.deserialize(output) for (prop, output) in zip(props, outputs)]
+
+    def _set_values(self, values):
+        """
+        Writes several properties with a single request, e.g.
+        odrv0._set_values({'axis0.controller.input_pos': 1.0, 'axis1.controller.input_pos': 2.0})
+        The writes are executed in the given order.
+        """
+        props = [(self._get_property(path), value) for (path, value) in values.items()]
+        for (prop, value) in props:
+            if not prop._can_write:
+                raise Exception("Cannot write to property {}".format(prop._name))
+        self.__channel__.remote_endpoint_batch(
+            [(prop._id, prop._codec.serialize(value), 0) for (prop, value) in props])
+
+    def _broadcast(self, values):
+        """
+        Writes properties on all devices of a multi-drop bus at once, e.g.
+        odrv0._broadcast({'axis0.controller.input_pos': 1.0})
+        The paths are resolved on this device, so all devices must run the
+        same firmware. Broadcasts are not acknowledged. Each property is sent
+        in its own request.
+        """
+        props = [(self._get_property(path), value) for (path, value) in values.items()]
+        for (prop, value) in props:
+            if not prop._can_write:
+                raise Exception("Cannot write to property {}".format(prop._name))
+        for (prop, value) in props:
+            self.__channel__.remote_endpoint_broadcast(prop._id, prop._codec.serialize(value))
+
+    def _transaction(self):
+        """
+        Collects property writes and commits them on exit, e.g.
+        with odrv0._transaction() as t:
+            t['axis0.controller.input_pos'] = 1.0
+            t['axis0.controller.input_vel'] = 0.5
+        The device applies all writes at the start of the same control loop
+        iteration. Nothing is written if the block raises an exception.
+        """
+        return _Transaction(self)
+
+    def _subscribe(self, paths, decimation, callback):
+        """
+        Makes the device send the specified properties periodically, e.g.
+        odrv0._subscribe(['axis0.encoder.pos_estimate', 'axis0.motor.current_control.Iq_measured'], 8, print)
+        calls print(timestamp, [pos_estimate, Iq_measured]) every 8th control
+        loop iteration. The callback runs on the receiver thread.
+        Only one subscription per channel can be active.
+        """
+        props = [self._get_property(path) for path in paths]
+
+        def on_sample(timestamp, payload):
+            values = []
+            for prop in props:
+                length = prop._codec.get_length()
+                values.append(prop._codec.deserialize(payload[:length]))
+                payload = payload[length:]
+            callback(timestamp, values)
+
+        lengths = self.__channel__.subscribe([prop._id for prop in props], decimation, on_sample)
+        for (prop, length) in zip(props, lengths):
+            if length != prop._codec.get_length():
+                self.__channel__.unsubscribe()
+                raise Exception("unexpected value length for {}".format(prop._name))
+
+    def _unsubscribe(self):
+        self.__channel__.unsubscribe()
+
     def _dump(self, indent, depth):
         if depth <= 0:
             return "..."
@@ -262,3 +353,22 @@ class RemoteObject(object):
         for k in self._remote_attributes.keys():
             self.__dict__.pop(k)
         self._remote_attributes = {}
+
+
+class _Transaction():
+    def __init__(self, obj):
+        self._obj = obj
+        self._writes = []
+
+    def __setitem__(self, path, value):
+        prop = self._obj._get_property(path)
+        if not prop._can_write:
+            raise Exception("Cannot write to property {}".format(prop._name))
+        self._writes.append((prop._id, prop._codec.serialize(value)))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None and self._writes:
+            self._obj.__channel__.remote_transaction(self._writes)
@@ -65,9 +65,16 @@ def find_pyserial_ports():
 def discover_channels(path, serial_number, callback, cancellation_token, channel_termination_token, logger):
     """
     Scans for serial ports that match the path spec.
+    A path spec that ends with "#<address>" (e.g. "/dev/ttyUSB0#3") selects
+    the device with that address on a multi-drop (RS-485) bus.
     This function blocks until cancellation_token is set.
     Channels spawned by this function run until channel_termination_token is set.
     """
+    address = None
+    if path != None and '#' in path:
+        path, address = path.rsplit('#', 1)
+        address = int(address)
+
     if path == None:
         # This regex should match all desired port names on macOS,
         # Linux and Windows but might match some incorrect port names.
@@ -94,9 +101,17 @@ def discover_channels(path, serial_number, callback, cancellation_token, channel
                 serial_device = SerialStreamTransport(port_name, DEFAULT_BAUDRATE)
                 input_stream = fibre.protocol.PacketFromStreamConverter(serial_device)
                 output_stream = fibre.protocol.StreamBasedPacketSink(serial_device)
+                broadcast_stream = None
+                name = "serial port {}@{}".format(port_name, DEFAULT_BAUDRATE)
+                if address != None:
+                    input_stream = fibre.protocol.MultidropPacketSource(input_stream, address)
+                    broadcast_stream = fibre.protocol.MultidropPacketSink(output_stream, fibre.protocol.MULTIDROP_BROADCAST_ADDRESS)
+                    output_stream = fibre.protocol.MultidropPacketSink(output_stream, address)
+                    name += " node {}".format(address)
                 channel = fibre.protocol.Channel(
-                        "serial port {}@{}".format(port_name, DEFAULT_BAUDRATE),
-                        input_stream, output_stream, channel_termination_token, logger)
+                        name,
+                        input_stream, output_stream, channel_termination_token, logger,
+                        broadcast_output=broadcast_stream)
                 channel.serial_device = serial_device
             except serial.serialutil.SerialException:
                 logger.debug("Serial device init failed. Ignoring this port. More info: " + traceback.format_exc())
@@ -122,7 +122,8 @@ class USBBulkTransport(fibre.protocol.PacketSource, fibre.protocol.PacketSink):
 
   def get_packet(self, deadline):
     try:
-      bufferLen = self.epr.wMaxPacketSize
+      # The device may send a packet as multi-packet transfer
+      bufferLen = max(self.epr.wMaxPacketSize, fibre.protocol.MAX_RX_PACKET_LENGTH)
       timeout = max(int((deadline - time.monotonic()) * 1000), 0)
       ret = self.epr.read(bufferLen, timeout)
       if self._was_damaged:
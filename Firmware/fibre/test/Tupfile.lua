@@ -8,6 +8,11 @@ test_server = define_package{
     sources={'test_server.cpp'}
 }
 
+loopback_benchmark = define_package{
+    packages={fibre_package},
+    sources={'loopback_benchmark.cpp'}
+}
+
 unit_tests = define_package{
     packages={fibre_package},
     sources={'run_tests.cpp'}
@@ -23,5 +28,6 @@ toolchain=GCCToolchain('', 'build', {'-O3', '-g', '-Wall'}, {})
 
 if tup.getconfig("BUILD_FIBRE_TESTS") == "true" then
 	build_executable('test_server', test_server, toolchain)
+	build_executable('loopback_benchmark', loopback_benchmark, toolchain)
 	--build_executable('run_tests', unit_tests, toolchain)
 end
@@ -0,0 +1,232 @@
+/*
+ * Measures the throughput and latency of the POSIX TCP and UDP servers over
+ * the loopback interface with many concurrent clients.
+ *
+ * Usage: loopback_benchmark [n_clients] [n_requests_per_client]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <fibre/protocol.hpp>
+#include <fibre/posix_reactor.hpp>
+#include <fibre/posix_tcp.hpp>
+#include <fibre/posix_udp.hpp>
+
+#define BENCHMARK_PORT	9911
+
+// Minimal stand-ins for the symbols that are normally autogenerated. Endpoint
+// 1 is a uint32 property.
+const unsigned char fibre::embedded_json[] = "[{\"name\":\"property1\",\"id\":1,\"type\":\"uint32\",\"access\":\"rw\"}]";
+const size_t fibre::embedded_json_length = sizeof(fibre::embedded_json) - 1;
+const unsigned char fibre::embedded_json_compressed[] = {0};
+const size_t fibre::embedded_json_compressed_length = 0;
+const uint16_t fibre::json_crc_ = 0x1234;
+const uint32_t fibre::json_version_id_ = 0x12345678;
+
+static uint32_t property1 = 0;
+
+bool fibre::endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    if (idx == 0) {
+        return endpoint0_handler(input_buffer, output_buffer);
+    } else if (idx == 1) {
+        uint32_t old_value = property1;
+        std::optional<uint32_t> new_value = read_le<uint32_t>(input_buffer);
+        if (new_value.has_value())
+            property1 = *new_value;
+        return write_le<uint32_t>(old_value, output_buffer);
+    }
+    return false;
+}
+
+bool fibre::is_endpoint_ref_valid(endpoint_ref_t endpoint_ref) {
+    return endpoint_ref.json_crc == json_crc_ && endpoint_ref.endpoint_id <= 1;
+}
+
+bool fibre::is_property_endpoint(int idx) {
+    return idx == 1;
+}
+
+bool fibre::is_transactional_endpoint(int idx) {
+    return idx == 1;
+}
+
+bool fibre::set_endpoint_from_float(endpoint_ref_t endpoint_ref, float value) {
+    return false;
+}
+
+// Request to read endpoint 1
+static std::vector<uint8_t> make_request(uint16_t seq_no) {
+    std::vector<uint8_t> packet(8);
+    write_le<uint16_t>(seq_no, packet.data());
+    write_le<uint16_t>(1 | 0x8000, packet.data() + 2);
+    write_le<uint16_t>(4, packet.data() + 4);
+    write_le<uint16_t>(fibre::json_crc_, packet.data() + 6);
+    return packet;
+}
+
+class ByteCollector : public StreamSink {
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override {
+        bytes.insert(bytes.end(), buffer, buffer + length);
+        return 0;
+    }
+    size_t get_free_space() override { return SIZE_MAX; }
+    std::vector<uint8_t> bytes;
+};
+
+class PacketCounter : public PacketSink {
+public:
+    int process_packet(const uint8_t* buffer, size_t length) override {
+        n_packets++;
+        return 0;
+    }
+    size_t n_packets = 0;
+};
+
+static int connect_to_server(int type) {
+    int s = socket(AF_INET6, type, 0);
+    struct sockaddr_in6 si_server = {};
+    si_server.sin6_family = AF_INET6;
+    si_server.sin6_port = htons(BENCHMARK_PORT);
+    si_server.sin6_addr = in6addr_loopback;
+    if (connect(s, reinterpret_cast<struct sockaddr *>(&si_server), sizeof(si_server)) == -1) {
+        close(s);
+        return -1;
+    }
+    int one = 1;
+    if (type == SOCK_STREAM)
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {1, 0};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return s;
+}
+
+// Sends one request at a time and records the round trip time of each
+static bool run_tcp_client(size_t n_requests, std::vector<double>* latencies) {
+    int s = connect_to_server(SOCK_STREAM);
+    if (s == -1)
+        return false;
+
+    uint8_t rx_buf[64];
+    PacketCounter responses;
+    StreamToPacketSegmenter segmenter(responses, rx_buf, sizeof(rx_buf));
+
+    for (size_t i = 0; i < n_requests; ++i) {
+        ByteCollector frame;
+        StreamBasedPacketSink framer(frame);
+        std::vector<uint8_t> request = make_request(0x80 | (i & 0x7f));
+        framer.process_packet(request.data(), request.size());
+
+        auto start = std::chrono::steady_clock::now();
+        if (send(s, frame.bytes.data(), frame.bytes.size(), 0) != (ssize_t)frame.bytes.size())
+            break;
+        while (responses.n_packets <= i) {
+            uint8_t buf[64];
+            ssize_t n_received = recv(s, buf, sizeof(buf), 0);
+            if (n_received <= 0) {
+                close(s);
+                return false;
+            }
+            segmenter.process_bytes(buf, n_received, nullptr);
+        }
+        latencies->push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    close(s);
+    return latencies->size() == n_requests;
+}
+
+static bool run_udp_client(size_t n_requests, std::vector<double>* latencies) {
+    int s = connect_to_server(SOCK_DGRAM);
+    if (s == -1)
+        return false;
+
+    // UDP is lossy, resend the request if no response arrives in time
+    struct timeval timeout = {0, 100000};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (size_t i = 0; i < n_requests; ++i) {
+        uint16_t seq_no = 0x80 | (i & 0x7f);
+        std::vector<uint8_t> request = make_request(seq_no);
+        auto start = std::chrono::steady_clock::now();
+        bool received = false;
+        for (size_t attempt = 0; attempt < 10 && !received; ++attempt) {
+            if (send(s, request.data(), request.size(), 0) != (ssize_t)request.size())
+                break;
+            uint8_t buf[64];
+            // Discard late responses to earlier requests
+            ssize_t n_received;
+            while ((n_received = recv(s, buf, sizeof(buf), 0)) >= 2) {
+                if (buf[0] == (seq_no & 0xff) && buf[1] == ((seq_no | 0x8000) >> 8)) {
+                    received = true;
+                    break;
+                }
+            }
+        }
+        if (!received)
+            break;
+        latencies->push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    close(s);
+    return latencies->size() == n_requests;
+}
+
+template<typename TFn>
+static bool run_benchmark(const char* name, TFn client, size_t n_clients, size_t n_requests) {
+    std::vector<std::vector<double>> latencies(n_clients);
+    std::vector<std::thread> threads;
+    std::vector<char> success(n_clients);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n_clients; ++i) {
+        threads.emplace_back([&, i]() { success[i] = client(n_requests, &latencies[i]); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto& l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    size_t n_failed = std::count(success.begin(), success.end(), 0);
+
+    if (all.empty()) {
+        printf("%s: no responses\n", name);
+        return false;
+    }
+    printf("%s: %zu clients, %.0f requests/s, latency median %.1f us, p99 %.1f us, %zu clients failed\n",
+           name, n_clients, all.size() / duration, all[all.size() / 2], all[all.size() * 99 / 100], n_failed);
+    return n_failed == 0;
+}
+
+int main(int argc, const char** argv) {
+    size_t n_clients = argc > 1 ? atoi(argv[1]) : 32;
+    size_t n_requests = argc > 2 ? atoi(argv[2]) : 2000;
+
+    PosixReactor reactor;
+    if (reactor.init() || serve_on_tcp(reactor, BENCHMARK_PORT) || serve_on_udp(reactor, BENCHMARK_PORT)) {
+        printf("failed to start server\n");
+        return -1;
+    }
+    std::thread server_thread([&reactor]() { reactor.run(); });
+
+    bool success = run_benchmark("TCP", run_tcp_client, n_clients, n_requests)
+                && run_benchmark("UDP", run_udp_client, n_clients, n_requests);
+
+    reactor.stop();
+    server_thread.join();
+    return success ? 0 : -1;
+}
@@ -5,6 +5,7 @@
 #include <signal.h>
 
 #include <fibre/protocol.hpp>
+#include <fibre/posix_reactor.hpp>
 #include <fibre/posix_tcp.hpp>
 #include <fibre/posix_udp.hpp>
 
@@ -37,9 +38,13 @@ int main() {
     auto definitions = test_object.fibre_definitions;
     fibre_publish(definitions);
 
-    // Expose Fibre objects on TCP and UDP
-    std::thread server_thread_tcp(serve_on_tcp, 9910);
-    std::thread server_thread_udp(serve_on_udp, 9910);
+    // Expose Fibre objects on TCP and UDP. Both are served by a single thread.
+    PosixReactor reactor;
+    if (reactor.init() || serve_on_tcp(reactor, 9910) || serve_on_udp(reactor, 9910)) {
+        printf("Failed to start Fibre server.\n");
+        return -1;
+    }
+    std::thread server_thread([&reactor]() { reactor.run(); });
     printf("Fibre server started.\n");
 
     // Dump property1 value
@@ -7,6 +7,7 @@ import jsonschema
 import re
 import argparse
 import sys
+import zlib
 from collections import OrderedDict
 
 # This schema describes what we expect interface definition files to look like
@@ -463,6 +464,9 @@ def generate_endpoint_for_property(prop, attr_bindto, idx):
         'type': map_to_fibre01_type(prop['type'].value_type),
         'access': 'r' if prop['type'].mode == 'readonly' else 'rw',
     }
+    # Transactions are applied in the control loop interrupt, so they can only
+    # write plain fields and setters that are marked as safe for that.
+    endpoint['transactional'] = prop['type'].mode != 'readonly' and (not 'c_setter' in prop or prop.get('transactional', False))
     return endpoint, endpoint_definition
 
 def generate_endpoint_table(intf, bindto, idx):
@@ -637,11 +641,27 @@ if args.generate_endpoints:
     endpoints, embedded_endpoint_definitions, _ = generate_endpoint_table(interfaces[args.generate_endpoints], '&ep_root', 1) # TODO: make user-configurable
     embedded_endpoint_definitions = [{'name': '', 'id': 0, 'type': 'json', 'access': 'r'}] + embedded_endpoint_definitions
     endpoints = [{'id': 0, 'function': {'fullname': 'endpoint0_handler', 'in': {}, 'out': {}}, 'bindings': {}}] + endpoints
+    # The endpoint table in endpoints_template.j2 is indexed by endpoint ID
+    assert [ep['id'] for ep in endpoints] == list(range(len(endpoints)))
 else:
     embedded_endpoint_definitions = None
     endpoints = None
 
 
+def calc_crc16(remainder, data, polynomial=0x3d65):
+    """
+    Calculates the CRC16 that is used by the fibre protocol (see crc.hpp).
+    """
+    for byte in data:
+        remainder ^= byte << 8
+        for _ in range(8):
+            if remainder & 0x8000:
+                remainder = ((remainder << 1) ^ polynomial) & 0xffff
+            else:
+                remainder = (remainder << 1) & 0xffff
+    return remainder
+
+
 # Render template
 
 env = jinja2.Environment(
@@ -701,7 +721,12 @@ env.filters['to_snake_case'] = to_snake_case
 env.filters['to_kebab_case'] = to_kebab_case
 env.filters['first'] = lambda x: next(iter(x))
 env.filters['skip_first'] = lambda x: list(x)[1:]
-env.filters['to_c_string'] = lambda x: '\n'.join(('"' + line.replace('"', '\\"') + '"') for line in json.dumps(x, separators=(',', ':')).replace('{"name"', '\n{"name"').split('\n'))
+env.filters['to_c_string'] = lambda x: '\n'.join(('"' + line.replace('\\', '\\\\').replace('"', '\\"') + '"') for line in json.dumps(x, separators=(',', ':')).replace('{"name"', '\n{"name"').split('\n'))
+env.filters['to_json'] = lambda x: json.dumps(x, separators=(',', ':'))
+env.filters['crc16'] = lambda x, init: calc_crc16(init, x.encode('utf-8'))
+env.filters['to_hex'] = lambda x: '0x{:x}'.format(x)
+env.filters['zlib_compress'] = lambda x: zlib.compress(x.encode('utf-8'), 9)
+env.filters['to_c_bytes'] = lambda x: ',\n    '.join(', '.join('0x{:02x}'.format(b) for b in x[i:i+16]) for i in range(0, len(x), 16))
 env.filters['tokenize'] = tokenize
 env.filters['diagonalize'] = lambda lst: [lst[:i + 1] for i in range(len(lst))]
 env.filters['debug'] = lambda x: print(x)
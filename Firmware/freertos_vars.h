@@ -7,8 +7,10 @@
 // List of semaphores
 extern osSemaphoreId sem_usb_irq;
 extern osSemaphoreId sem_uart_dma;
+extern osSemaphoreId sem_uart_rx;
 extern osSemaphoreId sem_usb_rx;
-extern osSemaphoreId sem_usb_tx;
+extern osSemaphoreId sem_usb_tx_cdc;
+extern osSemaphoreId sem_usb_tx_native;
 extern osSemaphoreId sem_can;
 
 extern osThreadId defaultTaskHandle;
@@ -38,6 +38,9 @@ command_set = {
     'reboot': (0x016, []), # tested
     'get_vbus_voltage': (0x017, [('vbus_voltage', 'f', 1)]), # tested
     'clear_errors': (0x018, []), # partially tested
+    # 0x019 not yet implemented
+    'set_scheduled_input_pos': (0x01a, [('timestamp', 'I', 1), ('input_pos', 'f', 1)]), # tested
+    'get_control_loop_timestamp': (0x01b, [('timestamp', 'I', 1), ('increment', 'I', 1)]), # tested
 }
 
 def command(bus, node_id_, extended_id, cmd_name, **kwargs):
@@ -222,6 +225,15 @@ class TestSimpleCAN():
         fence()
         test_assert_eq(axis.controller.config.inertia, 55.086, range=0.0001)
 
+        response = my_req('get_control_loop_timestamp')
+        test_assert_eq(response['increment'], odrive.handle.control_loop_timestamp_increment)
+        axis.controller.input_pos = 0.0
+        my_cmd('set_scheduled_input_pos', timestamp=(response['timestamp'] + 8000 * response['increment']) % 2**32, input_pos=2.5) # about 1s in the future
+        fence()
+        test_assert_eq(axis.controller.input_pos, 0.0, range=0.001)
+        time.sleep(1.2)
+        test_assert_eq(axis.controller.input_pos, 2.5, range=0.001)
+
         # any CAN cmd will feed the watchdog
         test_watchdog(axis, lambda: my_cmd('set_input_torque', input_torque=0.0), logger)
 